@@ -0,0 +1,74 @@
+#include "allocationcounter.h"
+
+#include <stdlib.h>
+#include <atomic>
+
+
+#if defined(LOAM_COUNT_ALLOCATIONS) && defined(__GLIBC__)
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+}
+
+// lock free and constant initialized, counting must not allocate
+static std::atomic<size_t> totalAllocations(0);
+static std::atomic<size_t> totalBytes(0);
+
+static inline void countAllocation(size_t size)
+{
+    totalAllocations.fetch_add(1, std::memory_order_relaxed);
+    totalBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+extern "C" void* malloc(size_t size)
+{
+    countAllocation(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+    countAllocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+    countAllocation(size);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void* ptr)
+{
+    __libc_free(ptr);
+}
+
+bool AllocationCounter::enabled() { return true; }
+size_t AllocationCounter::allocations() { return totalAllocations.load(std::memory_order_relaxed); }
+size_t AllocationCounter::bytes() { return totalBytes.load(std::memory_order_relaxed); }
+
+#else
+
+bool AllocationCounter::enabled() { return false; }
+size_t AllocationCounter::allocations() { return 0; }
+size_t AllocationCounter::bytes() { return 0; }
+
+#endif
+
+
+AllocationScope::AllocationScope(size_t& allocations, size_t& bytes):
+_allocations(allocations),
+_bytes(bytes),
+_startAllocations(AllocationCounter::allocations()),
+_startBytes(AllocationCounter::bytes())
+{
+}
+
+AllocationScope::~AllocationScope()
+{
+    _allocations += AllocationCounter::allocations() - _startAllocations;
+    _bytes += AllocationCounter::bytes() - _startBytes;
+}
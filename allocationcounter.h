@@ -0,0 +1,41 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <stddef.h>
+
+/// Heap allocation counters of the whole process.
+///
+/// Built with LOAM_COUNT_ALLOCATIONS on glibc, malloc(), calloc() and realloc()
+/// are hooked, which covers operator new as well as the Eigen aligned
+/// allocator of the point clouds. Otherwise the counters stay at zero.
+///
+/// The counters are shared by all threads, so they include the thread pool
+/// workers of a stage, but also anything else running at the same time.
+class AllocationCounter
+{
+public:
+    /// Whether allocations are counted in this build.
+    static bool enabled();
+
+    /// Allocations made by all threads so far.
+    static size_t allocations();
+
+    /// Bytes requested by those allocations.
+    static size_t bytes();
+};
+
+/// Adds the allocations made by all threads during its lifetime to the given counters.
+class AllocationScope
+{
+public:
+    AllocationScope(size_t& allocations, size_t& bytes);
+    ~AllocationScope();
+
+private:
+    size_t& _allocations;
+    size_t& _bytes;
+    size_t _startAllocations;
+    size_t _startBytes;
+};
+
+#endif // ALLOCATIONCOUNTER_H
@@ -0,0 +1,83 @@
+// Build time and 5-NN query latency of nanoflann::KdTreeFLANN at the cloud sizes
+// of the odometry and mapping KD-trees.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "benchutil.h"
+#include "loam_velodyne/ThreadPool.h"
+#include "loam_velodyne/nanoflann_pcl.h"
+
+
+namespace {
+
+typedef pcl::PointXYZI PointT;
+
+} // end anonymous namespace
+
+
+
+int main(int argc, char** argv)
+{
+  const size_t threads = argc > 1 ? size_t(std::atoi(argv[1])) : 4;
+  const size_t queryNum = 50000;
+  const int k = 5;
+  loam::ThreadPool pool(threads);
+
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> uniform(-1, 1);
+
+  std::printf("%8s %10s %14s %14s %14s\n", "points", "build ms", "single us", "batched us", "pooled us");
+  const size_t cloudSizes[] = { 2000, 10000, 50000, 200000 };
+  for (const size_t& cloudSize : cloudSizes) {
+    // a street like spread: wide and flat, every third point on the ground
+    pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>());
+    for (size_t i = 0; i < cloudSize; i++) {
+      PointT point;
+      point.x = 50 * uniform(rng);
+      point.y = i % 3 ? 3 * uniform(rng) : -1.8f;
+      point.z = 50 * uniform(rng);
+      cloud->push_back(point);
+    }
+
+    // queries close to the cloud, as after a good initial guess
+    std::vector<PointT, Eigen::aligned_allocator<PointT> > queries(queryNum);
+    for (PointT& query : queries) {
+      query = cloud->points[rng() % cloudSize];
+      query.x += 0.3f * uniform(rng);
+      query.y += 0.3f * uniform(rng);
+      query.z += 0.3f * uniform(rng);
+    }
+
+    double build = 1e30, single = 1e30, batched = 1e30, pooled = 1e30;
+    std::vector<int> indices, batchIndices(queryNum * k);
+    std::vector<float> sqDistances, batchSqDistances(queryNum * k);
+    for (int run = 0; run < 5; run++) {
+      nanoflann::KdTreeFLANN<PointT> kdtree;
+      Clock::time_point start = Clock::now();
+      kdtree.setInputCloud(cloud);
+      build = std::min(build, millisecondsSince(start));
+
+      start = Clock::now();
+      for (const PointT& query : queries) {
+        kdtree.nearestKSearch(query, k, indices, sqDistances);
+      }
+      single = std::min(single, 1e3 * millisecondsSince(start) / queryNum);
+
+      start = Clock::now();
+      kdtree.nearestKSearch(queries.data(), queryNum, k, batchIndices.data(), batchSqDistances.data());
+      batched = std::min(batched, 1e3 * millisecondsSince(start) / queryNum);
+
+      start = Clock::now();
+      kdtree.nearestKSearch(queries.data(), queryNum, k, batchIndices.data(), batchSqDistances.data(), pool);
+      pooled = std::min(pooled, 1e3 * millisecondsSince(start) / queryNum);
+    }
+
+    std::printf("%8zu %10.2f %14.3f %14.3f %14.3f\n", cloudSize, build, single, batched, pooled);
+  }
+  std::printf("%d-NN over %zu queries, best of 5 runs, pooled on %zu threads\n", k, queryNum, threads);
+  return 0;
+}
@@ -0,0 +1,256 @@
+// How the cost of a LaserOdometry frame scales with the number of corner points,
+// against the per query removeNaNFromPointCloud() pass over the last corner cloud
+// that the corner association used to make for every sharp point.
+//
+// Without a log the frames show a street with poles, driven along at 1 m/s. The
+// poles give the corner points, their number grows with the scale while the
+// surfaces stay fixed. With a DSVL log its frames are registered as by the
+// pipeline, without the IMU prior, and reported one by one.
+//
+// Usage: bench_laser_odometry [threads [dsvl [first frame [end frame]]]]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <pcl/filters/filter.h>
+
+#include "benchutil.h"
+#include "dsvlprefetcher.h"
+#include "dsvlreader.h"
+#include "loam_velodyne/LaserOdometry.h"
+#include "loam_velodyne/MultiScanRegistration.h"
+
+
+namespace {
+
+typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+/** \brief The feature clouds of one frame, as the registration hands them to the odometry. */
+struct Frame {
+  Cloud::Ptr cornerPointsSharp;
+  Cloud::Ptr cornerPointsLessSharp;
+  Cloud::Ptr surfacePointsFlat;
+  Cloud::Ptr surfacePointsLessFlat;
+  Cloud::Ptr laserCloud;
+};
+
+const int RING_NUM = 40;
+const int FIRING_NUM = 900;
+
+float ringElevation(const int& ring)
+{
+  return float(M_PI / 180) * (-16 + 23.0f * ring / (RING_NUM - 1));
+}
+
+pcl::PointXYZI makePoint(const float& x, const float& y, const float& z, const int& ring, const float& azimuth)
+{
+  pcl::PointXYZI point;
+  point.x = x;
+  point.y = y;
+  point.z = z;
+  float firing = std::fmod(azimuth / float(2 * M_PI) + 1, 1.0f);
+  point.intensity = ring + 0.1f * firing;
+  return point;
+}
+
+/** \brief One frame seen from (0, 0, sensorZ), in the LOAM camera frame with y up. */
+Frame makeFrame(const std::vector<Eigen::Vector2f>& poles, const float& sensorZ, std::mt19937& rng)
+{
+  std::normal_distribution<float> noise(0, 0.01f);
+  Frame frame;
+  frame.cornerPointsSharp.reset(new Cloud());
+  frame.cornerPointsLessSharp.reset(new Cloud());
+  frame.surfacePointsFlat.reset(new Cloud());
+  frame.surfacePointsLessFlat.reset(new Cloud());
+  frame.laserCloud.reset(new Cloud());
+
+  for (int ring = 0; ring < RING_NUM; ring++) {
+    float tanElevation = std::tan(ringElevation(ring));
+
+    // the ground 1.8 m below the sensor and walls 8 m to the sides
+    for (int col = 0; col < FIRING_NUM; col++) {
+      float azimuth = float(2 * M_PI) * col / FIRING_NUM;
+      float dx = std::sin(azimuth), dz = std::cos(azimuth);
+      float distance = 60;
+      if (tanElevation < 0) {
+        distance = std::min(distance, -1.8f / tanElevation);
+      }
+      if (std::fabs(dx) > 1e-3f) {
+        distance = std::min(distance, 8 / std::fabs(dx));
+      }
+      if (distance >= 60) {
+        continue;
+      }
+      pcl::PointXYZI point = makePoint(distance * dx + noise(rng), distance * tanElevation + noise(rng),
+                                       distance * dz + noise(rng), ring, azimuth);
+      frame.surfacePointsLessFlat->push_back(point);
+      if (col % 8 == 0) {
+        frame.surfacePointsFlat->push_back(point);
+      }
+      frame.laserCloud->push_back(point);
+    }
+
+    // the poles between the sensor and the walls, from the ground up to 6 m
+    int cornerNum = 0;
+    for (const Eigen::Vector2f& pole : poles) {
+      float x = pole.x(), z = pole.y() - sensorZ;
+      float distance = std::sqrt(x * x + z * z);
+      float y = distance * tanElevation;
+      if (y < -1.8f || y > 6 || distance > 60) {
+        continue;
+      }
+      pcl::PointXYZI point = makePoint(x + noise(rng), y + noise(rng), z + noise(rng), ring, std::atan2(x, z));
+      frame.cornerPointsLessSharp->push_back(point);
+      if (cornerNum++ % 5 == 0) {
+        frame.cornerPointsSharp->push_back(point);
+      }
+      frame.laserCloud->push_back(point);
+    }
+  }
+  return frame;
+}
+
+/** \brief Register the frames [first, end) of a DSVL log as the pipeline does. */
+std::vector<Frame> recordedFrames(const DsvlReader& reader, const int& first, const int& end)
+{
+  loam::MultiScanRegistration registration(loam::MultiScanMapper::Hesai_P40(),
+                                           loam::ScanRegistrationParams(0.1, 200, 6, 5, 2, 4, 0.2, 0.1, 200, "none", 1));
+  std::vector<Frame> frames;
+  for (int idx = first; idx < end; idx++) {
+    DsvlFrame input;
+    DsvlPrefetcher::decode(reader, idx, input, true);
+    registration.processOrganized(*input.cloud, 0.1 * idx);
+
+    Frame frame;
+    frame.cornerPointsSharp.reset(new Cloud(registration.cornerPointsSharp()));
+    frame.cornerPointsLessSharp.reset(new Cloud(registration.cornerPointsLessSharp()));
+    frame.surfacePointsFlat.reset(new Cloud(registration.surfacePointsFlat()));
+    frame.surfacePointsLessFlat.reset(new Cloud(registration.surfacePointsLessFlat()));
+    frame.laserCloud.reset(new Cloud(registration.laserCloud()));
+    frames.push_back(frame);
+  }
+  return frames;
+}
+
+struct Result {
+  double cornerPointsLessSharp;   ///< corner points of the last frame, the size of the last corner cloud
+  double cornerPointsSharp;       ///< corner points associated
+  double surfacePointsLessFlat;
+  double odometryTime;            ///< time of LaserOdometry::spin() in ms
+  double nanPassTime;             ///< time of the removed NaN passes per association round in ms
+};
+
+/** \brief Run the odometry over the frames, one result for each but the first, which only initializes it. */
+std::vector<Result> runOdometry(const std::vector<Frame>& frames, const int& threads)
+{
+  loam::LaserOdometry laserOdometry(loam::LaserOdometryParams(0.1, 2, 25, 0.1, 0.1, threads));
+  std::vector<Result> results;
+  for (size_t idx = 0; idx < frames.size(); idx++) {
+    const Frame& frame = frames[idx];
+    Clock::time_point start = Clock::now();
+    laserOdometry.spin(frame.cornerPointsSharp, frame.cornerPointsLessSharp,
+                       frame.surfacePointsFlat, frame.surfacePointsLessFlat,
+                       frame.laserCloud, loam::Twist(), 0.1 * idx);
+    double odometryTime = millisecondsSince(start);
+    if (idx == 0) {
+      continue;
+    }
+
+    // one in place pass over the last corner cloud per sharp point, as the association made every fifth iteration
+    Cloud lastCornerCloud = *frames[idx - 1].cornerPointsLessSharp;
+    std::vector<int> indices;
+    start = Clock::now();
+    for (size_t i = 0; i < frame.cornerPointsSharp->size(); i++) {
+      pcl::removeNaNFromPointCloud(lastCornerCloud, lastCornerCloud, indices);
+    }
+
+    Result result;
+    result.nanPassTime = millisecondsSince(start);
+    result.odometryTime = odometryTime;
+    result.cornerPointsLessSharp = frames[idx - 1].cornerPointsLessSharp->size();
+    result.cornerPointsSharp = frame.cornerPointsSharp->size();
+    result.surfacePointsLessFlat = frame.surfacePointsLessFlat->size();
+    results.push_back(result);
+  }
+  return results;
+}
+
+void printHeader()
+{
+  std::printf("\n%12s %12s %12s %16s %20s\n",
+              "less sharp", "sharp", "less flat", "odometry ms", "NaN passes ms/round");
+}
+
+void printResult(const Result& result)
+{
+  std::printf("%12.0f %12.0f %12.0f %16.2f %20.2f\n",
+              result.cornerPointsLessSharp, result.cornerPointsSharp, result.surfacePointsLessFlat,
+              result.odometryTime, result.nanPassTime);
+}
+
+} // end anonymous namespace
+
+
+
+int main(int argc, char** argv)
+{
+  const int threads = argc > 1 ? std::atoi(argv[1]) : 1;
+
+  if (argc > 2) {
+    DsvlReader reader;
+    if (!reader.open(argv[2])) {
+      std::fprintf(stderr, "Cannot open %s\n", argv[2]);
+      return EXIT_FAILURE;
+    }
+    int first = std::max(argc > 3 ? std::atoi(argv[3]) : 299, 0);
+    int end = std::min(argc > 4 ? std::atoi(argv[4]) : 450, int(reader.frameCount()));
+    std::vector<Result> results = runOdometry(recordedFrames(reader, first, end), threads);
+
+    printHeader();
+    for (const Result& result : results) {
+      printResult(result);
+    }
+    std::printf("frames %d to %d of %s on %d threads; the removed passes ran in up to 5 of the 25 rounds per frame\n",
+                first + 1, end - 1, argv[2], threads);
+    return 0;
+  }
+
+  const int frameNum = 10;
+  std::vector<Result> means;
+  const int scales[] = { 1, 2, 4, 8, 16, 32 };
+  for (const int& scale : scales) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> poleX(-7, 7), poleZ(-40, 40);
+    std::vector<Eigen::Vector2f> poles(20 * scale);
+    for (Eigen::Vector2f& pole : poles) {
+      pole = Eigen::Vector2f(poleX(rng), poleZ(rng));
+    }
+
+    std::vector<Frame> frames;
+    for (int idx = 0; idx <= frameNum; idx++) {
+      frames.push_back(makeFrame(poles, 0.1f * idx, rng));
+    }
+
+    Result mean = {};
+    for (const Result& result : runOdometry(frames, threads)) {
+      mean.cornerPointsLessSharp += result.cornerPointsLessSharp / frameNum;
+      mean.cornerPointsSharp += result.cornerPointsSharp / frameNum;
+      mean.surfacePointsLessFlat += result.surfacePointsLessFlat / frameNum;
+      mean.odometryTime += result.odometryTime / frameNum;
+      mean.nanPassTime += result.nanPassTime / frameNum;
+    }
+    means.push_back(mean);
+  }
+
+  printHeader();
+  for (const Result& mean : means) {
+    printResult(mean);
+  }
+  std::printf("mean over %d frames on %d threads; the removed passes ran in up to 5 of the 25 rounds per frame\n",
+              frameNum, threads);
+  return 0;
+}
@@ -0,0 +1,89 @@
+// Throughput of loam::dominantEigen3() against the Eigen solvers it replaces in
+// LaserMapping::associateCorner(), on covariances of 5 random neighbors.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <Eigen/Eigenvalues>
+#include <Eigen/StdVector>
+
+#include "loam_velodyne/SymmetricEigen3.h"
+
+
+namespace {
+
+typedef std::vector<Eigen::Matrix3f, Eigen::aligned_allocator<Eigen::Matrix3f> > MatrixList;
+
+/** \brief Time fn over all matrices, best of several runs, in ns per matrix. */
+template <typename Fn>
+double timePerMatrix(const MatrixList& matrices, Fn fn)
+{
+  double best = 1e30;
+  for (int run = 0; run < 5; run++) {
+    auto start = std::chrono::steady_clock::now();
+    for (const Eigen::Matrix3f& m : matrices) {
+      fn(m);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count() / matrices.size());
+  }
+  return best;
+}
+
+} // end anonymous namespace
+
+
+
+int main(int argc, char** argv)
+{
+  size_t count = argc > 1 ? size_t(std::atol(argv[1])) : 1000000;
+
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> uniform(-1, 1);
+  MatrixList matrices(count);
+  for (Eigen::Matrix3f& m : matrices) {
+    Eigen::Vector3f points[5];
+    Eigen::Vector3f mean = Eigen::Vector3f::Zero();
+    for (int j = 0; j < 5; j++) {
+      points[j] = Eigen::Vector3f(uniform(rng), 0.1f * uniform(rng), 0.1f * uniform(rng));
+      mean += points[j];
+    }
+    mean /= 5.0f;
+    m.setZero();
+    for (int j = 0; j < 5; j++) {
+      m += (points[j] - mean) * (points[j] - mean).transpose();
+    }
+    m /= 5.0f;
+  }
+
+  // count the edges, so the work cannot be optimized away
+  size_t edges = 0;
+
+  double iterative = timePerMatrix(matrices, [&](const Eigen::Matrix3f& m) {
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> solver(m);
+    edges += solver.eigenvalues()(2) > 3 * solver.eigenvalues()(1);
+  });
+
+  double direct = timePerMatrix(matrices, [&](const Eigen::Matrix3f& m) {
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> solver;
+    solver.computeDirect(m);
+    edges += solver.eigenvalues()(2) > 3 * solver.eigenvalues()(1);
+  });
+
+  double closedForm = timePerMatrix(matrices, [&](const Eigen::Matrix3f& m) {
+    float lambdaMax, lambdaMid;
+    Eigen::Vector3f direction;
+    loam::dominantEigen3(m, lambdaMax, lambdaMid, direction);
+    edges += lambdaMax > 3 * lambdaMid;
+  });
+
+  std::printf("%zu matrices, %zu edges\n", count, edges);
+  std::printf("SelfAdjointEigenSolver::compute       %8.1f ns\n", iterative);
+  std::printf("SelfAdjointEigenSolver::computeDirect %8.1f ns\n", direct);
+  std::printf("dominantEigen3                        %8.1f ns\n", closedForm);
+  return 0;
+}
@@ -0,0 +1,235 @@
+// loam::VoxelFilter against pcl::VoxelGrid<pcl::PointXYZI> on the frames of a DSVL
+// log, or on synthetic frames without one: both must produce the same centroids,
+// and the time of both is reported.
+//
+// Usage: bench_voxel_filter [dsvl [first frame [end frame]]]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include <pcl/filters/voxel_grid.h>
+
+#include "benchutil.h"
+#include "dsvlprefetcher.h"
+#include "dsvlreader.h"
+#include "loam_velodyne/VoxelFilter.h"
+
+
+namespace {
+
+typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+/** \brief The finite points of a frame, one cloud per beam, with beam + firing fraction in the intensity. */
+std::vector<Cloud> toRings(const pcl::PointCloud<pcl::PointXYZ>& frame)
+{
+  std::vector<Cloud> rings(frame.height);
+  for (uint32_t row = 0; row < frame.height; row++) {
+    for (uint32_t col = 0; col < frame.width; col++) {
+      const pcl::PointXYZ& p = frame(col, row);
+      if (std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z)) {
+        pcl::PointXYZI point;
+        point.x = p.x;
+        point.y = p.y;
+        point.z = p.z;
+        point.intensity = row + float(col) / frame.width;
+        rings[row].push_back(point);
+      }
+    }
+  }
+  return rings;
+}
+
+/** \brief Rings of a 40 beam sensor in a street between two walls, for runs without a log. */
+std::vector<Cloud> syntheticRings(std::mt19937& rng)
+{
+  std::uniform_real_distribution<float> noise(-0.02f, 0.02f);
+  std::vector<Cloud> rings(40);
+  for (int beam = 0; beam < 40; beam++) {
+    float elevation = float(M_PI / 180) * (-16 + 23.0f * beam / 39);
+    for (int col = 0; col < 1800; col++) {
+      float azimuth = float(2 * M_PI) * col / 1800;
+      float dx = std::sin(azimuth) * std::cos(elevation);
+      float dy = std::sin(elevation);
+      float dz = std::cos(azimuth) * std::cos(elevation);
+      // ground 2 m below the sensor, walls 8 m to the sides, range limited to 120 m
+      float range = 120;
+      if (dy < 0) range = std::min(range, -2 / dy);
+      if (std::fabs(dx) > 1e-3f) range = std::min(range, 8 / std::fabs(dx));
+      pcl::PointXYZI point;
+      point.x = range * dx + noise(rng);
+      point.y = range * dy + noise(rng);
+      point.z = range * dz + noise(rng);
+      point.intensity = beam + col / 1800.0f;
+      rings[beam].push_back(point);
+    }
+  }
+  return rings;
+}
+
+/** \brief True if pcl::VoxelGrid filters the cloud, it returns the input unchanged if the voxel indices overflow. */
+bool fitsVoxelGrid(const Cloud& cloud, const float& leafSize)
+{
+  float minP[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+  float maxP[3] = { -minP[0], -minP[1], -minP[2] };
+  for (const pcl::PointXYZI& point : cloud.points) {
+    const float p[3] = { point.x, point.y, point.z };
+    for (int a = 0; a < 3; a++) {
+      minP[a] = std::min(minP[a], p[a]);
+      maxP[a] = std::max(maxP[a], p[a]);
+    }
+  }
+  int64_t cells = 1;
+  for (int a = 0; a < 3; a++) {
+    cells *= int64_t((maxP[a] - minP[a]) / leafSize) + 1;
+  }
+  return cloud.empty() || cells <= std::numeric_limits<int32_t>::max();
+}
+
+struct Comparison {
+  size_t voxels;            ///< voxels of pcl::VoxelGrid
+  size_t countMismatches;   ///< clouds with a different number of voxels
+  size_t voxelMismatches;   ///< voxels without a counterpart within the tolerance
+  float maxDifference;      ///< largest coordinate or intensity difference of matched voxels
+  size_t skipped;           ///< clouds pcl::VoxelGrid cannot filter at this leaf size
+  double pclTime;
+  double loamTime;
+};
+
+/** \brief Order centroids by their voxel, then by position. */
+struct VoxelOrder {
+  float inverseLeafSize;
+  bool operator()(const pcl::PointXYZI& a, const pcl::PointXYZI& b) const
+  {
+    const float ka[3] = { std::floor(a.x * inverseLeafSize), std::floor(a.y * inverseLeafSize), std::floor(a.z * inverseLeafSize) };
+    const float kb[3] = { std::floor(b.x * inverseLeafSize), std::floor(b.y * inverseLeafSize), std::floor(b.z * inverseLeafSize) };
+    for (int c = 0; c < 3; c++) {
+      if (ka[c] != kb[c]) {
+        return ka[c] < kb[c];
+      }
+    }
+    return a.x < b.x;
+  }
+};
+
+/** \brief Filter a cloud with both filters the way the pipeline does, and compare the results. */
+void compare(const Cloud::Ptr& cloud, const float& leafSize, loam::VoxelFilter& voxelFilter, Comparison& result)
+{
+  if (!fitsVoxelGrid(*cloud, leafSize)) {
+    result.skipped++;
+    return;
+  }
+
+  // a fresh pcl::VoxelGrid per call, as the pipeline used it, and one reused VoxelFilter
+  Cloud expected, actual;
+  Clock::time_point start = Clock::now();
+  pcl::VoxelGrid<pcl::PointXYZI> voxelGrid;
+  voxelGrid.setInputCloud(cloud);
+  voxelGrid.setLeafSize(leafSize, leafSize, leafSize);
+  voxelGrid.filter(expected);
+  result.pclTime += millisecondsSince(start);
+
+  start = Clock::now();
+  voxelFilter.setLeafSize(leafSize);
+  voxelFilter.filter(*cloud, actual);
+  result.loamTime += millisecondsSince(start);
+
+  result.voxels += expected.size();
+  if (expected.size() != actual.size()) {
+    result.countMismatches++;
+  }
+
+  // both emit one centroid per voxel in a different order, match them up by voxel
+  VoxelOrder order = { 1.0f / leafSize };
+  std::sort(expected.points.begin(), expected.points.end(), order);
+  std::sort(actual.points.begin(), actual.points.end(), order);
+  const float tolerance = 1e-3f * leafSize;
+  size_t matched = 0;
+  for (size_t e = 0, a = 0; e < expected.size() && a < actual.size(); ) {
+    const pcl::PointXYZI& p = expected.points[e];
+    const pcl::PointXYZI& q = actual.points[a];
+    float difference = std::max(std::max(std::fabs(p.x - q.x), std::fabs(p.y - q.y)),
+                                std::max(std::fabs(p.z - q.z), std::fabs(p.intensity - q.intensity)));
+    if (difference <= tolerance) {
+      result.maxDifference = std::max(result.maxDifference, difference);
+      matched++;
+      e++;
+      a++;
+    } else if (order(p, q)) {
+      e++;
+    } else {
+      a++;
+    }
+  }
+  result.voxelMismatches += std::max(expected.size(), actual.size()) - matched;
+}
+
+void printResult(const char* name, const float& leafSize, const size_t& clouds, const Comparison& result)
+{
+  std::printf("%-12s leaf %.1f: %7zu voxels from %5zu clouds, count mismatches %zu, voxel mismatches %zu, "
+              "max difference %.2e, skipped %zu | pcl::VoxelGrid %8.2f ms, VoxelFilter %8.2f ms\n",
+              name, leafSize, result.voxels, clouds - result.skipped, result.countMismatches,
+              result.voxelMismatches, result.maxDifference, result.skipped, result.pclTime, result.loamTime);
+}
+
+} // end anonymous namespace
+
+
+
+int main(int argc, char** argv)
+{
+  // the frames, each as one cloud per beam
+  std::vector<std::vector<Cloud> > frames;
+  if (argc > 1) {
+    DsvlReader reader;
+    if (!reader.open(argv[1])) {
+      std::fprintf(stderr, "Cannot open %s\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+    int first = argc > 2 ? std::atoi(argv[2]) : 299;
+    int end = argc > 3 ? std::atoi(argv[3]) : 450;
+    end = std::min(end, int(reader.frameCount()));
+    for (int idx = std::max(first, 0); idx < end; idx++) {
+      DsvlFrame frame;
+      DsvlPrefetcher::decode(reader, idx, frame, true);
+      frames.push_back(toRings(*frame.cloud));
+    }
+    std::printf("%zu frames of %s\n", frames.size(), argv[1]);
+  } else {
+    std::mt19937 rng(42);
+    for (int idx = 0; idx < 20; idx++) {
+      frames.push_back(syntheticRings(rng));
+    }
+    std::printf("%zu synthetic frames\n", frames.size());
+  }
+
+  loam::VoxelFilter voxelFilter;
+  bool ok = true;
+
+  // per ring as in ScanRegistration, and on the whole frame as for the stacks and the map
+  const float leafSizes[] = { 0.2f, 0.4f, 0.6f };
+  for (const float& leafSize : leafSizes) {
+    Comparison ringResult = {}, frameResult = {};
+    size_t ringNum = 0;
+    for (const std::vector<Cloud>& rings : frames) {
+      Cloud::Ptr frameCloud(new Cloud());
+      for (const Cloud& ring : rings) {
+        compare(ring.makeShared(), leafSize, voxelFilter, ringResult);
+        *frameCloud += ring;
+        ringNum++;
+      }
+      compare(frameCloud, leafSize, voxelFilter, frameResult);
+    }
+    printResult("per ring", leafSize, ringNum, ringResult);
+    printResult("per frame", leafSize, frames.size(), frameResult);
+    ok = ok && ringResult.countMismatches == 0 && ringResult.voxelMismatches == 0
+            && frameResult.countMismatches == 0 && frameResult.voxelMismatches == 0;
+  }
+
+  std::printf(ok ? "same voxels\n" : "DIFFERENT voxels\n");
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,101 @@
+// Build and 5-NN query time of loam::VoxelHashIndex against nanoflann::KdTreeFLANN
+// on map cubes as kept by LaserMapping.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "benchutil.h"
+#include "loam_velodyne/VoxelHashIndex.h"
+#include "loam_velodyne/nanoflann_pcl.h"
+
+
+namespace {
+
+typedef pcl::PointXYZI PointT;
+typedef pcl::PointCloud<PointT> Cloud;
+
+/** \brief A ground plane and some walls in one 50 m cube, at the spacing of the down size filters. */
+Cloud::Ptr streetCloud(const float& spacing, std::mt19937& rng)
+{
+  std::uniform_real_distribution<float> uniform(0, 1);
+  Cloud::Ptr cloud(new Cloud());
+  PointT point;
+  for (float x = 0; x < 50; x += spacing) {
+    for (float z = 0; z < 50; z += spacing) {
+      if (uniform(rng) < 0.5f) {
+        point.x = x + spacing * uniform(rng);
+        point.y = -1.5f + 0.05f * uniform(rng);
+        point.z = z + spacing * uniform(rng);
+        cloud->push_back(point);
+      }
+    }
+  }
+  for (int wall = 0; wall < 8; wall++) {
+    float x0 = 50 * uniform(rng), z0 = 50 * uniform(rng), angle = float(M_PI) * uniform(rng);
+    for (float t = 0; t < 20; t += spacing) {
+      for (float y = -1.5f; y < 4; y += spacing) {
+        point.x = x0 + t * std::cos(angle);
+        point.y = y;
+        point.z = z0 + t * std::sin(angle);
+        cloud->push_back(point);
+      }
+    }
+  }
+  return cloud;
+}
+
+} // end anonymous namespace
+
+
+
+int main()
+{
+  const size_t queryNum = 50000;
+  const int k = 5;
+  std::mt19937 rng(5);
+  std::uniform_real_distribution<float> uniform(-0.3f, 0.3f);
+
+  std::printf("%8s %8s %14s %14s %14s %14s\n", "spacing", "points", "kd build ms", "kd query ms", "hash build ms", "hash query ms");
+  const float spacings[] = { 0.2f, 0.4f, 0.6f };
+  for (const float& spacing : spacings) {
+    Cloud::Ptr cloud = streetCloud(spacing, rng);
+
+    // stack points after a good initial guess, close to the map
+    std::vector<PointT, Eigen::aligned_allocator<PointT> > queries(queryNum);
+    for (PointT& query : queries) {
+      query = cloud->points[rng() % cloud->size()];
+      query.x += uniform(rng);
+      query.y += uniform(rng);
+      query.z += uniform(rng);
+    }
+
+    std::vector<int> indices(queryNum * k);
+    std::vector<float> sqDistances(queryNum * k);
+    double kdBuild = 1e30, kdQuery = 1e30, hashBuild = 1e30, hashQuery = 1e30;
+    for (int run = 0; run < 10; run++) {
+      nanoflann::KdTreeFLANN<PointT> kdtree;
+      Clock::time_point start = Clock::now();
+      kdtree.setInputCloud(cloud);
+      kdBuild = std::min(kdBuild, millisecondsSince(start));
+      start = Clock::now();
+      kdtree.nearestKSearch(queries.data(), queryNum, k, indices.data(), sqDistances.data());
+      kdQuery = std::min(kdQuery, millisecondsSince(start));
+
+      loam::VoxelHashIndex hash(1.0f);
+      start = Clock::now();
+      hash.setInputCloud(cloud);
+      hashBuild = std::min(hashBuild, millisecondsSince(start));
+      start = Clock::now();
+      hash.nearestKSearch(queries.data(), queryNum, k, indices.data(), sqDistances.data());
+      hashQuery = std::min(hashQuery, millisecondsSince(start));
+    }
+
+    std::printf("%8.1f %8zu %14.2f %14.2f %14.2f %14.2f\n",
+                spacing, cloud->size(), kdBuild, kdQuery, hashBuild, hashQuery);
+  }
+  std::printf("%d-NN over %zu queries, hash cell size 1 m, best of 10 runs\n", k, queryNum);
+  return 0;
+}
@@ -0,0 +1,17 @@
+// Timing helpers shared by the benchmarks.
+
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include <chrono>
+
+
+typedef std::chrono::steady_clock Clock;
+
+/** \brief Wall clock time since start in ms. */
+inline double millisecondsSince(const Clock::time_point& start)
+{
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+#endif // BENCHUTIL_H
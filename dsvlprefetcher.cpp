@@ -0,0 +1,117 @@
+#include "dsvlprefetcher.h"
+
+#include <stdio.h>
+#include <limits>
+
+
+DsvlPrefetcher::DsvlPrefetcher(const DsvlReader &reader, int begin, int end,
+                               int depth, bool dropWhenFull, int readAhead, bool organized):
+_reader(reader),
+_end(end),
+_dropWhenFull(dropWhenFull),
+_readAhead(readAhead),
+_organized(organized),
+_next(begin),
+_ring(depth > 0 ? depth : 1),
+_dropped(0)
+{
+    if (depth > 0)
+        _thread = std::thread(&DsvlPrefetcher::run, this);
+}
+
+DsvlPrefetcher::~DsvlPrefetcher()
+{
+    // unblocks a producer waiting on a full ring
+    _ring.close();
+    if (_thread.joinable())
+        _thread.join();
+}
+
+bool DsvlPrefetcher::next(DsvlFrame &frame)
+{
+    if (_thread.joinable())
+        return _ring.pop(frame);
+
+    if (_next >= _end)
+        return false;
+    fetch(_next++, frame);
+    return true;
+}
+
+void DsvlPrefetcher::run()
+{
+    for (int idx = _next; idx < _end && !_ring.closed(); idx++) {
+        DsvlFrame frame;
+        fetch(idx, frame);
+
+        if (_dropWhenFull) {
+            if (!_ring.tryPush(frame)) {
+                _dropped++;
+                printf("[DsvlPrefetcher] ring full, dropping frame %d\n", idx);
+            }
+        }
+        else if (!_ring.push(frame)) {
+            break;
+        }
+    }
+    _ring.close();
+}
+
+void DsvlPrefetcher::fetch(int idx, DsvlFrame &frame)
+{
+    // page in the following frames while this one is unpacked
+    _reader.prefetch(idx + 1, _readAhead);
+    _reader.release(idx);
+    decode(_reader, idx, frame, _organized);
+}
+
+void DsvlPrefetcher::decode(const DsvlReader &reader, int idx, DsvlFrame &frame, bool organized)
+{
+    const ONEDSVDATA *onefrm = reader.frame(idx);
+
+    frame.index = idx;
+    frame.millisec = onefrm[0].millisec;
+    frame.ang = onefrm[0].ang;
+    frame.shv = onefrm[0].shv;
+    frame.cloud.reset(new pcl::PointCloud<pcl::PointXYZ>());
+
+    const point3fi *p;
+    if (organized) {
+        pcl::PointXYZ invalid;
+        invalid.x = invalid.y = invalid.z = std::numeric_limits<float>::quiet_NaN();
+
+        // row k is beam k, column i*LINES_PER_BLK+j the j-th firing of block i
+        const int firings = BKNUM_PER_FRM * LINES_PER_BLK;
+        frame.cloud->points.assign(firings * PNTS_PER_LINE, invalid);
+        frame.cloud->width = firings;
+        frame.cloud->height = PNTS_PER_LINE;
+        frame.cloud->is_dense = false;
+
+        for (int i=0; i<BKNUM_PER_FRM; i++) {
+            for (int j = 0; j < LINES_PER_BLK; j++) {
+                for (int k = 0; k < PNTS_PER_LINE; k++) {
+                    p = &onefrm[i].points[j * PNTS_PER_LINE + k];
+                    if (!p->i)
+                        continue;
+                    pcl::PointXYZ &p_ = frame.cloud->points[k * firings + i * LINES_PER_BLK + j];
+                    p_.x = p->x; p_.y = p->y; p_.z = p->z;
+                }
+            }
+        }
+        return;
+    }
+
+    frame.cloud->reserve(BKNUM_PER_FRM * PTNUM_PER_BLK);
+    for (int i=0; i<BKNUM_PER_FRM; i++) {
+        for (int j = 0; j < LINES_PER_BLK; j++) {
+            for (int k = 0; k < PNTS_PER_LINE; k++) {
+                p = &onefrm[i].points[j * PNTS_PER_LINE + k];
+                if (!p->i)
+                    continue;
+                pcl::PointXYZ p_;
+                p_.x = p->x; p_.y = p->y; p_.z = p->z;
+                frame.cloud->push_back(p_);
+            }
+        }
+    }
+}
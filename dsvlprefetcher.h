@@ -0,0 +1,72 @@
+#ifndef DSVLPREFETCHER_H
+#define DSVLPREFETCHER_H
+
+#include <atomic>
+#include <thread>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "types.h"
+#include "dsvlreader.h"
+#include "spscring.h"
+
+/// One decoded DSVL frame, ready to be handed to the feature extractor.
+struct DsvlFrame
+{
+    int index;          ///< frame index in the log
+    int millisec;       ///< time stamp of the first block
+    point3d ang;        ///< vehicle attitude of the first block
+    point3d shv;        ///< vehicle position of the first block
+    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;  ///< points of all blocks
+
+    DsvlFrame(): index(-1), millisec(0), ang(), shv() {}
+};
+
+/// Decodes frames [begin, end) of a DSVL log on a producer thread.
+///
+/// Up to depth decoded frames are kept in a lock-free SPSC ring, so reading
+/// and unpacking the next frames overlaps with processing the current one.
+/// When the ring is full the producer either waits for the consumer or, with
+/// dropWhenFull, discards the frame it just decoded. A depth of 0 decodes
+/// synchronously in next() without starting a thread.
+///
+/// With organized set, clouds keep the sensor layout: one row per beam and
+/// one column per firing (block line), invalid points set to NaN.
+class DsvlPrefetcher
+{
+public:
+    DsvlPrefetcher(const DsvlReader& reader, int begin, int end,
+                   int depth, bool dropWhenFull, int readAhead, bool organized);
+    ~DsvlPrefetcher();
+
+    /// Fetch the next frame, waiting for the producer if needed.
+    /// Returns false once all frames have been handed out.
+    bool next(DsvlFrame& frame);
+
+    /// Number of frames discarded because the ring was full.
+    int dropped() const { return _dropped.load(); }
+
+    /// Unpack the blocks of frame idx.
+    static void decode(const DsvlReader& reader, int idx, DsvlFrame& frame, bool organized);
+
+private:
+    DsvlPrefetcher(const DsvlPrefetcher&);
+    DsvlPrefetcher& operator=(const DsvlPrefetcher&);
+
+    void run();
+    void fetch(int idx, DsvlFrame& frame);
+
+    const DsvlReader& _reader;
+    const int _end;
+    const bool _dropWhenFull;
+    const int _readAhead;
+    const bool _organized;
+    int _next;
+
+    SpscRing<DsvlFrame> _ring;
+    std::atomic<int> _dropped;
+    std::thread _thread;
+};
+
+#endif // DSVLPREFETCHER_H
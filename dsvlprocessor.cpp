@@ -1,198 +1,285 @@
 #include "dsvlprocessor.h"
+#include <algorithm>
+#include <functional>
+#include <thread>
 #include <unordered_set>
 
 
-DsvlProcessor::DsvlProcessor(std::string dsvl_, std::string calib_):
-isInited(false),
+DsvlProcessor::DsvlProcessor(std::string dsvl_, std::string calib_, const DsvlProcessorParams& params_):
+params(params_),
+millsec(0),
+isPoseInited(false),
 num(0),
 _canvas(600,600,CV_8UC3, cv::Scalar::all(1)),
-viewer(new pcl::visualization::PCLVisualizer("Feature-Vis")),
 pts(new pcl::PointCloud<pointT>()),
-laserCloud(),
-cornerPointsSharp(),
-cornerPointsLessSharp(),
-surfacePointsFlat(),
-surfacePointsLessFlat(),
+laserCloud(new pcl::PointCloud<pcl::PointXYZI>()),
+cornerPointsSharp(new pcl::PointCloud<pcl::PointXYZI>()),
+cornerPointsLessSharp(new pcl::PointCloud<pcl::PointXYZI>()),
+surfacePointsFlat(new pcl::PointCloud<pcl::PointXYZI>()),
+surfacePointsLessFlat(new pcl::PointCloud<pcl::PointXYZI>()),
 _map(),
-handler(new pcl::visualization::PointCloudColorHandlerGenericField<pointT>(pts, "z"))
+_cornerFromMapNum(0),
+_surfFromMapNum(0),
+_mappingOptimizationTime(0),
+_allocations(0),
+_allocatedBytes(0),
+_finishedFrames(0),
+_cornerFromMapSum(0),
+_surfFromMapSum(0),
+_mappingOptimizationTimeSum(0),
+_allocationsSum(0),
+_allocatedBytesSum(0)
 {
-    loam::MultiScanMapper scanMapper = loam::MultiScanMapper(-16,7,40);
-    loam::ScanRegistrationParams params = loam::ScanRegistrationParams(0.1,200,6,5,2,4,0.2,0.1,200,"none");
+    // pipelined, the three stages run at once and share the cores
+    int stages = params_.pipelined ? 3 : 1;
+    int threads = params_.threads > 0 ? params_.threads : std::max(1, int(std::thread::hardware_concurrency()) / stages);
+
+    loam::MultiScanMapper scanMapper = loam::MultiScanMapper::Hesai_P40();
+    loam::ScanRegistrationParams params = loam::ScanRegistrationParams(0.1,200,6,5,2,4,0.2,0.1,200,"none",threads);
     featureExtractor = loam::MultiScanRegistration(scanMapper, params);
 
-    loam::LaserOdometryParams laserOdometryParams = loam::LaserOdometryParams();
+    loam::LaserOdometryParams laserOdometryParams = loam::LaserOdometryParams(0.1,2,25,0.1,0.1,threads);
     laserOdometry = loam::LaserOdometry(laserOdometryParams);
 
-    loam::LaserMappingParams laserMappingParams= loam::LaserMappingParams();
+    // the P40's vertical field of view and range; -90 to 90 degrees without a range limit keeps all cubes
+    loam::LaserMappingParams laserMappingParams= params_.fovCulling
+        ? loam::LaserMappingParams(0.1,1,5,10,0.05,0.05,0.2,0.4,0.6,threads,-16,7,200,true,params_.edgeResiduals)
+        : loam::LaserMappingParams(0.1,1,5,10,0.05,0.05,0.2,0.4,0.6,threads,-90,90,0,true,params_.edgeResiduals);
     laserMapping= loam::LaserMapping(laserMappingParams);
 
-    viewer->setBackgroundColor(0,0,0);
-    viewer->addCoordinateSystem(1.0);
+    if (!params_.headless)
+        visualizer.reset(new FeatureVisualizer(params_.visualizeEvery));
 
     loadCalibFile(calib_);
 
-    dsvlbytesiz = sizeof (ONEDSVDATA);
-    dsvbytesiz = dsvlbytesiz-sizeof(int)*LINES_PER_BLK*PNTS_PER_LINE;
-    dFrmNum=0;
-
     fout = std::fopen("traj.nav", "w");
 
-    dfp.open(dsvl_.c_str(), std::ios_base::binary);
-    if (!dfp.is_open()){
-        printf("File open failure : %s\n", dsvl_.c_str());
-        isRunning = false;
-    }
-    else{
-        isRunning = true;
-    }
+    isRunning = reader.open(dsvl_);
+    dFrmNum = reader.frameCount();
 }
 
 
-bool DsvlProcessor::ReadOneDsvlFrame()
+void DsvlProcessor::Processing()
 {
-    int		i;
-    for (i=0; i<BKNUM_PER_FRM; i++) {
-        dfp.read((char *)&onefrm->dsv[i], dsvlbytesiz);
-        if (dfp.gcount() != dsvlbytesiz)
-            break;
+    int endFrame = dFrmNum;
+    if (params.endFrame >= 0 && params.endFrame < endFrame)
+        endFrame = params.endFrame;
+
+    DsvlPrefetcher prefetcher(reader, std::max(params.startFrame, 0), endFrame,
+                              params.prefetchDepth, params.prefetchDropWhenFull, params.readAhead,
+                              params.organized);
+    if (params.pipelined)
+        runPipelined(prefetcher);
+    else
+        runSynchronous(prefetcher);
+
+    if (_finishedFrames > 0) {
+        std::printf("[frames, %d], [mean cornerFromMap, %.0f], [mean surfFromMap, %.0f], [mean mappingOptimization, %.2f ms]\n",
+                    _finishedFrames,
+                    _cornerFromMapSum / _finishedFrames,
+                    _surfFromMapSum / _finishedFrames,
+                    _mappingOptimizationTimeSum / _finishedFrames);
+        if (AllocationCounter::enabled()) {
+            std::printf("[mean allocations, %.0f], [mean allocatedBytes, %.0f]\n",
+                        _allocationsSum / _finishedFrames, _allocatedBytesSum / _finishedFrames);
+            // the counters are process wide, other threads running alongside a stage count too
+            if (params.pipelined || params.prefetchDepth > 0 || !params.headless)
+                std::printf("allocations include concurrent stages, prefetching and the viewer, "
+                            "run with --sync --prefetch 0 --headless for exact per frame numbers\n");
+        }
     }
 
-    if (i<BKNUM_PER_FRM)
-        return false;
-    else
-        return true;
+//    pcl::PCDWriter pclWriter;
+//    pclWriter.write("map.pcd",_map);
 }
 
-
-void DsvlProcessor::Processing()
+void DsvlProcessor::runSynchronous(DsvlPrefetcher& prefetcher)
 {
-    dfp.seekg(0, std::ios_base::end);
-    dFrmNum = dfp.tellg() / 180 / dsvlbytesiz;
-
-    dfp.seekg(0, std::ios_base::beg);
-
-    onefrm= new ONEDSVFRAME[1];
-
-    while (ReadOneDsvlFrame () && isRunning)
+    DsvlFrame input;
+    while (isRunning && prefetcher.next(input))
     {
-        if (num%100==0) {
-            printf("%d (%d)\n",num,dFrmNum);
-        }
-        num++;
-        if (num < 300) continue;
-        if (num > 450) break;
-
-        ProcessOneFrame();
-
-        pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZI> colorLaserCloud(laserCloud.makeShared(), 255, 255, 255);
-        pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZI> colorCornerPointsSharp(cornerPointsSharp.makeShared(), 255, 0, 0);
-        pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZI> colorCornerPointsLessSharp(cornerPointsLessSharp.makeShared(), 255, 255, 0);
-        pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZI> colorSurfacePointsFlat(surfacePointsFlat.makeShared(), 0, 255, 0);
-        viewer->setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 5, "cornerPointsSharp");
-        viewer->setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 3, "cornerPointsLessSharp");
-        viewer->setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 4, "surfacePointsFlat");
-        if(!isInited)
-        {
-            viewer->addPointCloud<pcl::PointXYZI>(laserCloud.makeShared(), colorLaserCloud, "laserCloud");
-            viewer->addPointCloud<pcl::PointXYZI>(cornerPointsSharp.makeShared(), colorCornerPointsSharp, "cornerPointsSharp");
-            viewer->addPointCloud<pcl::PointXYZI>(cornerPointsLessSharp.makeShared(), colorCornerPointsLessSharp, "cornerPointsLessSharp");
-            viewer->addPointCloud<pcl::PointXYZI>(surfacePointsFlat.makeShared(), colorSurfacePointsFlat, "surfacePointsFlat");
-            isInited = true;
-        }
-        else {
-            viewer->updatePointCloud<pcl::PointXYZI>(laserCloud.makeShared(), colorLaserCloud, "laserCloud");
-            viewer->updatePointCloud<pcl::PointXYZI>(cornerPointsSharp.makeShared(), colorCornerPointsSharp, "cornerPointsSharp");
-            viewer->updatePointCloud<pcl::PointXYZI>(cornerPointsLessSharp.makeShared(), colorCornerPointsLessSharp, "cornerPointsLessSharp");
-            viewer->updatePointCloud<pcl::PointXYZI>(surfacePointsFlat.makeShared(), colorSurfacePointsFlat, "surfacePointsFlat");
-        }
-        viewer->spinOnce(100);
-
-//        int ix0, ix1, iy0, iy1;
-//        bool bound0 = transformToCanvas(_shv0.x, _shv0.z, ix0, iy0);
-//        bool bound1 = transformToCanvas(_shv.x, _shv.z, ix1, iy1);
-//        if (bound0 && bound1)
-//            cv::line(_canvas, cv::Point(ix0,iy0), cv::Point(ix1,iy1), cv::Scalar(0,0,255), 5, CV_AA);
-//        cv::imshow("Traj", _canvas);
-//        cv::waitKey(100);
-
-        printLog();
+        LoamFrame frame;
+        registerFrame(input, frame);
+        odometryFrame(frame);
+        mappingFrame(frame);
+        finishFrame(frame);
     }
-
-//    pcl::PCDWriter pclWriter;
-//    pclWriter.write("map.pcd",_map);
 }
 
-void DsvlProcessor::ProcessOneFrame() {
-    loam::Time millsec = onefrm->dsv[0].millisec;
-    _ang = onefrm->dsv[0].ang;
-    _shv = onefrm->dsv[0].shv;
-
-    point3fi *p;
-    pts->clear();
-    for (int i=0; i<BKNUM_PER_FRM; i++) {
-        for (int j = 0; j < LINES_PER_BLK; j++) {
-            for (int k = 0; k < PNTS_PER_LINE; k++) {
-                p = &onefrm->dsv[i].points[j * PNTS_PER_LINE + k];
-                if (!p->i)
-                    continue;
-                pointT p_;
-                p_.x = p->x; p_.y = p->y; p_.z = p->z;
-                pts->push_back(p_);
-            }
+void DsvlProcessor::runPipelined(DsvlPrefetcher& prefetcher)
+{
+    // registration -> odometry -> mapping each run on a worker, finishing
+    // the frames stays on this thread. Every stage sees the frames in log order, so the
+    // results match the synchronous mode.
+    FrameQueue registered(params.pipelineDepth);
+    FrameQueue odometered(params.pipelineDepth);
+    FrameQueue mapped(params.pipelineDepth);
+
+    std::thread registration([&]() {
+        DsvlFrame input;
+        while (isRunning && prefetcher.next(input)) {
+            LoamFrame::Ptr frame(new LoamFrame());
+            registerFrame(input, *frame);
+            if (!registered.push(frame))
+                break;
         }
+        registered.close();
+    });
+    std::thread odometry(&DsvlProcessor::runStage, this,
+                         std::ref(registered), std::ref(odometered), &DsvlProcessor::odometryFrame);
+    std::thread mapping(&DsvlProcessor::runStage, this,
+                        std::ref(odometered), std::ref(mapped), &DsvlProcessor::mappingFrame);
+
+    LoamFrame::Ptr frame;
+    while (mapped.pop(frame))
+        finishFrame(*frame);
+
+    mapping.join();
+    odometry.join();
+    registration.join();
+}
+
+void DsvlProcessor::runStage(FrameQueue& in, FrameQueue& out, void (DsvlProcessor::*stage)(LoamFrame&))
+{
+    LoamFrame::Ptr frame;
+    while (in.pop(frame)) {
+        (this->*stage)(*frame);
+        if (!out.push(frame))
+            break;
     }
+    // closing both sides stops the stages up- and downstream as well
+    in.close();
+    out.close();
+}
 
-    updateTransformToInit();
+void DsvlProcessor::registerFrame(const DsvlFrame& input, LoamFrame& frame) {
+    AllocationScope allocationScope(frame.allocations, frame.allocatedBytes);
 
-    featureExtractor.process(*pts, millsec);
-    laserCloud = featureExtractor.laserCloud();
-    cornerPointsSharp = featureExtractor.cornerPointsSharp();
-    cornerPointsLessSharp = featureExtractor.cornerPointsLessSharp();
-    surfacePointsFlat = featureExtractor.surfacePointsFlat();
-    surfacePointsLessFlat = featureExtractor.surfacePointsLessFlat();
+    // frame numbers are 1-based in the log output
+    frame.num = input.index + 1;
+    frame.millsec = input.millisec;
+    frame.ang = input.ang;
+    frame.shv = input.shv;
+    frame.pts = input.cloud;
 
-    transformPclToIMU();
+    updateTransformToInit(frame);
 
-    if(!isInited) {
-        _ang0.x = 0; _ang0.y = 0; _ang.z = 0;
+    if (frame.pts->isOrganized())
+        featureExtractor.processOrganized(*frame.pts, frame.millsec);
+    else
+        featureExtractor.process(*frame.pts, frame.millsec);
+
+    // take over the extractor's buffers instead of copying them
+    frame.laserCloud.reset(new pcl::PointCloud<pcl::PointXYZI>());
+    frame.cornerPointsSharp.reset(new pcl::PointCloud<pcl::PointXYZI>());
+    frame.cornerPointsLessSharp.reset(new pcl::PointCloud<pcl::PointXYZI>());
+    frame.surfacePointsFlat.reset(new pcl::PointCloud<pcl::PointXYZI>());
+    frame.surfacePointsLessFlat.reset(new pcl::PointCloud<pcl::PointXYZI>());
+    frame.laserCloud->swap(featureExtractor.laserCloud());
+    frame.cornerPointsSharp->swap(featureExtractor.cornerPointsSharp());
+    frame.cornerPointsLessSharp->swap(featureExtractor.cornerPointsLessSharp());
+    frame.surfacePointsFlat->swap(featureExtractor.surfacePointsFlat());
+    frame.surfacePointsLessFlat->swap(featureExtractor.surfacePointsLessFlat());
+
+    transformPclToIMU(frame);
+
+    if(!isPoseInited) {
+        _ang0.x = 0; _ang0.y = 0; frame.ang.z = 0;
         _initAng = _ang0;
-        _shv0 = _shv;
-        _initShv = _shv;
+        _shv0 = frame.shv;
+        _initShv = frame.shv;
+        isPoseInited = true;
     }
 
-    loam::Twist imuTrans;
-    imuTrans.pos = loam::Vector3(_shv.y - _shv0.y, _shv.z - _shv0.z, _shv.x - _shv0.x);
-    imuTrans.rot_x = loam::Angle(_ang.y - _ang0.y);
-    imuTrans.rot_y = loam::Angle(_ang.z - _ang0.z);
-    imuTrans.rot_z = loam::Angle(_ang.x - _ang0.x);
+    frame.imuTrans.pos = loam::Vector3(frame.shv.y - _shv0.y, frame.shv.z - _shv0.z, frame.shv.x - _shv0.x);
+    frame.imuTrans.rot_x = loam::Angle(frame.ang.y - _ang0.y);
+    frame.imuTrans.rot_y = loam::Angle(frame.ang.z - _ang0.z);
+    frame.imuTrans.rot_z = loam::Angle(frame.ang.x - _ang0.x);
 
-    laserOdometry.spin(cornerPointsSharp.makeShared(),
-                       cornerPointsLessSharp.makeShared(),
-                       surfacePointsFlat.makeShared(),
-                       surfacePointsLessFlat.makeShared(),
-                       laserCloud.makeShared(),
-                       imuTrans, millsec);
-    _transformSum = laserOdometry.transformSum();
+    _ang0 = frame.ang;
+    _shv0 = frame.shv;
+}
 
-    laserMapping.spin(cornerPointsSharp.makeShared(),
-                      surfacePointsFlat.makeShared(),
-                      laserCloud.makeShared(),
-                      _transformSum, millsec);
-    _transformAftMapped = laserMapping.transformAftMapped();
+void DsvlProcessor::odometryFrame(LoamFrame& frame) {
+    AllocationScope allocationScope(frame.allocations, frame.allocatedBytes);
+    laserOdometry.spin(frame.cornerPointsSharp,
+                       frame.cornerPointsLessSharp,
+                       frame.surfacePointsFlat,
+                       frame.surfacePointsLessFlat,
+                       frame.laserCloud,
+                       frame.imuTrans, frame.millsec);
+    frame.transformSum = laserOdometry.transformSum();
+}
+
+void DsvlProcessor::mappingFrame(LoamFrame& frame) {
+    AllocationScope allocationScope(frame.allocations, frame.allocatedBytes);
+    laserMapping.spin(frame.cornerPointsSharp,
+                      frame.surfacePointsFlat,
+                      frame.laserCloud,
+                      frame.transformSum, frame.millsec);
+    frame.transformAftMapped = laserMapping.transformAftMapped();
+    frame.cornerFromMapNum = laserMapping.laserCloudCornerFromMapNum();
+    frame.surfFromMapNum = laserMapping.laserCloudSurfFromMapNum();
+    frame.mappingOptimizationTime = laserMapping.optimizationTime();
+}
+
+void DsvlProcessor::finishFrame(LoamFrame& frame) {
+    transformImuToInit(frame);
+
+    num = frame.num;
+    millsec = frame.millsec;
+    _ang = frame.ang;
+    _shv = frame.shv;
+    pts = frame.pts;
+    laserCloud = frame.laserCloud;
+    cornerPointsSharp = frame.cornerPointsSharp;
+    cornerPointsLessSharp = frame.cornerPointsLessSharp;
+    surfacePointsFlat = frame.surfacePointsFlat;
+    surfacePointsLessFlat = frame.surfacePointsLessFlat;
+    _transformSum = frame.transformSum;
+    _transformAftMapped = frame.transformAftMapped;
+    _cornerFromMapNum = frame.cornerFromMapNum;
+    _surfFromMapNum = frame.surfFromMapNum;
+    _mappingOptimizationTime = frame.mappingOptimizationTime;
+    _allocations = frame.allocations;
+    _allocatedBytes = frame.allocatedBytes;
+
+    _finishedFrames++;
+    _cornerFromMapSum += _cornerFromMapNum;
+    _surfFromMapSum += _surfFromMapNum;
+    _mappingOptimizationTimeSum += _mappingOptimizationTime;
+    _allocationsSum += _allocations;
+    _allocatedBytesSum += _allocatedBytes;
+
+//    _map += *laserCloud;
+
+    if (num%100==0) {
+        printf("%d (%d)\n",num,dFrmNum);
+    }
 
-    transformImuToInit();
+    if (visualizer)
+        visualizer->submit(laserCloud, cornerPointsSharp, cornerPointsLessSharp, surfacePointsFlat);
 
-//    _map += laserCloud;
+//    int ix0, ix1, iy0, iy1;
+//    bool bound0 = transformToCanvas(_shv0.x, _shv0.z, ix0, iy0);
+//    bool bound1 = transformToCanvas(_shv.x, _shv.z, ix1, iy1);
+//    if (bound0 && bound1)
+//        cv::line(_canvas, cv::Point(ix0,iy0), cv::Point(ix1,iy1), cv::Scalar(0,0,255), 5, CV_AA);
+//    cv::imshow("Traj", _canvas);
+//    cv::waitKey(100);
 
-    _ang0 = _ang;
-    _shv0 = _shv;
+    printLog();
 }
 
 void DsvlProcessor::printLog() {
-    std::printf("[num, %d], [timestamp, %d], ", num, onefrm->dsv[0].millisec);
+    std::printf("[num, %d], [timestamp, %d], ", num, millsec);
     std::printf("[laserCloud, %zu], [cornerPointsSharp, %zu], [cornerPointsLessSharp, %zu], [surfacePointsFlat, %zu], [surfacePointsLessFlat, %zu]\n",\
-    laserCloud.size(), cornerPointsSharp.size(), cornerPointsLessSharp.size(),\
-    surfacePointsFlat.size(), surfacePointsLessFlat.size());
+    laserCloud->size(), cornerPointsSharp->size(), cornerPointsLessSharp->size(),\
+    surfacePointsFlat->size(), surfacePointsLessFlat->size());
+    std::printf("[cornerFromMap, %zu], [surfFromMap, %zu], [mappingOptimization, %.2f ms]\n",
+                _cornerFromMapNum, _surfFromMapNum, _mappingOptimizationTime);
+    if (AllocationCounter::enabled())
+        std::printf("[allocations, %zu], [allocatedBytes, %zu]\n", _allocations, _allocatedBytes);
     std::printf("[x, %f], [y, %f], [z, %f], [pitch, %f], [yaw, %f], [roll, %f]\n",
             _transformSum.pos.x(),
             _transformSum.pos.y(),
@@ -223,11 +310,11 @@ void DsvlProcessor::printLog() {
             _transformAftMapped.rot_z.deg());
 }
 
-void DsvlProcessor::updateTransformToInit() {
-    point3d shv_now = _shv;
-    point3d ang_now = _ang;
-    ang_now.x = _ang.y;
-    ang_now.y = _ang.x;
+void DsvlProcessor::updateTransformToInit(LoamFrame& frame) {
+    point3d shv_now = frame.shv;
+    point3d ang_now = frame.ang;
+    ang_now.x = frame.ang.y;
+    ang_now.y = frame.ang.x;
     double shv_x = shv_now.x - _initShv.x;
     double shv_y = shv_now.y - _initShv.y;
     double shv_z = shv_now.z - _initShv.z;
@@ -240,7 +327,7 @@ void DsvlProcessor::updateTransformToInit() {
     {
         for(int j=0;j<4;j++) {
             if (j < 3) {
-                _rTransMat(i, j) = rot.at<double>(i,j);
+                frame.rTransMat(i, j) = rot.at<double>(i,j);
             }
         }
     }
@@ -252,9 +339,9 @@ void DsvlProcessor::transformToIMU(const pcl::PointXYZI &pi, pcl::PointXYZI &po)
     po.x = pt_.y; po.y = pt_.z; po.z = pt_.x;
 }
 
-void DsvlProcessor::transformToInit(const pcl::PointXYZI& pi, pcl::PointXYZI& po) {
+void DsvlProcessor::transformToInit(const pcl::PointXYZI& pi, pcl::PointXYZI& po, const LoamFrame& frame) {
     po = pi;
-    cv::Point3d pt = _rTransMat * cv::Point3d(pi.z, pi.x, pi.y) + cv::Point3d(_shv.x, _shv.y, _shv.z);
+    cv::Point3d pt = frame.rTransMat * cv::Point3d(pi.z, pi.x, pi.y) + cv::Point3d(frame.shv.x, frame.shv.y, frame.shv.z);
     po.x = pt.y; po.y = pt.z; po.z = pt.x;
 }
 
@@ -282,63 +369,63 @@ void DsvlProcessor::loadCalibFile(string filename) {
     }
 }
 
-void DsvlProcessor::transformPclToIMU() {
-    size_t laserCloudNum = laserCloud.points.size();
+void DsvlProcessor::transformPclToIMU(LoamFrame& frame) {
+    size_t laserCloudNum = frame.laserCloud->points.size();
     for (int i = 0; i < laserCloudNum; i++) {
-        transformToIMU(laserCloud.points[i], laserCloud.points[i]);
+        transformToIMU(frame.laserCloud->points[i], frame.laserCloud->points[i]);
     }
 
-    size_t cornerPointsSharpNum = cornerPointsSharp.points.size();
+    size_t cornerPointsSharpNum = frame.cornerPointsSharp->points.size();
     for (int i = 0; i < cornerPointsSharpNum; i++) {
-        transformToIMU(cornerPointsSharp.points[i], cornerPointsSharp.points[i]);
+        transformToIMU(frame.cornerPointsSharp->points[i], frame.cornerPointsSharp->points[i]);
     }
 
-    size_t cornerPointsLessSharpNum = cornerPointsLessSharp.points.size();
+    size_t cornerPointsLessSharpNum = frame.cornerPointsLessSharp->points.size();
     for (int i = 0; i < cornerPointsLessSharpNum; i++) {
-        transformToIMU(cornerPointsLessSharp.points[i], cornerPointsLessSharp.points[i]);
+        transformToIMU(frame.cornerPointsLessSharp->points[i], frame.cornerPointsLessSharp->points[i]);
     }
 
-    size_t surfacePointsFlatNum = surfacePointsFlat.points.size();
+    size_t surfacePointsFlatNum = frame.surfacePointsFlat->points.size();
     for (int i = 0; i < surfacePointsFlatNum; i++) {
-        transformToIMU(surfacePointsFlat.points[i], surfacePointsFlat.points[i]);
+        transformToIMU(frame.surfacePointsFlat->points[i], frame.surfacePointsFlat->points[i]);
     }
 
-    size_t surfacePointsLessFlatNum = surfacePointsFlat.points.size();
+    size_t surfacePointsLessFlatNum = frame.surfacePointsFlat->points.size();
     for (int i = 0; i < surfacePointsLessFlatNum; i++) {
-        transformToIMU(surfacePointsLessFlat.points[i], surfacePointsLessFlat.points[i]);
+        transformToIMU(frame.surfacePointsLessFlat->points[i], frame.surfacePointsLessFlat->points[i]);
     }
 }
 
-void DsvlProcessor::transformImuToInit() {
-    size_t laserCloudNum = laserCloud.points.size();
+void DsvlProcessor::transformImuToInit(LoamFrame& frame) {
+    size_t laserCloudNum = frame.laserCloud->points.size();
     for (int i = 0; i < laserCloudNum; i++) {
-        transformToInit(laserCloud.points[i], laserCloud.points[i]);
+        transformToInit(frame.laserCloud->points[i], frame.laserCloud->points[i], frame);
     }
 
-    size_t cornerPointsSharpNum = cornerPointsSharp.points.size();
+    size_t cornerPointsSharpNum = frame.cornerPointsSharp->points.size();
     for (int i = 0; i < cornerPointsSharpNum; i++) {
-        transformToInit(cornerPointsSharp.points[i], cornerPointsSharp.points[i]);
+        transformToInit(frame.cornerPointsSharp->points[i], frame.cornerPointsSharp->points[i], frame);
     }
 
-    size_t cornerPointsLessSharpNum = cornerPointsLessSharp.points.size();
+    size_t cornerPointsLessSharpNum = frame.cornerPointsLessSharp->points.size();
     for (int i = 0; i < cornerPointsLessSharpNum; i++) {
-        transformToInit(cornerPointsLessSharp.points[i], cornerPointsLessSharp.points[i]);
+        transformToInit(frame.cornerPointsLessSharp->points[i], frame.cornerPointsLessSharp->points[i], frame);
     }
 
-    size_t surfacePointsFlatNum = surfacePointsFlat.points.size();
+    size_t surfacePointsFlatNum = frame.surfacePointsFlat->points.size();
     for (int i = 0; i < surfacePointsFlatNum; i++) {
-        transformToInit(surfacePointsFlat.points[i], surfacePointsFlat.points[i]);
+        transformToInit(frame.surfacePointsFlat->points[i], frame.surfacePointsFlat->points[i], frame);
     }
 
-    size_t surfacePointsLessFlatNum = surfacePointsFlat.points.size();
+    size_t surfacePointsLessFlatNum = frame.surfacePointsFlat->points.size();
     for (int i = 0; i < surfacePointsLessFlatNum; i++) {
-        transformToInit(surfacePointsLessFlat.points[i], surfacePointsLessFlat.points[i]);
+        transformToInit(frame.surfacePointsLessFlat->points[i], frame.surfacePointsLessFlat->points[i], frame);
     }
 }
 
 DsvlProcessor::~DsvlProcessor() {
     std::fclose(fout);
-    dfp.close();
+    reader.close();
 }
 
 bool DsvlProcessor::transformToCanvas(const float x_, const float y_, int &ix_, int &iy_) {
@@ -14,9 +14,13 @@
 
 #include <pcl/io/pcd_io.h>
 #include <pcl/point_types.h>
-#include <pcl/visualization/pcl_visualizer.h>
 
 #include "types.h"
+#include "allocationcounter.h"
+#include "dsvlreader.h"
+#include "dsvlprefetcher.h"
+#include "spscring.h"
+#include "featurevisualizer.h"
 #include "loam_velodyne/MultiScanRegistration.h"
 #include "loam_velodyne/LaserOdometry.h"
 #include "loam_velodyne/LaserMapping.h"
@@ -25,51 +29,178 @@ using namespace std;
 
 typedef pcl::PointXYZ pointT;
 
+struct DsvlProcessorParams
+{
+    /** Index of the first frame to process. */
+    int startFrame;
+
+    /** Index one past the last frame to process, negative for the end of the log. */
+    int endFrame;
+
+    /** Number of frames paged in ahead of the one being decoded. */
+    int readAhead;
+
+    /** Number of decoded frames buffered ahead of processing, 0 to decode synchronously. */
+    int prefetchDepth;
+
+    /** Drop newly decoded frames instead of waiting when the prefetch buffer is full. */
+    bool prefetchDropWhenFull;
+
+    /** Run registration, odometry and mapping on their own threads instead of one after another. */
+    bool pipelined;
+
+    /** Number of frames queued between two pipeline stages. */
+    int pipelineDepth;
+
+    /** Never open a viewer, for batch runs without a display. */
+    bool headless;
+
+    /** Show only every n-th frame in the viewer. */
+    int visualizeEvery;
+
+    /** Number of threads each LOAM stage may use. 0 splits the cores among the stages
+     *  running at the same time, i.e. a third each when pipelined. */
+    int threads;
+
+    /** Feed the extractor the sensor's beam/firing layout instead of recovering rings from point angles. */
+    bool organized;
+
+    /** Add the point-to-edge residuals of the corner points in mapping, see loam::LaserMappingParams. */
+    bool edgeResiduals;
+
+    /** Search only the map cubes within the sensor's field of view in mapping, instead of all 5x5x5 around it. */
+    bool fovCulling;
+
+    DsvlProcessorParams(const int& startFrame_ = 299,
+                        const int& endFrame_ = 450,
+                        const int& readAhead_ = 8,
+                        const int& prefetchDepth_ = 4,
+                        const bool& prefetchDropWhenFull_ = false,
+                        const bool& pipelined_ = true,
+                        const int& pipelineDepth_ = 2,
+                        const bool& headless_ = false,
+                        const int& visualizeEvery_ = 1,
+                        const int& threads_ = 0,
+                        const bool& organized_ = true,
+                        const bool& edgeResiduals_ = false,
+                        const bool& fovCulling_ = true)
+    : startFrame(startFrame_),
+      endFrame(endFrame_),
+      readAhead(readAhead_),
+      prefetchDepth(prefetchDepth_),
+      prefetchDropWhenFull(prefetchDropWhenFull_),
+      pipelined(pipelined_),
+      pipelineDepth(pipelineDepth_),
+      headless(headless_),
+      visualizeEvery(visualizeEvery_),
+      threads(threads_),
+      organized(organized_),
+      edgeResiduals(edgeResiduals_),
+      fovCulling(fovCulling_)
+    { }
+};
+
+/// State of one frame handed from stage to stage of the LOAM pipeline.
+struct LoamFrame
+{
+    typedef boost::shared_ptr<LoamFrame> Ptr;
+
+    int num;                    ///< 1-based frame number
+    int millsec;                ///< time stamp
+    point3d ang;                ///< vehicle attitude
+    point3d shv;                ///< vehicle position
+    cv::Matx33d rTransMat;      ///< rotation from the IMU frame to the initial frame
+    pcl::PointCloud<pointT>::Ptr pts;
+
+    // allocated once per frame and shared, never copied, with the LOAM stages
+    // and the visualizer; only the stage owning the frame may modify them
+    pcl::PointCloud<pcl::PointXYZI>::Ptr laserCloud;
+    pcl::PointCloud<pcl::PointXYZI>::Ptr cornerPointsSharp;
+    pcl::PointCloud<pcl::PointXYZI>::Ptr cornerPointsLessSharp;
+    pcl::PointCloud<pcl::PointXYZI>::Ptr surfacePointsFlat;
+    pcl::PointCloud<pcl::PointXYZI>::Ptr surfacePointsLessFlat;
+
+    loam::Twist imuTrans;               ///< IMU motion since the previous frame
+    loam::Twist transformSum;           ///< odometry result
+    loam::Twist transformAftMapped;     ///< mapping result
+    size_t cornerFromMapNum;            ///< corner map points searched by mapping
+    size_t surfFromMapNum;              ///< surface map points searched by mapping
+    double mappingOptimizationTime;     ///< time of the mapping pose optimization in ms
+    size_t allocations;                 ///< heap allocations of the stages, with LOAM_COUNT_ALLOCATIONS
+    size_t allocatedBytes;              ///< bytes requested by them
+
+    LoamFrame(): num(0), millsec(0), ang(), shv(), cornerFromMapNum(0), surfFromMapNum(0), mappingOptimizationTime(0),
+                 allocations(0), allocatedBytes(0) {}
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
 class DsvlProcessor
 {
 public:
-    DsvlProcessor(std::string dsvl_, std::string calib_);
+    DsvlProcessor(std::string dsvl_, std::string calib_,
+                  const DsvlProcessorParams& params_ = DsvlProcessorParams());
     ~DsvlProcessor();
     void Processing();
 
 private:
-    bool ReadOneDsvlFrame ();
-    void ProcessOneFrame ();
+    typedef SpscRing<LoamFrame::Ptr> FrameQueue;
+
+    void runSynchronous(DsvlPrefetcher& prefetcher);
+    void runPipelined(DsvlPrefetcher& prefetcher);
+    void runStage(FrameQueue& in, FrameQueue& out, void (DsvlProcessor::*stage)(LoamFrame&));
+
+    // pipeline stages, each one only touches its own members
+    void registerFrame(const DsvlFrame& input, LoamFrame& frame);
+    void odometryFrame(LoamFrame& frame);
+    void mappingFrame(LoamFrame& frame);
+    void finishFrame(LoamFrame& frame);
+
     void printLog();
     void transformToIMU(const pcl::PointXYZI& pi, pcl::PointXYZI& po);
-    void transformToInit(const pcl::PointXYZI& pi, pcl::PointXYZI& po);
+    void transformToInit(const pcl::PointXYZI& pi, pcl::PointXYZI& po, const LoamFrame& frame);
     void loadCalibFile(std::string);
-    void updateTransformToInit();
-    void transformPclToIMU();
-    void transformImuToInit();
+    void updateTransformToInit(LoamFrame& frame);
+    void transformPclToIMU(LoamFrame& frame);
+    void transformImuToInit(LoamFrame& frame);
     bool transformToCanvas(const float x_, const float y_, int& ix_, int& iy_);
 
 private:
     cv::Mat _canvas;
 
-    pcl::visualization::PCLVisualizer::Ptr viewer;
+    FeatureVisualizer::Ptr visualizer;   ///< NULL in headless mode
     pcl::PointCloud<pointT>::Ptr pts;
-    pcl::visualization::PointCloudColorHandlerGenericField<pointT>::Ptr handler;
 
-    pcl::PointCloud<pcl::PointXYZI> laserCloud;
-    pcl::PointCloud<pcl::PointXYZI> cornerPointsSharp;
-    pcl::PointCloud<pcl::PointXYZI> cornerPointsLessSharp;
-    pcl::PointCloud<pcl::PointXYZI> surfacePointsFlat;
-    pcl::PointCloud<pcl::PointXYZI> surfacePointsLessFlat;
+    pcl::PointCloud<pcl::PointXYZI>::ConstPtr laserCloud;
+    pcl::PointCloud<pcl::PointXYZI>::ConstPtr cornerPointsSharp;
+    pcl::PointCloud<pcl::PointXYZI>::ConstPtr cornerPointsLessSharp;
+    pcl::PointCloud<pcl::PointXYZI>::ConstPtr surfacePointsFlat;
+    pcl::PointCloud<pcl::PointXYZI>::ConstPtr surfacePointsLessFlat;
 
     pcl::PointCloud<pcl::PointXYZI> _map;
 
     loam::Twist _transformSum;
     loam::Twist _transformAftMapped;
-
-    int dsvlbytesiz;
-    int dsvbytesiz;
-    int labbytesiz;
+    size_t _cornerFromMapNum;
+    size_t _surfFromMapNum;
+    double _mappingOptimizationTime;
+    size_t _allocations;
+    size_t _allocatedBytes;
+
+    // sums over all finished frames, for the summary
+    int _finishedFrames;
+    double _cornerFromMapSum;
+    double _surfFromMapSum;
+    double _mappingOptimizationTimeSum;
+    double _allocationsSum;
+    double _allocatedBytesSum;
+
+    DsvlProcessorParams params;
+    DsvlReader reader;
     int dFrmNum;
-    ONEDSVFRAME	*onefrm;
-    std::ifstream dfp;
+    int millsec;
     bool isRunning;
-    bool  isInited;
+    bool  isPoseInited;
     FILE *fout;
     int num;
 
@@ -82,7 +213,6 @@ private:
     point3d calib_ang;
     point3d calib_shv;
     cv::Matx33d _cTransMat;
-    cv::Matx33d _rTransMat;
 
     loam::MultiScanRegistration featureExtractor;
     loam::LaserOdometry laserOdometry;
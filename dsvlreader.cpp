@@ -0,0 +1,110 @@
+#include "dsvlreader.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+DsvlReader::DsvlReader():
+_fd(-1),
+_data(NULL),
+_size(0),
+_frameBytes(sizeof(ONEDSVDATA) * BKNUM_PER_FRM),
+_frameNum(0),
+_released(0)
+{
+}
+
+DsvlReader::~DsvlReader()
+{
+    close();
+}
+
+bool DsvlReader::open(const std::string &filename)
+{
+    close();
+
+    _fd = ::open(filename.c_str(), O_RDONLY);
+    if (_fd < 0) {
+        printf("File open failure : %s\n", filename.c_str());
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(_fd, &st) != 0 || st.st_size < (off_t)_frameBytes) {
+        printf("File too short for one frame : %s\n", filename.c_str());
+        close();
+        return false;
+    }
+
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, _fd, 0);
+    if (addr == MAP_FAILED) {
+        printf("File mmap failure : %s\n", filename.c_str());
+        close();
+        return false;
+    }
+
+    _data = (const char *)addr;
+    _size = st.st_size;
+    // a trailing partial frame is ignored, as the stream reader did
+    _frameNum = _size / _frameBytes;
+
+    madvise(addr, _size, MADV_SEQUENTIAL);
+    return true;
+}
+
+void DsvlReader::close()
+{
+    if (_data) {
+        munmap((void *)_data, _size);
+        _data = NULL;
+    }
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+    _size = 0;
+    _frameNum = 0;
+    _released = 0;
+}
+
+const ONEDSVDATA* DsvlReader::frame(size_t idx) const
+{
+    if (idx >= _frameNum)
+        return NULL;
+    return (const ONEDSVDATA *)(_data + idx * _frameBytes);
+}
+
+void DsvlReader::prefetch(size_t idx, size_t count) const
+{
+    if (idx >= _frameNum)
+        return;
+    size_t last = idx + count < _frameNum ? idx + count : _frameNum;
+    advise(idx * _frameBytes, last * _frameBytes, MADV_WILLNEED);
+}
+
+void DsvlReader::release(size_t idx) const
+{
+    if (idx > _frameNum)
+        idx = _frameNum;
+    // keep the page shared with frame idx mapped
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t end = idx * _frameBytes;
+    end -= end % pageSize;
+    if (end <= _released)
+        return;
+    advise(_released, end, MADV_DONTNEED);
+    _released = end;
+}
+
+void DsvlReader::advise(size_t begin, size_t end, int advice) const
+{
+    // madvise wants a page aligned start address
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+    begin -= begin % pageSize;
+    if (!_data || end <= begin)
+        return;
+    madvise((void *)(_data + begin), end - begin, advice);
+}
@@ -0,0 +1,53 @@
+#ifndef DSVLREADER_H
+#define DSVLREADER_H
+
+#include <stddef.h>
+#include <string>
+
+#include "types.h"
+
+/// Read-only, memory-mapped view of a DSVL log.
+///
+/// A frame is BKNUM_PER_FRM consecutive ONEDSVDATA blocks. frame() hands out
+/// a pointer straight into the mapping, so frames can be visited in any order
+/// without reading the blocks before them. The returned pointer stays valid
+/// until close() is called.
+class DsvlReader
+{
+public:
+    DsvlReader();
+    ~DsvlReader();
+
+    bool open(const std::string& filename);
+    void close();
+
+    bool isOpen() const { return _data != NULL; }
+    size_t frameCount() const { return _frameNum; }
+
+    /// Blocks of frame idx, or NULL if idx is out of range.
+    const ONEDSVDATA* frame(size_t idx) const;
+
+    /// Ask the kernel to page in frames [idx, idx+count) ahead of use.
+    void prefetch(size_t idx, size_t count) const;
+
+    /// Tell the kernel frames [0, idx) will not be touched again.
+    ///
+    /// Only the part not released by an earlier call is advised, so the cost
+    /// does not grow with the position in the log.
+    void release(size_t idx) const;
+
+private:
+    DsvlReader(const DsvlReader&);
+    DsvlReader& operator=(const DsvlReader&);
+
+    void advise(size_t begin, size_t end, int advice) const;
+
+    int _fd;
+    const char *_data;
+    size_t _size;
+    size_t _frameBytes;
+    size_t _frameNum;
+    mutable size_t _released;   ///< end of the prefix already released, page aligned
+};
+
+#endif // DSVLREADER_H
@@ -0,0 +1,96 @@
+#include "featurevisualizer.h"
+
+
+FeatureVisualizer::FeatureVisualizer(int decimation):
+_decimation(decimation > 0 ? decimation : 1),
+_submitted(0),
+_hasPending(false),
+_stop(false)
+{
+    _thread = std::thread(&FeatureVisualizer::run, this);
+}
+
+FeatureVisualizer::~FeatureVisualizer()
+{
+    _stop = true;
+    if (_thread.joinable())
+        _thread.join();
+}
+
+void FeatureVisualizer::submit(const Cloud::ConstPtr &laserCloud,
+                               const Cloud::ConstPtr &cornerPointsSharp,
+                               const Cloud::ConstPtr &cornerPointsLessSharp,
+                               const Cloud::ConstPtr &surfacePointsFlat)
+{
+    // the window has been closed
+    if (_stop)
+        return;
+    if (_submitted++ % _decimation != 0)
+        return;
+
+    Clouds clouds;
+    clouds.laserCloud = laserCloud;
+    clouds.cornerPointsSharp = cornerPointsSharp;
+    clouds.cornerPointsLessSharp = cornerPointsLessSharp;
+    clouds.surfacePointsFlat = surfacePointsFlat;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _pending = clouds;
+    _hasPending = true;
+}
+
+void FeatureVisualizer::run()
+{
+    // VTK wants the window to be used only from the thread that created it
+    pcl::visualization::PCLVisualizer viewer("Feature-Vis");
+    viewer.setBackgroundColor(0,0,0);
+    viewer.addCoordinateSystem(1.0);
+
+    bool added = false;
+    while (!viewer.wasStopped()) {
+        Clouds clouds;
+        bool hasClouds = false;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_hasPending) {
+                clouds = _pending;
+                _pending = Clouds();
+                _hasPending = false;
+                hasClouds = true;
+            }
+        }
+
+        if (hasClouds)
+            show(viewer, clouds, added);
+        else if (_stop)
+            break;
+
+        viewer.spinOnce(100);
+    }
+    _stop = true;
+}
+
+void FeatureVisualizer::show(pcl::visualization::PCLVisualizer &viewer, const Clouds &clouds, bool &added)
+{
+    pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZI> colorLaserCloud(clouds.laserCloud, 255, 255, 255);
+    pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZI> colorCornerPointsSharp(clouds.cornerPointsSharp, 255, 0, 0);
+    pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZI> colorCornerPointsLessSharp(clouds.cornerPointsLessSharp, 255, 255, 0);
+    pcl::visualization::PointCloudColorHandlerCustom<pcl::PointXYZI> colorSurfacePointsFlat(clouds.surfacePointsFlat, 0, 255, 0);
+    if (!added)
+    {
+        viewer.addPointCloud<pcl::PointXYZI>(clouds.laserCloud, colorLaserCloud, "laserCloud");
+        viewer.addPointCloud<pcl::PointXYZI>(clouds.cornerPointsSharp, colorCornerPointsSharp, "cornerPointsSharp");
+        viewer.addPointCloud<pcl::PointXYZI>(clouds.cornerPointsLessSharp, colorCornerPointsLessSharp, "cornerPointsLessSharp");
+        viewer.addPointCloud<pcl::PointXYZI>(clouds.surfacePointsFlat, colorSurfacePointsFlat, "surfacePointsFlat");
+        added = true;
+    }
+    else {
+        viewer.updatePointCloud<pcl::PointXYZI>(clouds.laserCloud, colorLaserCloud, "laserCloud");
+        viewer.updatePointCloud<pcl::PointXYZI>(clouds.cornerPointsSharp, colorCornerPointsSharp, "cornerPointsSharp");
+        viewer.updatePointCloud<pcl::PointXYZI>(clouds.cornerPointsLessSharp, colorCornerPointsLessSharp, "cornerPointsLessSharp");
+        viewer.updatePointCloud<pcl::PointXYZI>(clouds.surfacePointsFlat, colorSurfacePointsFlat, "surfacePointsFlat");
+    }
+    viewer.setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 5, "cornerPointsSharp");
+    viewer.setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 3, "cornerPointsLessSharp");
+    viewer.setPointCloudRenderingProperties(pcl::visualization::PCL_VISUALIZER_POINT_SIZE, 4, "surfacePointsFlat");
+}
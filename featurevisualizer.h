@@ -0,0 +1,59 @@
+#ifndef FEATUREVISUALIZER_H
+#define FEATUREVISUALIZER_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/visualization/pcl_visualizer.h>
+
+/// Shows the extracted features of every decimation-th frame in a PCL viewer.
+///
+/// The viewer is created, updated and spun on a thread of its own, so the
+/// processing loop never waits for rendering. submit() shares the clouds
+/// instead of copying them, so they must not be modified afterwards. A frame
+/// that has not been drawn yet is replaced by the newer one.
+class FeatureVisualizer
+{
+public:
+    typedef boost::shared_ptr<FeatureVisualizer> Ptr;
+    typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+
+    explicit FeatureVisualizer(int decimation);
+    ~FeatureVisualizer();
+
+    /// Hand over the clouds of the next frame, returns without waiting for the viewer.
+    void submit(const Cloud::ConstPtr& laserCloud,
+                const Cloud::ConstPtr& cornerPointsSharp,
+                const Cloud::ConstPtr& cornerPointsLessSharp,
+                const Cloud::ConstPtr& surfacePointsFlat);
+
+private:
+    FeatureVisualizer(const FeatureVisualizer&);
+    FeatureVisualizer& operator=(const FeatureVisualizer&);
+
+    struct Clouds
+    {
+        Cloud::ConstPtr laserCloud;
+        Cloud::ConstPtr cornerPointsSharp;
+        Cloud::ConstPtr cornerPointsLessSharp;
+        Cloud::ConstPtr surfacePointsFlat;
+    };
+
+    void run();
+    void show(pcl::visualization::PCLVisualizer& viewer, const Clouds& clouds, bool& added);
+
+    const int _decimation;
+    int _submitted;
+
+    std::mutex _mutex;
+    Clouds _pending;
+    bool _hasPending;
+
+    std::atomic<bool> _stop;
+    std::thread _thread;
+};
+
+#endif // FEATUREVISUALIZER_H
@@ -0,0 +1,107 @@
+#include "loam_velodyne/Curvature.h"
+
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LOAM_CURVATURE_AVX2
+#include <immintrin.h>
+#endif
+
+
+namespace loam {
+
+/** \brief Curvature of the points [beginIdx, endIdx), which must all have region neighbors on both sides. */
+static void curvatureRange(const float* x, const float* y, const float* z,
+                           const size_t& beginIdx, const size_t& endIdx,
+                           const int& region, float* curvature)
+{
+  float pointWeight = -2 * region;
+
+  for (size_t i = beginIdx; i < endIdx; i++) {
+    float diffX = pointWeight * x[i];
+    float diffY = pointWeight * y[i];
+    float diffZ = pointWeight * z[i];
+
+    for (int j = 1; j <= region; j++) {
+      diffX += x[i + j] + x[i - j];
+      diffY += y[i + j] + y[i - j];
+      diffZ += z[i + j] + z[i - j];
+    }
+
+    curvature[i] = diffX * diffX + diffY * diffY + diffZ * diffZ;
+  }
+}
+
+
+
+#ifdef LOAM_CURVATURE_AVX2
+
+/** \brief AVX2 version of curvatureRange(), eight points at a time.
+ *
+ * Every lane performs the same operations in the same order as the scalar loop.
+ * No FMA is used, as contracting the multiply-add would change the rounding.
+ */
+__attribute__((target("avx2")))
+static void curvatureRangeAVX2(const float* x, const float* y, const float* z,
+                               const size_t& beginIdx, const size_t& endIdx,
+                               const int& region, float* curvature)
+{
+  const __m256 pointWeight = _mm256_set1_ps(float(-2 * region));
+
+  size_t i = beginIdx;
+  for (; i + 8 <= endIdx; i += 8) {
+    __m256 diffX = _mm256_mul_ps(pointWeight, _mm256_loadu_ps(x + i));
+    __m256 diffY = _mm256_mul_ps(pointWeight, _mm256_loadu_ps(y + i));
+    __m256 diffZ = _mm256_mul_ps(pointWeight, _mm256_loadu_ps(z + i));
+
+    for (int j = 1; j <= region; j++) {
+      diffX = _mm256_add_ps(diffX, _mm256_add_ps(_mm256_loadu_ps(x + i + j), _mm256_loadu_ps(x + i - j)));
+      diffY = _mm256_add_ps(diffY, _mm256_add_ps(_mm256_loadu_ps(y + i + j), _mm256_loadu_ps(y + i - j)));
+      diffZ = _mm256_add_ps(diffZ, _mm256_add_ps(_mm256_loadu_ps(z + i + j), _mm256_loadu_ps(z + i - j)));
+    }
+
+    __m256 sum = _mm256_add_ps(_mm256_mul_ps(diffX, diffX), _mm256_mul_ps(diffY, diffY));
+    _mm256_storeu_ps(curvature + i, _mm256_add_ps(sum, _mm256_mul_ps(diffZ, diffZ)));
+  }
+
+  curvatureRange(x, y, z, i, endIdx, region, curvature);
+}
+
+#endif
+
+
+
+void computeCurvatureScalar(const float* x, const float* y, const float* z,
+                            const size_t& size, const int& region, float* curvature)
+{
+  std::fill(curvature, curvature + size, 0.0f);
+  if (region < 0 || size <= 2 * size_t(region)) {
+    return;
+  }
+
+  curvatureRange(x, y, z, region, size - region, region, curvature);
+}
+
+
+
+void computeCurvature(const float* x, const float* y, const float* z,
+                      const size_t& size, const int& region, float* curvature)
+{
+#ifdef LOAM_CURVATURE_AVX2
+  static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+
+  if (hasAVX2) {
+    std::fill(curvature, curvature + size, 0.0f);
+    if (region < 0 || size <= 2 * size_t(region)) {
+      return;
+    }
+
+    curvatureRangeAVX2(x, y, z, region, size - region, region, curvature);
+    return;
+  }
+#endif
+
+  computeCurvatureScalar(x, y, z, size, region, curvature);
+}
+
+} // end namespace loam
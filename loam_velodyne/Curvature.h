@@ -0,0 +1,37 @@
+#ifndef LOAM_CURVATURE_H
+#define LOAM_CURVATURE_H
+
+
+#include <stddef.h>
+
+
+namespace loam {
+
+/** \brief Compute the LOAM curvature of all points of one scan ring.
+ *
+ * The ring is given in SoA layout. For every point i in [region, size - region)
+ * the curvature is the squared norm of
+ *   sum_{j = 1..region} (p[i + j] + p[i - j]) - 2 * region * p[i],
+ * evaluated in exactly the order of the scalar loop, so the vectorized and the
+ * scalar path give bit identical results (the file is built with FMA contraction
+ * off for that). The remaining entries are set to 0.
+ *
+ * The AVX2 kernel is used when the CPU supports it.
+ *
+ * @param x the x coordinates of the ring
+ * @param y the y coordinates of the ring
+ * @param z the z coordinates of the ring
+ * @param size the number of points of the ring
+ * @param region the number of neighbors on each side
+ * @param curvature the output array of size elements
+ */
+void computeCurvature(const float* x, const float* y, const float* z,
+                      const size_t& size, const int& region, float* curvature);
+
+/** \brief Scalar reference of computeCurvature(). */
+void computeCurvatureScalar(const float* x, const float* y, const float* z,
+                            const size_t& size, const int& region, float* curvature);
+
+} // end namespace loam
+
+#endif //LOAM_CURVATURE_H
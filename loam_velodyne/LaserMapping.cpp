@@ -34,7 +34,11 @@
 #include "common.h"
 #include "nanoflann_pcl.h"
 #include "math_utils.h"
+#include "NormalEquations.h"
+#include "SymmetricEigen3.h"
 
+#include <algorithm>
+#include <chrono>
 #include <Eigen/Eigenvalues>
 #include <Eigen/QR>
 
@@ -47,14 +51,60 @@ using std::asin;
 using std::atan2;
 using std::pow;
 
+/** Number of stack points associated per work item; fixed, so the summation order does not depend on the thread count. */
+static const size_t MAPPING_CHUNK_SIZE = 64;
+
+/** \brief Check if the sensor can see any part of an axis aligned box.
+ *
+ * The box is seen if it intersects the band of elevation angles above the xz
+ * plane between atan(tanMinElevation) and atan(tanMaxElevation), and if its
+ * nearest point is within maxRange. Both the horizontal distance and the
+ * height of the box points span an interval, so the elevation test is exact;
+ * the range test ignores the elevation.
+ *
+ * @param boxMin the lower box corner relative to the sensor
+ * @param boxMax the upper box corner relative to the sensor
+ * @param tanMinElevation the tangent of the lower elevation bound
+ * @param tanMaxElevation the tangent of the upper elevation bound
+ * @param maxRange the maximum range, 0 for no limit
+ */
+static bool isBoxInFOV(const Vector3& boxMin, const Vector3& boxMax,
+                       const float& tanMinElevation, const float& tanMaxElevation,
+                       const float& maxRange)
+{
+  // nearest and farthest horizontal distance of the box
+  float nearX = std::max(0.0f, std::max(boxMin.x(), -boxMax.x()));
+  float nearZ = std::max(0.0f, std::max(boxMin.z(), -boxMax.z()));
+  float farX = std::max(fabs(boxMin.x()), fabs(boxMax.x()));
+  float farZ = std::max(fabs(boxMin.z()), fabs(boxMax.z()));
+  float minDist = sqrt(nearX * nearX + nearZ * nearZ);
+  float maxDist = sqrt(farX * farX + farZ * farZ);
+
+  // the box reaches above the lower and below the upper boundary of the band
+  if (boxMax.y() < std::min(minDist * tanMinElevation, maxDist * tanMinElevation) ||
+      boxMin.y() > std::max(minDist * tanMaxElevation, maxDist * tanMaxElevation)) {
+    return false;
+  }
+
+  if (maxRange > 0) {
+    float nearY = std::max(0.0f, std::max(boxMin.y(), -boxMax.y()));
+    return minDist * minDist + nearY * nearY <= maxRange * maxRange;
+  }
+
+  return true;
+}
+
+/** Number of map neighbors an edge or plane is fitted to. */
+static const size_t MAP_NEIGHBOR_NUM = 5;
+
+/** Squared distance within which all map neighbors have to lie. */
+static const float MAP_NEIGHBOR_SQ_DIS = 1.0f;
+
 
 LaserMapping::LaserMapping(const LaserMappingParams& params)
       : _params(params),
         _frameCount(0),
         _mapFrameCount(0),
-        _laserCloudCenWidth(10),
-        _laserCloudCenHeight(5),
-        _laserCloudCenDepth(10),
         _timeLaserCloudCornerLast(0),
         _timeLaserCloudSurfLast(0),
         _timeLaserCloudFullRes(0),
@@ -72,30 +122,20 @@ LaserMapping::LaserMapping(const LaserMappingParams& params)
         _laserCloudSurfStackDS(new pcl::PointCloud<pcl::PointXYZI>()),
         _laserCloudSurround(new pcl::PointCloud<pcl::PointXYZI>()),
         _laserCloudSurroundDS(new pcl::PointCloud<pcl::PointXYZI>()),
-        _laserCloudCornerFromMap(new pcl::PointCloud<pcl::PointXYZI>()),
-        _laserCloudSurfFromMap(new pcl::PointCloud<pcl::PointXYZI>())
+        _laserCloudCubeDS(new pcl::PointCloud<pcl::PointXYZI>()),
+        _laserCloudCornerFromMapNum(0),
+        _laserCloudSurfFromMapNum(0),
+        _optimizationTime(0),
+        _threadPool(new ThreadPool(params.nThreads))
 {
   // initialize frame counter
   _frameCount = _params.stackFrameNum - 1;
   _mapFrameCount = _params.mapFrameNum - 1;
 
-  // setup cloud vectors
-  _laserCloudCornerArray.resize(_params.laserCloudNum);
-  _laserCloudSurfArray.resize(_params.laserCloudNum);
-  _laserCloudCornerDSArray.resize(_params.laserCloudNum);
-  _laserCloudSurfDSArray.resize(_params.laserCloudNum);
-
-  for (size_t i = 0; i < _params.laserCloudNum; i++) {
-    _laserCloudCornerArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
-    _laserCloudSurfArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
-    _laserCloudCornerDSArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
-    _laserCloudSurfDSArray[i].reset(new pcl::PointCloud<pcl::PointXYZI>());
-  }
-
   // setup down size filters
-  _downSizeFilterCorner.setLeafSize(_params.cornerFilterSize, _params.cornerFilterSize, _params.cornerFilterSize);
-  _downSizeFilterSurf.setLeafSize(_params.surfFilterSize, _params.surfFilterSize, _params.surfFilterSize);
-  _downSizeFilterMap.setLeafSize(_params.mapFilterSize, _params.mapFilterSize, _params.mapFilterSize);
+  _downSizeFilterCorner.setLeafSize(_params.cornerFilterSize);
+  _downSizeFilterSurf.setLeafSize(_params.surfFilterSize);
+  _downSizeFilterMap.setLeafSize(_params.mapFilterSize);
 }
 
 void LaserMapping::transformAssociateToMap()
@@ -224,9 +264,9 @@ void LaserMapping::pointAssociateTobeMapped(const pcl::PointXYZI& pi, pcl::Point
 }
 
 
-void LaserMapping::spin(const pcl::PointCloud<pcl::PointXYZI>::Ptr& laserCloudCornerLast_,
-                        const pcl::PointCloud<pcl::PointXYZI>::Ptr& laserCloudSurfLast_,
-                        const pcl::PointCloud<pcl::PointXYZI>::Ptr& laserCloudFullRes_,
+void LaserMapping::spin(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& laserCloudCornerLast_,
+                        const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& laserCloudSurfLast_,
+                        const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& laserCloudFullRes_,
                         Twist transformSum_,
                         Time timestamp)
 {
@@ -326,162 +366,70 @@ bool LaserMapping::process()
   pointOnYAxis.z = 0.0;
   pointAssociateToMap(pointOnYAxis, pointOnYAxis);
 
-  int centerCubeI = int((_transformTobeMapped.pos.x() + 25.0) / 50.0) + _laserCloudCenWidth;
-  int centerCubeJ = int((_transformTobeMapped.pos.y() + 25.0) / 50.0) + _laserCloudCenHeight;
-  int centerCubeK = int((_transformTobeMapped.pos.z() + 25.0) / 50.0) + _laserCloudCenDepth;
-
-  if (_transformTobeMapped.pos.x() + 25.0 < 0) centerCubeI--;
-  if (_transformTobeMapped.pos.y() + 25.0 < 0) centerCubeJ--;
-  if (_transformTobeMapped.pos.z() + 25.0 < 0) centerCubeK--;
-
-  while (centerCubeI < 3) {
-    for (size_t j = 0; j < _params.laserCloudHeight; j++) {
-      for (size_t k = 0; k < _params.laserCloudDepth; k++) {
-        for (int i = _params.laserCloudWidth - 1; i >= 1; i--) {
-          const size_t indexA = toIndex(i, j, k);
-          const size_t indexB = toIndex(i-1, j, k);
-          std::swap( _laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB] );
-          std::swap( _laserCloudSurfArray[indexA],   _laserCloudSurfArray[indexB]);
-        }
-      }
-    }
-    centerCubeI++;
-    _laserCloudCenWidth++;
-  }
-
-  while (centerCubeI >= (int)_params.laserCloudWidth - 3) {
-    for (size_t j = 0; j < _params.laserCloudHeight; j++) {
-      for (size_t k = 0; k < _params.laserCloudDepth; k++) {
-       for (size_t i = 0; i < _params.laserCloudWidth - 1; i++) {
-          const size_t indexA = toIndex(i, j, k);
-          const size_t indexB = toIndex(i+1, j, k);
-          std::swap( _laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB] );
-          std::swap( _laserCloudSurfArray[indexA],   _laserCloudSurfArray[indexB]);
-        }
-      }
-    }
-    centerCubeI--;
-    _laserCloudCenWidth--;
-  }
-
-  while (centerCubeJ < 3) {
-    for (size_t i = 0; i < _params.laserCloudWidth; i++) {
-      for (size_t k = 0; k < _params.laserCloudDepth; k++) {
-        for (int j = (int)_params.laserCloudHeight - 1; j >= 1; j--) {
-          const size_t indexA = toIndex(i, j, k);
-          const size_t indexB = toIndex(i, j-1, k);
-          std::swap( _laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB] );
-          std::swap( _laserCloudSurfArray[indexA],   _laserCloudSurfArray[indexB]);
-        }
-      }
+  int centerCubeI = toCube(_transformTobeMapped.pos.x());
+  int centerCubeJ = toCube(_transformTobeMapped.pos.y());
+  int centerCubeK = toCube(_transformTobeMapped.pos.z());
+
+  // vertical field of view of the sensor, widened by its tilt against the vertical map axis y
+  float sensorUpY = (pointOnYAxis.y - _transformTobeMapped.pos.y()) / 10.0f;
+  float tilt = rad2deg(std::acos(std::max(-1.0f, std::min(1.0f, sensorUpY))));
+  float tanMinElevation = std::tan(deg2rad(std::max(-89.9f, _params.fovMinElevation - tilt)));
+  float tanMaxElevation = std::tan(deg2rad(std::min(89.9f, _params.fovMaxElevation + tilt)));
+  const float searchRadius = std::sqrt(MAP_NEIGHBOR_SQ_DIS);
+
+  for (const CubeKey& key : _laserCloudValidInd) {
+    CubeMap::iterator cube = _laserCloudCubes.find(key);
+    if (cube != _laserCloudCubes.end()) {
+      cube->second.valid = false;
     }
-    centerCubeJ++;
-    _laserCloudCenHeight++;
   }
-
-  while (centerCubeJ >= (int)_params.laserCloudHeight - 3) {
-    for (size_t i = 0; i < _params.laserCloudWidth; i++) {
-      for (size_t k = 0; k < _params.laserCloudDepth; k++) {
-        for (int j = 0; j < (int)_params.laserCloudHeight - 1; j++) {
-          const size_t indexA = toIndex(i, j, k);
-          const size_t indexB = toIndex(i, j+1, k);
-          std::swap( _laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB] );
-          std::swap( _laserCloudSurfArray[indexA],   _laserCloudSurfArray[indexB]);
-        }
-      }
-    }
-    centerCubeJ--;
-    _laserCloudCenHeight--;
-  }
-
-  while (centerCubeK < 3) {
-    for (size_t i = 0; i < _params.laserCloudWidth; i++) {
-      for (size_t j = 0; j < _params.laserCloudHeight; j++) {
-        for (int k = _params.laserCloudDepth - 1; k >= 1; k--) {
-          const size_t indexA = toIndex(i, j, k);
-          const size_t indexB = toIndex(i, j, k-1);
-          std::swap( _laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB] );
-          std::swap( _laserCloudSurfArray[indexA],   _laserCloudSurfArray[indexB]);
-        }
-      }
-    }
-    centerCubeK++;
-    _laserCloudCenDepth++;
-  }
-
-  while (centerCubeK >= (int)_params.laserCloudDepth - 3) {
-    for (size_t i = 0; i < _params.laserCloudWidth; i++) {
-      for (size_t j = 0; j < _params.laserCloudHeight; j++) {
-        for (size_t k = 0; k < _params.laserCloudDepth - 1; k++) {
-          const size_t indexA = toIndex(i, j, k);
-          const size_t indexB = toIndex(i, j, k+1);
-          std::swap( _laserCloudCornerArray[indexA], _laserCloudCornerArray[indexB] );
-          std::swap( _laserCloudSurfArray[indexA],   _laserCloudSurfArray[indexB]);
-        }
-      }
-    }
-    centerCubeK--;
-    _laserCloudCenDepth--;
-  }
-
   _laserCloudValidInd.clear();
   _laserCloudSurroundInd.clear();
   for (int i = centerCubeI - 2; i <= centerCubeI + 2; i++) {
     for (int j = centerCubeJ - 2; j <= centerCubeJ + 2; j++) {
       for (int k = centerCubeK - 2; k <= centerCubeK + 2; k++) {
-        if (i >= 0 && i < (int)_params.laserCloudWidth &&
-            j >= 0 && j < (int)_params.laserCloudHeight &&
-            k >= 0 && k < (int)_params.laserCloudDepth) {
-
-          float centerX = 50.0f * (i - _laserCloudCenWidth);
-          float centerY = 50.0f * (j - _laserCloudCenHeight);
-          float centerZ = 50.0f * (k - _laserCloudCenDepth);
-
-          pcl::PointXYZI transform_pos = (pcl::PointXYZI) _transformTobeMapped.pos;
-
-          bool isInLaserFOV = true;
-//          bool isInLaserFOV = false;
-//          for (int ii = -1; ii <= 1; ii += 2) {
-//            for (int jj = -1; jj <= 1; jj += 2) {
-//              for (int kk = -1; kk <= 1; kk += 2) {
-//                pcl::PointXYZI corner;
-//                corner.x = centerX + 25.0f * ii;
-//                corner.y = centerY + 25.0f * jj;
-//                corner.z = centerZ + 25.0f * kk;
-//
-//                float squaredSide1 = calcSquaredDiff(transform_pos, corner);
-//                float squaredSide2 = calcSquaredDiff(pointOnYAxis, corner);
-//
-//                float check1 = 100.0f + squaredSide1 - squaredSide2
-//                               - 10.0f * sqrt(3.0f) * sqrt(squaredSide1);
-//
-//                float check2 = 100.0f + squaredSide1 - squaredSide2
-//                               + 10.0f * sqrt(3.0f) * sqrt(squaredSide1);
-//
-//                if (check1 < 0 && check2 > 0) {
-//                  isInLaserFOV = true;
-//                }
-//              }
-//            }
-//          }
-
-          size_t cubeIdx = i + _params.laserCloudWidth*j + _params.laserCloudWidth * _params.laserCloudHeight * k;
-          if (isInLaserFOV) {
-            _laserCloudValidInd.push_back(cubeIdx);
+        float centerX = 50.0f * i;
+        float centerY = 50.0f * j;
+        float centerZ = 50.0f * k;
+
+        // cube bounds relative to the sensor, grown by the neighbor search radius
+        Vector3 boxMin(centerX - 25.0f - searchRadius, centerY - 25.0f - searchRadius, centerZ - 25.0f - searchRadius);
+        Vector3 boxMax(centerX + 25.0f + searchRadius, centerY + 25.0f + searchRadius, centerZ + 25.0f + searchRadius);
+        boxMin -= _transformTobeMapped.pos;
+        boxMax -= _transformTobeMapped.pos;
+
+        bool isInLaserFOV = isBoxInFOV(boxMin, boxMax, tanMinElevation, tanMaxElevation, _params.fovMaxRange);
+
+        CubeKey key(i, j, k);
+        if (isInLaserFOV) {
+          _laserCloudValidInd.push_back(key);
+          CubeMap::iterator cube = _laserCloudCubes.find(key);
+          if (cube != _laserCloudCubes.end()) {
+            cube->second.valid = true;
           }
-          _laserCloudSurroundInd.push_back(cubeIdx);
         }
+        _laserCloudSurroundInd.push_back(key);
       }
     }
   }
 
-  // prepare valid map corner and surface cloud for pose optimization
-  _laserCloudCornerFromMap->clear();
-  _laserCloudSurfFromMap->clear();
+  // prepare the search indices of the valid cubes for pose optimization, only cubes that changed are rebuilt
   size_t laserCloudValidNum = _laserCloudValidInd.size();
+  _threadPool->parallelFor(laserCloudValidNum, [&](size_t i, size_t) {
+    CubeMap::iterator cube = _laserCloudCubes.find(_laserCloudValidInd[i]);
+    if (cube != _laserCloudCubes.end()) {
+      cube->second.updateIndices(_params.voxelHashSearch, std::sqrt(MAP_NEIGHBOR_SQ_DIS));
+    }
+  });
+
+  _laserCloudCornerFromMapNum = 0;
+  _laserCloudSurfFromMapNum = 0;
   for (size_t i = 0; i < laserCloudValidNum; i++) {
-    *_laserCloudCornerFromMap += *_laserCloudCornerArray[_laserCloudValidInd[i]];
-    *_laserCloudSurfFromMap += *_laserCloudSurfArray[_laserCloudValidInd[i]];
+    CubeMap::const_iterator cube = _laserCloudCubes.find(_laserCloudValidInd[i]);
+    if (cube != _laserCloudCubes.end()) {
+      _laserCloudCornerFromMapNum += cube->second.cornerCloud->size();
+      _laserCloudSurfFromMapNum += cube->second.surfCloud->size();
+    }
   }
 
   // prepare feature stack clouds for pose optimization
@@ -496,14 +444,10 @@ bool LaserMapping::process()
   }
 
   // down sample feature stack clouds
-  _laserCloudCornerStackDS->clear();
-  _downSizeFilterCorner.setInputCloud(_laserCloudCornerStack);
-  _downSizeFilterCorner.filter(*_laserCloudCornerStackDS);
+  _downSizeFilterCorner.filter(*_laserCloudCornerStack, *_laserCloudCornerStackDS);
   size_t laserCloudCornerStackNum = _laserCloudCornerStackDS->points.size();
 
-  _laserCloudSurfStackDS->clear();
-  _downSizeFilterSurf.setInputCloud(_laserCloudSurfStack);
-  _downSizeFilterSurf.filter(*_laserCloudSurfStackDS);
+  _downSizeFilterSurf.filter(*_laserCloudSurfStack, *_laserCloudSurfStackDS);
   size_t laserCloudSurfStackNum = _laserCloudSurfStackDS->points.size();
 
   _laserCloudCornerStack->clear();
@@ -511,316 +455,372 @@ bool LaserMapping::process()
 
 
   // run pose optimization
+  std::chrono::steady_clock::time_point optimizationStart = std::chrono::steady_clock::now();
   optimizeTransformTobeMapped();
+  _optimizationTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - optimizationStart).count();
 
 
   // store down sized corner stack points in corresponding cube clouds
   for (size_t i = 0; i < laserCloudCornerStackNum; i++) {
     pointAssociateToMap(_laserCloudCornerStackDS->points[i], pointSel);
 
-    int cubeI = int((pointSel.x + 25.0) / 50.0) + _laserCloudCenWidth;
-    int cubeJ = int((pointSel.y + 25.0) / 50.0) + _laserCloudCenHeight;
-    int cubeK = int((pointSel.z + 25.0) / 50.0) + _laserCloudCenDepth;
-
-    if (pointSel.x + 25.0 < 0) cubeI--;
-    if (pointSel.y + 25.0 < 0) cubeJ--;
-    if (pointSel.z + 25.0 < 0) cubeK--;
-
-    if (cubeI >= 0 && cubeI < (int)_params.laserCloudWidth &&
-        cubeJ >= 0 && cubeJ < (int)_params.laserCloudHeight &&
-        cubeK >= 0 && cubeK < (int)_params.laserCloudDepth) {
-      size_t cubeInd = cubeI + _params.laserCloudWidth * cubeJ + _params.laserCloudWidth * _params.laserCloudHeight * cubeK;
-      _laserCloudCornerArray[cubeInd]->push_back(pointSel);
-    }
+    MapCube& cube = _laserCloudCubes[CubeKey(toCube(pointSel.x), toCube(pointSel.y), toCube(pointSel.z))];
+    cube.cornerCloud->push_back(pointSel);
+    cube.cornerDirty = true;
+    cube.indicesStale = true;
   }
 
   // store down sized surface stack points in corresponding cube clouds
   for (size_t i = 0; i < laserCloudSurfStackNum; i++) {
     pointAssociateToMap(_laserCloudSurfStackDS->points[i], pointSel);
 
-    int cubeI = int((pointSel.x + 25.0) / 50.0) + _laserCloudCenWidth;
-    int cubeJ = int((pointSel.y + 25.0) / 50.0) + _laserCloudCenHeight;
-    int cubeK = int((pointSel.z + 25.0) / 50.0) + _laserCloudCenDepth;
+    MapCube& cube = _laserCloudCubes[CubeKey(toCube(pointSel.x), toCube(pointSel.y), toCube(pointSel.z))];
+    cube.surfCloud->push_back(pointSel);
+    cube.surfDirty = true;
+    cube.indicesStale = true;
+  }
 
-    if (pointSel.x + 25.0 < 0) cubeI--;
-    if (pointSel.y + 25.0 < 0) cubeJ--;
-    if (pointSel.z + 25.0 < 0) cubeK--;
+  // down size the valid (within field of view) feature cube clouds that received new points,
+  // clouds without new points are down sized already
+  for (size_t i = 0; i < laserCloudValidNum; i++) {
+    CubeMap::iterator it = _laserCloudCubes.find(_laserCloudValidInd[i]);
+    if (it == _laserCloudCubes.end()) {
+      continue;
+    }
+    MapCube& cube = it->second;
+
+    // filter into the scratch cloud and swap it with the cube cloud for next processing
+    if (cube.cornerDirty) {
+      _downSizeFilterCorner.filter(*cube.cornerCloud, *_laserCloudCubeDS);
+      cube.cornerCloud.swap(_laserCloudCubeDS);
+      cube.cornerDirty = false;
+      cube.indicesStale = true;
+    }
 
-    if (cubeI >= 0 && cubeI < (int)_params.laserCloudWidth &&
-        cubeJ >= 0 && cubeJ < (int)_params.laserCloudHeight &&
-        cubeK >= 0 && cubeK < (int)_params.laserCloudDepth) {
-      size_t cubeInd = cubeI + _params.laserCloudWidth * cubeJ + _params.laserCloudWidth * _params.laserCloudHeight * cubeK;
-      _laserCloudSurfArray[cubeInd]->push_back(pointSel);
+    if (cube.surfDirty) {
+      _downSizeFilterSurf.filter(*cube.surfCloud, *_laserCloudCubeDS);
+      cube.surfCloud.swap(_laserCloudCubeDS);
+      cube.surfDirty = false;
+      cube.indicesStale = true;
     }
   }
 
-  // down size all valid (within field of view) feature cube clouds
-  for (size_t i = 0; i < laserCloudValidNum; i++) {
-    size_t ind = _laserCloudValidInd[i];
+  // std::cout << "[LaserMapping] took " << stopWatch.elapsed() << " seconds" << std::endl;;
+  return true;
+}
+
+
 
-    _laserCloudCornerDSArray[ind]->clear();
-    _downSizeFilterCorner.setInputCloud(_laserCloudCornerArray[ind]);
-    _downSizeFilterCorner.filter(*_laserCloudCornerDSArray[ind]);
+bool LaserMapping::nearestMapPoints(const pcl::PointXYZI& pointSel,
+                                    const bool& corner,
+                                    pcl::PointXYZI* neighbors) const
+{
+  // cubes overlapping the bounding box of the search sphere
+  const float radius = std::sqrt(MAP_NEIGHBOR_SQ_DIS);
+  int minI = toCube(pointSel.x - radius);
+  int minJ = toCube(pointSel.y - radius);
+  int minK = toCube(pointSel.z - radius);
+  int maxI = toCube(pointSel.x + radius);
+  int maxJ = toCube(pointSel.y + radius);
+  int maxK = toCube(pointSel.z + radius);
+
+  float neighborSqDis[MAP_NEIGHBOR_NUM];
+  size_t neighborNum = 0;
+  int pointSearchInd[MAP_NEIGHBOR_NUM];
+  float pointSearchSqDis[MAP_NEIGHBOR_NUM];
+
+  for (int i = minI; i <= maxI; i++) {
+    for (int j = minJ; j <= maxJ; j++) {
+      for (int k = minK; k <= maxK; k++) {
+        CubeMap::const_iterator it = _laserCloudCubes.find(CubeKey(i, j, k));
+        if (it == _laserCloudCubes.end() || !it->second.valid) {
+          continue;
+        }
+
+        const MapCube& cube = it->second;
+        if (!cube.nearestKSearch(corner, pointSel, MAP_NEIGHBOR_NUM, pointSearchInd, pointSearchSqDis)) {
+          continue;
+        }
+        const MapCube::Cloud& cloud = corner ? *cube.cornerCloud : *cube.surfCloud;
 
-    _laserCloudSurfDSArray[ind]->clear();
-    _downSizeFilterSurf.setInputCloud(_laserCloudSurfArray[ind]);
-    _downSizeFilterSurf.filter(*_laserCloudSurfDSArray[ind]);
+        // merge the sorted results of this cube into the sorted neighbors
+        for (size_t n = 0; n < MAP_NEIGHBOR_NUM; n++) {
+          float sqDis = pointSearchSqDis[n];
+          if (pointSearchInd[n] < 0 || sqDis >= MAP_NEIGHBOR_SQ_DIS ||
+              (neighborNum == MAP_NEIGHBOR_NUM && sqDis >= neighborSqDis[MAP_NEIGHBOR_NUM - 1])) {
+            break;
+          }
 
-    // swap cube clouds for next processing
-    _laserCloudCornerArray[ind].swap(_laserCloudCornerDSArray[ind]);
-    _laserCloudSurfArray[ind].swap(_laserCloudSurfDSArray[ind]);
+          size_t pos = neighborNum < MAP_NEIGHBOR_NUM ? neighborNum++ : MAP_NEIGHBOR_NUM - 1;
+          for (; pos > 0 && neighborSqDis[pos - 1] > sqDis; pos--) {
+            neighborSqDis[pos] = neighborSqDis[pos - 1];
+            neighbors[pos] = neighbors[pos - 1];
+          }
+          neighborSqDis[pos] = sqDis;
+          neighbors[pos] = cloud.points[pointSearchInd[n]];
+        }
+      }
+    }
   }
 
-  // std::cout << "[LaserMapping] took " << stopWatch.elapsed() << " seconds" << std::endl;;
-  return true;
+  return neighborNum == MAP_NEIGHBOR_NUM;
 }
 
 
 
-void LaserMapping::optimizeTransformTobeMapped()
+bool LaserMapping::associateCorner(const pcl::PointXYZI& pointOri,
+                                   pcl::PointXYZI& coeff)
 {
-  if (_laserCloudCornerFromMap->points.size() <= 10 || _laserCloudSurfFromMap->points.size() <= 100) {
-    return;
+  if (!_params.edgeResiduals) {
+    return false;
   }
 
-  bool isConverged = false;
+  pcl::PointXYZI pointSel, pointProj;
+  pcl::PointXYZI neighbors[MAP_NEIGHBOR_NUM];
+  pointAssociateToMap(pointOri, pointSel);
 
-  pcl::PointXYZI pointSel, pointOri, pointProj, coeff;
+  Eigen::Matrix3f matA1;
 
-  std::vector<int> pointSearchInd(5, 0);
-  std::vector<float> pointSearchSqDis(5, 0);
+  if (nearestMapPoints(pointSel, true, neighbors)) {
+    Vector3 vc(0,0,0);
 
-  nanoflann::KdTreeFLANN<pcl::PointXYZI> kdtreeCornerFromMap;
-  nanoflann::KdTreeFLANN<pcl::PointXYZI> kdtreeSurfFromMap;
+    for (int j = 0; j < 5; j++) {
+      vc += Vector3(neighbors[j]);
+    }
+    vc /= 5.0;
 
-  kdtreeCornerFromMap.setInputCloud(_laserCloudCornerFromMap);
-  kdtreeSurfFromMap.setInputCloud(_laserCloudSurfFromMap);
+    Eigen::Matrix3f mat_a;
+    mat_a.setZero();
 
-  Eigen::Matrix<float, 5, 3> matA0;
-  Eigen::Matrix<float, 5, 1> matB0;
-  Eigen::Vector3f matX0;
-  Eigen::Matrix3f matA1;
-  Eigen::Matrix<float, 1, 3> matD1;
-  Eigen::Matrix3f matV1;
+    for (size_t j = 0; j < 5; j++) {
+      Vector3 a = Vector3(neighbors[j]) - vc;
 
-  matA0.setZero();
-  matB0.setConstant(-1);
-  matX0.setZero();
+      mat_a(0,0) += a.x() * a.x();
+      mat_a(0,1) += a.x() * a.y();
+      mat_a(0,2) += a.x() * a.z();
+      mat_a(1,1) += a.y() * a.y();
+      mat_a(1,2) += a.y() * a.z();
+      mat_a(2,2) += a.z() * a.z();
+    }
+    matA1 = mat_a / 5.0;
 
-  matA1.setZero();
-  matD1.setZero();
-  matV1.setZero();
+    // the neighbors form an edge if they spread mainly along one direction
+    float lambdaMax, lambdaMid;
+    Eigen::Vector3f direction;
+    dominantEigen3(matA1, lambdaMax, lambdaMid, direction);
 
-  bool isDegenerate = false;
-  Eigen::Matrix<float, 6, 6> matP;
+    if (lambdaMax > 3 * lambdaMid) {
 
-  size_t laserCloudCornerStackNum = _laserCloudCornerStackDS->points.size();
-  size_t laserCloudSurfStackNum = _laserCloudSurfStackDS->points.size();
+      float x0 = pointSel.x;
+      float y0 = pointSel.y;
+      float z0 = pointSel.z;
+      float x1 = vc.x() + 0.1 * direction.x();
+      float y1 = vc.y() + 0.1 * direction.y();
+      float z1 = vc.z() + 0.1 * direction.z();
+      float x2 = vc.x() - 0.1 * direction.x();
+      float y2 = vc.y() - 0.1 * direction.y();
+      float z2 = vc.z() - 0.1 * direction.z();
 
-  pcl::PointCloud<pcl::PointXYZI> laserCloudOri;
-  pcl::PointCloud<pcl::PointXYZI> coeffSel;
+      float a012 = sqrt(((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                        * ((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                        + ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
+                          * ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
+                        + ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))
+                          * ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1)));
 
-  // start iterating
-  for (size_t iterCount = 0; iterCount < _params.maxIterations; iterCount++) {
-    laserCloudOri.clear();
-    coeffSel.clear();
+      float l12 = sqrt((x1 - x2)*(x1 - x2) + (y1 - y2)*(y1 - y2) + (z1 - z2)*(z1 - z2));
 
-    // process edges
-    for (size_t i = 0; i < laserCloudCornerStackNum; i++) {
-      pointOri = _laserCloudCornerStackDS->points[i];
-      pointAssociateToMap(pointOri, pointSel);
-      kdtreeCornerFromMap.nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis );
+      float la = ((y1 - y2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                  + (z1 - z2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))) / a012 / l12;
 
-      if (pointSearchSqDis[4] < 1.0) {
-        Vector3 vc(0,0,0);
+      float lb = -((x1 - x2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                   - (z1 - z2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
 
-        for (int j = 0; j < 5; j++) {
-          vc += Vector3(_laserCloudCornerFromMap->points[pointSearchInd[j]]);
-        }
-        vc /= 5.0;
+      float lc = -((x1 - x2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
+                   + (y1 - y2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
 
-        Eigen::Matrix3f mat_a;
-        mat_a.setZero();
+      float ld2 = a012 / l12;
 
-        for (size_t j = 0; j < 5; j++) {
-          Vector3 a = Vector3(_laserCloudCornerFromMap->points[pointSearchInd[j]]) - vc;
+      // TODO: Why writing to a variable that's never read? Maybe it should be used afterwards?
+      pointProj = pointSel;
+      pointProj.x -= la * ld2;
+      pointProj.y -= lb * ld2;
+      pointProj.z -= lc * ld2;
 
-          mat_a(0,0) += a.x() * a.x();
-          mat_a(0,1) += a.x() * a.y();
-          mat_a(0,2) += a.x() * a.z();
-          mat_a(1,1) += a.y() * a.y();
-          mat_a(1,2) += a.y() * a.z();
-          mat_a(2,2) += a.z() * a.z();
-        }
-        matA1 = mat_a / 5.0;
+      float s = 1 - 0.9f * fabs(ld2);
 
-        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> esolver(matA1);
-        matD1 = esolver.eigenvalues().real();
-        matV1 = esolver.eigenvectors().real();
+      coeff.x = s * la;
+      coeff.y = s * lb;
+      coeff.z = s * lc;
+      coeff.intensity = s * ld2;
 
-        if (matD1(0, 0) > 3 * matD1(0, 1)) {
+      if (s > 0.1) {
+        return true;
+      }
+    }
+  }
 
-          float x0 = pointSel.x;
-          float y0 = pointSel.y;
-          float z0 = pointSel.z;
-          float x1 = vc.x() + 0.1 * matV1(0, 0);
-          float y1 = vc.y() + 0.1 * matV1(0, 1);
-          float z1 = vc.z() + 0.1 * matV1(0, 2);
-          float x2 = vc.x() - 0.1 * matV1(0, 0);
-          float y2 = vc.y() - 0.1 * matV1(0, 1);
-          float z2 = vc.z() - 0.1 * matV1(0, 2);
+  return false;
+}
 
-          float a012 = sqrt(((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                            * ((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                            + ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
-                              * ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
-                            + ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))
-                              * ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1)));
 
-          float l12 = sqrt((x1 - x2)*(x1 - x2) + (y1 - y2)*(y1 - y2) + (z1 - z2)*(z1 - z2));
 
-          float la = ((y1 - y2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                      + (z1 - z2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))) / a012 / l12;
+bool LaserMapping::associateSurface(const pcl::PointXYZI& pointOri,
+                                    pcl::PointXYZI& coeff)
+{
+  pcl::PointXYZI pointSel, pointProj;
+  pcl::PointXYZI neighbors[MAP_NEIGHBOR_NUM];
+  pointAssociateToMap(pointOri, pointSel);
 
-          float lb = -((x1 - x2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                       - (z1 - z2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
+  Eigen::Matrix<float, 5, 3> matA0;
+  Eigen::Matrix<float, 5, 1> matB0;
+  Eigen::Vector3f matX0;
+  matB0.setConstant(-1);
 
-          float lc = -((x1 - x2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
-                       + (y1 - y2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
+  if (nearestMapPoints(pointSel, false, neighbors)) {
+    for (size_t j = 0; j < 5; j++) {
+      matA0(j, 0) = neighbors[j].x;
+      matA0(j, 1) = neighbors[j].y;
+      matA0(j, 2) = neighbors[j].z;
+    }
+    matX0 = matA0.colPivHouseholderQr().solve(matB0);
+
+    float pa = matX0(0, 0);
+    float pb = matX0(1, 0);
+    float pc = matX0(2, 0);
+    float pd = 1;
+
+    float ps = sqrt(pa * pa + pb * pb + pc * pc);
+    pa /= ps;
+    pb /= ps;
+    pc /= ps;
+    pd /= ps;
+
+    bool planeValid = true;
+    for (size_t j = 0; j < 5; j++) {
+      if (fabs(pa * neighbors[j].x +
+               pb * neighbors[j].y +
+               pc * neighbors[j].z + pd) > 0.2) {
+        planeValid = false;
+        break;
+      }
+    }
 
-          float ld2 = a012 / l12;
+    if (planeValid) {
+      float pd2 = pa * pointSel.x + pb * pointSel.y + pc * pointSel.z + pd;
 
-          // TODO: Why writing to a variable that's never read? Maybe it should be used afterwards?
-          pointProj = pointSel;
-          pointProj.x -= la * ld2;
-          pointProj.y -= lb * ld2;
-          pointProj.z -= lc * ld2;
+      // TODO: Why writing to a variable that's never read? Maybe it should be used afterwards?
+      pointProj = pointSel;
+      pointProj.x -= pa * pd2;
+      pointProj.y -= pb * pd2;
+      pointProj.z -= pc * pd2;
 
-          float s = 1 - 0.9f * fabs(ld2);
+      float s = 1 - 0.9f * fabs(pd2) / sqrt(calcPointDistance(pointSel));
 
-          coeff.x = s * la;
-          coeff.y = s * lb;
-          coeff.z = s * lc;
-          coeff.intensity = s * ld2;
+      coeff.x = s * pa;
+      coeff.y = s * pb;
+      coeff.z = s * pc;
+      coeff.intensity = s * pd2;
 
-          if (s > 0.1) {
-            laserCloudOri.push_back(pointOri);
-            coeffSel.push_back(coeff);
-          }
-        }
+      if (s > 0.1) {
+        return true;
       }
     }
+  }
 
-    // proces planes
-    for (size_t i = 0; i < laserCloudSurfStackNum; i++) {
-      pointOri = _laserCloudSurfStackDS->points[i];
-      pointAssociateToMap(pointOri, pointSel);
-      kdtreeSurfFromMap.nearestKSearch(pointSel, 5, pointSearchInd, pointSearchSqDis );
-
-      if (pointSearchSqDis[4] < 1.0) {
-        for (size_t j = 0; j < 5; j++) {
-          matA0(j, 0) = _laserCloudSurfFromMap->points[pointSearchInd[j]].x;
-          matA0(j, 1) = _laserCloudSurfFromMap->points[pointSearchInd[j]].y;
-          matA0(j, 2) = _laserCloudSurfFromMap->points[pointSearchInd[j]].z;
-        }
-        matX0 = matA0.colPivHouseholderQr().solve(matB0);
-
-        float pa = matX0(0, 0);
-        float pb = matX0(1, 0);
-        float pc = matX0(2, 0);
-        float pd = 1;
-
-        float ps = sqrt(pa * pa + pb * pb + pc * pc);
-        pa /= ps;
-        pb /= ps;
-        pc /= ps;
-        pd /= ps;
-
-        bool planeValid = true;
-        for (size_t j = 0; j < 5; j++) {
-          if (fabs(pa * _laserCloudSurfFromMap->points[pointSearchInd[j]].x +
-                   pb * _laserCloudSurfFromMap->points[pointSearchInd[j]].y +
-                   pc * _laserCloudSurfFromMap->points[pointSearchInd[j]].z + pd) > 0.2) {
-            planeValid = false;
-            break;
-          }
-        }
+  return false;
+}
 
-        if (planeValid) {
-          float pd2 = pa * pointSel.x + pb * pointSel.y + pc * pointSel.z + pd;
 
-          // TODO: Why writing to a variable that's never read? Maybe it should be used afterwards?
-          pointProj = pointSel;
-          pointProj.x -= pa * pd2;
-          pointProj.y -= pb * pd2;
-          pointProj.z -= pc * pd2;
 
-          float s = 1 - 0.9f * fabs(pd2) / sqrt(calcPointDistance(pointSel));
+void LaserMapping::accumulateChunk(const size_t& begin,
+                                   const size_t& end,
+                                   NormalEquations& normalEquations)
+{
+  normalEquations.clear();
 
-          coeff.x = s * pa;
-          coeff.y = s * pb;
-          coeff.z = s * pc;
-          coeff.intensity = s * pd2;
+  pcl::PointXYZI coeff;
 
-          if (s > 0.1) {
-            laserCloudOri.push_back(pointOri);
-            coeffSel.push_back(coeff);
-          }
-        }
-      }
+  // prepare Jacobian matrix
+  float srx = _transformTobeMapped.rot_x.sin();
+  float crx = _transformTobeMapped.rot_x.cos();
+  float sry = _transformTobeMapped.rot_y.sin();
+  float cry = _transformTobeMapped.rot_y.cos();
+  float srz = _transformTobeMapped.rot_z.sin();
+  float crz = _transformTobeMapped.rot_z.cos();
+
+  // corner points come first, followed by the surface points
+  size_t laserCloudCornerStackNum = _laserCloudCornerStackDS->points.size();
+  for (size_t k = begin; k < end; k++) {
+    bool isCorner = k < laserCloudCornerStackNum;
+    const pcl::PointXYZI& pointOri = isCorner ? _laserCloudCornerStackDS->points[k]
+                                              : _laserCloudSurfStackDS->points[k - laserCloudCornerStackNum];
+    if (isCorner ? !associateCorner(pointOri, coeff)
+                 : !associateSurface(pointOri, coeff)) {
+      continue;
     }
 
+    float arx = (crx*sry*srz*pointOri.x + crx*crz*sry*pointOri.y - srx*sry*pointOri.z) * coeff.x
+                + (-srx*srz*pointOri.x - crz*srx*pointOri.y - crx*pointOri.z) * coeff.y
+                + (crx*cry*srz*pointOri.x + crx*cry*crz*pointOri.y - cry*srx*pointOri.z) * coeff.z;
 
-    // prepare Jacobian matrix
-    float srx = _transformTobeMapped.rot_x.sin();
-    float crx = _transformTobeMapped.rot_x.cos();
-    float sry = _transformTobeMapped.rot_y.sin();
-    float cry = _transformTobeMapped.rot_y.cos();
-    float srz = _transformTobeMapped.rot_z.sin();
-    float crz = _transformTobeMapped.rot_z.cos();
+    float ary = ((cry*srx*srz - crz*sry)*pointOri.x
+                 + (sry*srz + cry*crz*srx)*pointOri.y + crx*cry*pointOri.z) * coeff.x
+                + ((-cry*crz - srx*sry*srz)*pointOri.x
+                   + (cry*srz - crz*srx*sry)*pointOri.y - crx*sry*pointOri.z) * coeff.z;
 
-    size_t laserCloudSelNum = laserCloudOri.points.size();
-    if (laserCloudSelNum < 50) {
-      continue;
+    float arz = ((crz*srx*sry - cry*srz)*pointOri.x + (-cry*crz-srx*sry*srz)*pointOri.y)*coeff.x
+                + (crx*crz*pointOri.x - crx*srz*pointOri.y) * coeff.y
+                + ((sry*srz + cry*crz*srx)*pointOri.x + (crz*sry-cry*srx*srz)*pointOri.y)*coeff.z;
+
+    NormalEquations::Vector6 matA;
+    matA << arx, ary, arz, coeff.x, coeff.y, coeff.z;
+    normalEquations.add(matA, -coeff.intensity);
+  }
+}
+
+
+
+void LaserMapping::optimizeTransformTobeMapped()
+{
+  if (_laserCloudCornerFromMapNum <= 10 || _laserCloudSurfFromMapNum <= 100) {
+    return;
+  }
+
+  bool isConverged = false;
+
+  bool isDegenerate = false;
+  Eigen::Matrix<float, 6, 6> matP;
+
+  size_t laserCloudCornerStackNum = _laserCloudCornerStackDS->points.size();
+  size_t laserCloudSurfStackNum = _laserCloudSurfStackDS->points.size();
+
+  size_t featureNum = laserCloudCornerStackNum + laserCloudSurfStackNum;
+  size_t chunkNum = (featureNum + MAPPING_CHUNK_SIZE - 1) / MAPPING_CHUNK_SIZE;
+  _chunkEquations.resize(chunkNum);
+
+  // start iterating
+  for (size_t iterCount = 0; iterCount < _params.maxIterations; iterCount++) {
+    _threadPool->parallelFor(chunkNum, [&](size_t chunk, size_t) {
+      accumulateChunk(chunk * MAPPING_CHUNK_SIZE,
+                      std::min(featureNum, (chunk + 1) * MAPPING_CHUNK_SIZE),
+                      _chunkEquations[chunk]);
+    });
+
+    // sum up in chunk order, so the result does not depend on the number of threads
+    NormalEquations normalEquations;
+    for (const NormalEquations& chunkEquations : _chunkEquations) {
+      normalEquations += chunkEquations;
     }
 
-    Eigen::Matrix<float, Eigen::Dynamic, 6> matA(laserCloudSelNum, 6);
-    Eigen::Matrix<float, 6, Eigen::Dynamic> matAt(6, laserCloudSelNum);
-    Eigen::Matrix<float, 6, 6> matAtA;
-    Eigen::VectorXf matB(laserCloudSelNum);
-    Eigen::VectorXf matAtB;
-    Eigen::VectorXf matX;
-
-    for (size_t i = 0; i < laserCloudSelNum; i++) {
-      pointOri = laserCloudOri.points[i];
-      coeff = coeffSel.points[i];
-
-      float arx = (crx*sry*srz*pointOri.x + crx*crz*sry*pointOri.y - srx*sry*pointOri.z) * coeff.x
-                  + (-srx*srz*pointOri.x - crz*srx*pointOri.y - crx*pointOri.z) * coeff.y
-                  + (crx*cry*srz*pointOri.x + crx*cry*crz*pointOri.y - cry*srx*pointOri.z) * coeff.z;
-
-      float ary = ((cry*srx*srz - crz*sry)*pointOri.x
-                   + (sry*srz + cry*crz*srx)*pointOri.y + crx*cry*pointOri.z) * coeff.x
-                  + ((-cry*crz - srx*sry*srz)*pointOri.x
-                     + (cry*srz - crz*srx*sry)*pointOri.y - crx*sry*pointOri.z) * coeff.z;
-
-      float arz = ((crz*srx*sry - cry*srz)*pointOri.x + (-cry*crz-srx*sry*srz)*pointOri.y)*coeff.x
-                  + (crx*crz*pointOri.x - crx*srz*pointOri.y) * coeff.y
-                  + ((sry*srz + cry*crz*srx)*pointOri.x + (crz*sry-cry*srx*srz)*pointOri.y)*coeff.z;
-
-      matA(i, 0) = arx;
-      matA(i, 1) = ary;
-      matA(i, 2) = arz;
-      matA(i, 3) = coeff.x;
-      matA(i, 4) = coeff.y;
-      matA(i, 5) = coeff.z;
-      matB(i, 0) = -coeff.intensity;
+    size_t laserCloudSelNum = normalEquations.size();
+    if (laserCloudSelNum < 50) {
+      continue;
     }
 
-    matAt = matA.transpose();
-    matAtA = matAt * matA;
-    matAtB = matAt * matB;
-    matX = matAtA.colPivHouseholderQr().solve(matAtB);
+    Eigen::Matrix<float, 6, 1> matX;
+    const Eigen::Matrix<float, 6, 6>& matAtA = normalEquations.matAtA();
+    matX = matAtA.colPivHouseholderQr().solve(normalEquations.matAtB());
 
     if (iterCount == 0) {
       Eigen::Matrix<float, 1, 6> matE;
@@ -892,15 +892,15 @@ bool LaserMapping::generateMapCloud(pcl::PointCloud<pcl::PointXYZI>::Ptr& map_cl
 
     size_t laserCloudSurroundNum = _laserCloudSurroundInd.size();
     for (size_t i = 0; i < laserCloudSurroundNum; i++) {
-      size_t ind = _laserCloudSurroundInd[i];
-      *_laserCloudSurround += *_laserCloudCornerArray[ind];
-      *_laserCloudSurround += *_laserCloudSurfArray[ind];
+      CubeMap::const_iterator cube = _laserCloudCubes.find(_laserCloudSurroundInd[i]);
+      if (cube != _laserCloudCubes.end()) {
+        *_laserCloudSurround += *cube->second.cornerCloud;
+        *_laserCloudSurround += *cube->second.surfCloud;
+      }
     }
 
     // down size map cloud
-    _laserCloudSurroundDS->clear();
-    _downSizeFilterCorner.setInputCloud(_laserCloudSurround);
-    _downSizeFilterCorner.filter(*_laserCloudSurroundDS);
+    _downSizeFilterCorner.filter(*_laserCloudSurround, *_laserCloudSurroundDS);
 
     pcl::copyPointCloud(*_laserCloudSurroundDS, *map_cloud);
     return true;
@@ -912,11 +912,11 @@ bool LaserMapping::generateMapCloud(pcl::PointCloud<pcl::PointXYZI>::Ptr& map_cl
 bool LaserMapping::generateRegisteredCloud(pcl::PointCloud<pcl::PointXYZI>::Ptr& registered_cloud) {
 // transform full resolution input cloud to map
   size_t laserCloudFullResNum = _laserCloudFullRes->points.size();
+  registered_cloud->resize(laserCloudFullResNum);
   for (size_t i = 0; i < laserCloudFullResNum; i++) {
-    pointAssociateToMap(_laserCloudFullRes->points[i], _laserCloudFullRes->points[i]);
+    pointAssociateToMap(_laserCloudFullRes->points[i], registered_cloud->points[i]);
   }
 
-  pcl::copyPointCloud(*_laserCloudFullRes, *registered_cloud);
   return true;
 }
 
@@ -37,12 +37,15 @@
 #include "Twist.h"
 #include "CircularBuffer.h"
 #include "IMUState.h"
+#include "MapCube.h"
+#include "NormalEquations.h"
 #include "Parameters.h"
+#include "ThreadPool.h"
+#include "VoxelFilter.h"
 
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include <pcl/common/io.h>
-#include <pcl/filters/voxel_grid.h>
 
 
 namespace loam {
@@ -54,10 +57,13 @@ class LaserMapping {
 public:
   explicit LaserMapping(const LaserMappingParams& params = LaserMappingParams());
 
-  /** \brief Process incoming messages in a loop until shutdown (used in active mode). */
-  void spin(const pcl::PointCloud<pcl::PointXYZI>::Ptr& laserCloudCornerLast_,
-       const pcl::PointCloud<pcl::PointXYZI>::Ptr& laserCloudSurfLast_,
-       const pcl::PointCloud<pcl::PointXYZI>::Ptr& laserCloudFullRes_,
+  /** \brief Process incoming messages in a loop until shutdown (used in active mode).
+   *
+   * The clouds are shared, not copied, and are only read during this call.
+   */
+  void spin(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& laserCloudCornerLast_,
+       const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& laserCloudSurfLast_,
+       const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& laserCloudFullRes_,
        Twist transformSum_,
        Time timestamp);
 
@@ -73,15 +79,15 @@ public:
     return _params;
   }
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr& laserCloudCornerLast() {
+  const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& laserCloudCornerLast() const {
     return _laserCloudCornerLast;
   }
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr& laserCloudSurfLast() {
+  const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& laserCloudSurfLast() const {
     return _laserCloudSurfLast;
   }
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr& laserCloudFullRes() {
+  const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& laserCloudFullRes() const {
     return _laserCloudFullRes;
   }
 
@@ -137,6 +143,21 @@ public:
     return _newLaserOdometry;
   }
 
+  /** \brief Number of corner map points in the cubes searched by the last pose optimization. */
+  size_t laserCloudCornerFromMapNum() const {
+    return _laserCloudCornerFromMapNum;
+  }
+
+  /** \brief Number of surface map points in the cubes searched by the last pose optimization. */
+  size_t laserCloudSurfFromMapNum() const {
+    return _laserCloudSurfFromMapNum;
+  }
+
+  /** \brief Wall clock time of the last pose optimization in ms. */
+  double optimizationTime() const {
+    return _optimizationTime;
+  }
+
 
 protected:
   /** \brief Reset flags, etc. */
@@ -153,12 +174,54 @@ protected:
   void pointAssociateToMap(const pcl::PointXYZI& pi, pcl::PointXYZI& po);
   void pointAssociateTobeMapped(const pcl::PointXYZI& pi, pcl::PointXYZI& po);
 
+  /** \brief Find the nearest corner or surface map points of a point.
+   *
+   * Only the search indices of the valid cubes within reach of the search radius are
+   * queried and their results merged, which yields the same neighbors as a
+   * search over all valid cubes whenever all of them are closer than the radius.
+   *
+   * @param pointSel the query point in the map frame
+   * @param corner search the corner map if true, the surface map otherwise
+   * @param neighbors the array for storing the neighbors, nearest first
+   * @return true if MAP_NEIGHBOR_NUM neighbors within the search radius were found
+   */
+  bool nearestMapPoints(const pcl::PointXYZI& pointSel,
+                        const bool& corner,
+                        pcl::PointXYZI* neighbors) const;
+
+  /** \brief Find the edge in the corner map matching a corner point of the current sweep.
+   *
+   * @param pointOri the corner point in the sweep frame
+   * @param coeff the point instance for storing the residual direction and distance
+   * @return true if the point contributes a residual
+   */
+  bool associateCorner(const pcl::PointXYZI& pointOri,
+                       pcl::PointXYZI& coeff);
+
+  /** \brief Find the plane in the surface map matching a surface point of the current sweep.
+   *
+   * @see associateCorner()
+   */
+  bool associateSurface(const pcl::PointXYZI& pointOri,
+                        pcl::PointXYZI& coeff);
+
+  /** \brief Associate the down sampled stack points [begin, end) and sum up their normal equations.
+   *
+   * Indices address the corner stack first, followed by the surface stack.
+   */
+  void accumulateChunk(const size_t& begin,
+                       const size_t& end,
+                       NormalEquations& normalEquations);
+
 
 private:
 
-  size_t toIndex(int i, int j, int k) const
+  /** \brief The cube coordinate of a map coordinate, relative to the cube of the map origin. */
+  static int toCube(const float& v)
   {
-    return i + _params.laserCloudWidth * j + _params.laserCloudWidth * _params.laserCloudHeight * k;
+    int cube = int((v + 25.0) / 50.0);
+    if (v + 25.0 < 0) cube--;
+    return cube;
   }
 
   LaserMappingParams _params;
@@ -166,10 +229,6 @@ private:
   long _frameCount;
   long _mapFrameCount;
 
-  int _laserCloudCenWidth;
-  int _laserCloudCenHeight;
-  int _laserCloudCenDepth;
-
   Time _timeLaserCloudCornerLast;   ///< time of current last corner cloud
   Time _timeLaserCloudSurfLast;     ///< time of current last surface cloud
   Time _timeLaserCloudFullRes;      ///< time of current full resolution cloud
@@ -180,9 +239,9 @@ private:
   bool _newLaserCloudFullRes;     ///< flag if a new full resolution cloud has been received
   bool _newLaserOdometry;         ///< flag if a new laser odometry has been received
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCornerLast;   ///< last corner points cloud
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurfLast;     ///< last surface points cloud
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudFullRes;      ///< last full resolution cloud
+  pcl::PointCloud<pcl::PointXYZI>::ConstPtr _laserCloudCornerLast;   ///< last corner points cloud (shared with the caller)
+  pcl::PointCloud<pcl::PointXYZI>::ConstPtr _laserCloudSurfLast;     ///< last surface points cloud (shared with the caller)
+  pcl::PointCloud<pcl::PointXYZI>::ConstPtr _laserCloudFullRes;      ///< last full resolution cloud (shared with the caller)
 
   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCornerStack;
   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurfStack;
@@ -191,16 +250,15 @@ private:
 
   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurround;
   pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurroundDS;     ///< down sampled
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCornerFromMap;
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudSurfFromMap;
+  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudCubeDS;        ///< down sampled cube cloud, swapped into the cube
+  size_t _laserCloudCornerFromMapNum;   ///< number of corner points in the valid cubes
+  size_t _laserCloudSurfFromMapNum;     ///< number of surface points in the valid cubes
+  double _optimizationTime;             ///< wall clock time of the last pose optimization in ms
 
-  std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudCornerArray;
-  std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudSurfArray;
-  std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudCornerDSArray;  ///< down sampled
-  std::vector<pcl::PointCloud<pcl::PointXYZI>::Ptr> _laserCloudSurfDSArray;    ///< down sampled
+  CubeMap _laserCloudCubes;   ///< occupied map cubes
 
-  std::vector<size_t> _laserCloudValidInd;
-  std::vector<size_t> _laserCloudSurroundInd;
+  std::vector<CubeKey> _laserCloudValidInd;
+  std::vector<CubeKey> _laserCloudSurroundInd;
 
   Twist _transformSum;
   Twist _transformIncre;
@@ -210,9 +268,12 @@ private:
 
   CircularBuffer<IMUState> _imuHistory;    ///< history of IMU states
 
-  pcl::VoxelGrid<pcl::PointXYZI> _downSizeFilterCorner;   ///< voxel filter for down sizing corner clouds
-  pcl::VoxelGrid<pcl::PointXYZI> _downSizeFilterSurf;     ///< voxel filter for down sizing surface clouds
-  pcl::VoxelGrid<pcl::PointXYZI> _downSizeFilterMap;      ///< voxel filter for down sizing accumulated map
+  VoxelFilter _downSizeFilterCorner;   ///< voxel filter for down sizing corner clouds
+  VoxelFilter _downSizeFilterSurf;     ///< voxel filter for down sizing surface clouds
+  VoxelFilter _downSizeFilterMap;      ///< voxel filter for down sizing accumulated map
+
+  std::vector<NormalEquations, Eigen::aligned_allocator<NormalEquations> > _chunkEquations;  ///< per chunk normal equations
+  ThreadPool::Ptr _threadPool;    ///< workers associating the stack points
 };
 
 } // end namespace loam
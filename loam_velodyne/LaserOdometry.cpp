@@ -34,6 +34,7 @@
 #include "common.h"
 #include "math_utils.h"
 
+#include <algorithm>
 #include <pcl/filters/filter.h>
 #include <Eigen/Eigenvalues>
 #include <Eigen/QR>
@@ -49,6 +50,9 @@ using std::sqrt;
 using std::fabs;
 using std::pow;
 
+/** Number of feature points associated per work item; fixed, so the summation order does not depend on the thread count. */
+static const size_t ODOMETRY_CHUNK_SIZE = 128;
+
 
 LaserOdometry::LaserOdometry(const LaserOdometryParams& params)
       : _params(params),
@@ -73,10 +77,9 @@ LaserOdometry::LaserOdometry(const LaserOdometryParams& params)
         _laserCloudFullRes(new pcl::PointCloud<pcl::PointXYZI>()),
         _lastCornerCloud(new pcl::PointCloud<pcl::PointXYZI>()),
         _lastSurfaceCloud(new pcl::PointCloud<pcl::PointXYZI>()),
-        _laserCloudOri(new pcl::PointCloud<pcl::PointXYZI>()),
-        _coeffSel(new pcl::PointCloud<pcl::PointXYZI>()),
         _lastCornerKDTree(new nanoflann::KdTreeFLANN<pcl::PointXYZI>()),
-        _lastSurfaceKDTree(new nanoflann::KdTreeFLANN<pcl::PointXYZI>())
+        _lastSurfaceKDTree(new nanoflann::KdTreeFLANN<pcl::PointXYZI>()),
+        _threadPool(new ThreadPool(params.nThreads))
 { }
 
 
@@ -98,12 +101,16 @@ void LaserOdometry::transformToStart(const pcl::PointXYZI& pi, pcl::PointXYZI& p
 
 
 
-size_t LaserOdometry::transformToEnd(pcl::PointCloud<pcl::PointXYZI>::Ptr& cloud)
+size_t LaserOdometry::transformToEnd(const pcl::PointCloud<pcl::PointXYZI>& cloudIn,
+                                    pcl::PointCloud<pcl::PointXYZI>& cloudOut)
 {
-  size_t cloudSize = cloud->points.size();
+  size_t cloudSize = cloudIn.points.size();
+  cloudOut.resize(cloudSize);
+  cloudOut.is_dense = cloudIn.is_dense;
 
   for (size_t i = 0; i < cloudSize; i++) {
-    pcl::PointXYZI& point = cloud->points[i];
+    pcl::PointXYZI& point = cloudOut.points[i];
+    point = cloudIn.points[i];
 
     float s = 10 * (point.intensity - int(point.intensity));
 
@@ -240,19 +247,19 @@ void LaserOdometry::accumulateRotation(Angle cx, Angle cy, Angle cz,
 }
 
 
-void LaserOdometry::spin(const pcl::PointCloud<pcl::PointXYZI>::Ptr& cornerPointsSharp,
-        const pcl::PointCloud<pcl::PointXYZI>::Ptr& cornerPointsLessSharp,
-        const pcl::PointCloud<pcl::PointXYZI>::Ptr& surfPointsFlat,
-        const pcl::PointCloud<pcl::PointXYZI>::Ptr& surfPointsLessFlat,
-        const pcl::PointCloud<pcl::PointXYZI>::Ptr& laserCloudFullRes,
+void LaserOdometry::spin(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& cornerPointsSharp,
+        const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& cornerPointsLessSharp,
+        const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& surfPointsFlat,
+        const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& surfPointsLessFlat,
+        const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& laserCloudFullRes,
         Twist imuTrans_,
         Time timestamp)
 {
-  pcl::copyPointCloud(*cornerPointsSharp, *_cornerPointsSharp);
-  pcl::copyPointCloud(*cornerPointsLessSharp, *_cornerPointsLessSharp);
-  pcl::copyPointCloud(*surfPointsFlat, *_surfPointsFlat);
-  pcl::copyPointCloud(*surfPointsLessFlat, *_surfPointsLessFlat);
-  pcl::copyPointCloud(*laserCloudFullRes, *_laserCloudFullRes);
+  _cornerPointsSharp = cornerPointsSharp;
+  _cornerPointsLessSharp = cornerPointsLessSharp;
+  _surfPointsFlat = surfPointsFlat;
+  _surfPointsLessFlat = surfPointsLessFlat;
+  _laserCloudFullRes = laserCloudFullRes;
 
   _imuPitchStart = Angle();
   _imuYawStart   = Angle();
@@ -307,6 +314,313 @@ bool LaserOdometry::hasNewData()
 
 
 
+bool LaserOdometry::associateCorner(const size_t& i,
+                                    const size_t& iterCount,
+                                    pcl::PointXYZI& coeff)
+{
+  pcl::PointXYZI pointSel, pointProj, tripod1, tripod2;
+
+  if (iterCount % 5 == 0) {
+    pointSel = _pointSel[i];
+
+    int closestPointInd = -1, minPointInd2 = -1;
+    if (_pointSearchNearestSqDis[i] < 25) {
+      closestPointInd = _pointSearchNearestInd[i];
+      int closestPointScan = int(_lastCornerCloud->points[closestPointInd].intensity);
+
+      // nearest point of the two scans above or below
+      float minPointSqDis2 = 25;
+      for (int scan = closestPointScan - 2; scan <= closestPointScan + 2; scan++) {
+        if (scan == closestPointScan) {
+          continue;
+        }
+        int ind = _lastCornerRingIndex.nearestInRing(pointSel, scan, closestPointInd, minPointSqDis2);
+        if (ind >= 0) {
+          minPointInd2 = ind;
+        }
+      }
+    }
+
+    _pointSearchCornerInd1[i] = closestPointInd;
+    _pointSearchCornerInd2[i] = minPointInd2;
+  } else {
+    transformToStart(_cornerPointsSharp->points[i], pointSel);
+  }
+
+  if (_pointSearchCornerInd2[i] >= 0) {
+    tripod1 = _lastCornerCloud->points[_pointSearchCornerInd1[i]];
+    tripod2 = _lastCornerCloud->points[_pointSearchCornerInd2[i]];
+
+    float x0 = pointSel.x;
+    float y0 = pointSel.y;
+    float z0 = pointSel.z;
+    float x1 = tripod1.x;
+    float y1 = tripod1.y;
+    float z1 = tripod1.z;
+    float x2 = tripod2.x;
+    float y2 = tripod2.y;
+    float z2 = tripod2.z;
+
+    float a012 = sqrt(((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                      * ((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                      + ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
+                        * ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
+                      + ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))
+                        * ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1)));
+
+    float l12 = sqrt((x1 - x2)*(x1 - x2) + (y1 - y2)*(y1 - y2) + (z1 - z2)*(z1 - z2));
+
+    float la = ((y1 - y2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                + (z1 - z2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))) / a012 / l12;
+
+    float lb = -((x1 - x2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
+                 - (z1 - z2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
+
+    float lc = -((x1 - x2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
+                 + (y1 - y2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
+
+    float ld2 = a012 / l12;
+
+    // TODO: Why writing to a variable that's never read?
+    pointProj = pointSel;
+    pointProj.x -= la * ld2;
+    pointProj.y -= lb * ld2;
+    pointProj.z -= lc * ld2;
+
+    float s = 1;
+    if (iterCount >= 5) {
+      s = 1 - 1.8f * fabs(ld2);
+    }
+
+    coeff.x = s * la;
+    coeff.y = s * lb;
+    coeff.z = s * lc;
+    coeff.intensity = s * ld2;
+
+    if (s > 0.1 && ld2 != 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+
+bool LaserOdometry::associateSurface(const size_t& i,
+                                     const size_t& iterCount,
+                                     pcl::PointXYZI& coeff)
+{
+  pcl::PointXYZI pointSel, pointProj, tripod1, tripod2, tripod3;
+
+  if (iterCount % 5 == 0) {
+    // the surface points follow the corner points in the search buffers
+    size_t k = _cornerPointsSharp->points.size() + i;
+    pointSel = _pointSel[k];
+
+    int closestPointInd = -1, minPointInd2 = -1, minPointInd3 = -1;
+    if (_pointSearchNearestSqDis[k] < 25) {
+      closestPointInd = _pointSearchNearestInd[k];
+      int closestPointScan = int(_lastSurfaceCloud->points[closestPointInd].intensity);
+
+      // nearest other point of the same scan, and nearest point of the two scans above or below
+      float minPointSqDis2 = 25, minPointSqDis3 = 25;
+      minPointInd2 = _lastSurfaceRingIndex.nearestInRing(pointSel, closestPointScan, closestPointInd, minPointSqDis2);
+      for (int scan = closestPointScan - 2; scan <= closestPointScan + 2; scan++) {
+        if (scan == closestPointScan) {
+          continue;
+        }
+        int ind = _lastSurfaceRingIndex.nearestInRing(pointSel, scan, closestPointInd, minPointSqDis3);
+        if (ind >= 0) {
+          minPointInd3 = ind;
+        }
+      }
+    }
+
+    _pointSearchSurfInd1[i] = closestPointInd;
+    _pointSearchSurfInd2[i] = minPointInd2;
+    _pointSearchSurfInd3[i] = minPointInd3;
+  } else {
+    transformToStart(_surfPointsFlat->points[i], pointSel);
+  }
+
+  if (_pointSearchSurfInd2[i] >= 0 && _pointSearchSurfInd3[i] >= 0) {
+    tripod1 = _lastSurfaceCloud->points[_pointSearchSurfInd1[i]];
+    tripod2 = _lastSurfaceCloud->points[_pointSearchSurfInd2[i]];
+    tripod3 = _lastSurfaceCloud->points[_pointSearchSurfInd3[i]];
+
+    float pa = (tripod2.y - tripod1.y) * (tripod3.z - tripod1.z)
+               - (tripod3.y - tripod1.y) * (tripod2.z - tripod1.z);
+    float pb = (tripod2.z - tripod1.z) * (tripod3.x - tripod1.x)
+               - (tripod3.z - tripod1.z) * (tripod2.x - tripod1.x);
+    float pc = (tripod2.x - tripod1.x) * (tripod3.y - tripod1.y)
+               - (tripod3.x - tripod1.x) * (tripod2.y - tripod1.y);
+    float pd = -(pa * tripod1.x + pb * tripod1.y + pc * tripod1.z);
+
+    float ps = sqrt(pa * pa + pb * pb + pc * pc);
+    pa /= ps;
+    pb /= ps;
+    pc /= ps;
+    pd /= ps;
+
+    float pd2 = pa * pointSel.x + pb * pointSel.y + pc * pointSel.z + pd;
+
+    // TODO: Why writing to a variable that's never read? Maybe it should be used afterwards?
+    pointProj = pointSel;
+    pointProj.x -= pa * pd2;
+    pointProj.y -= pb * pd2;
+    pointProj.z -= pc * pd2;
+
+    float s = 1;
+    if (iterCount >= 5) {
+      s = 1 - 1.8f * fabs(pd2) / sqrt(calcPointDistance(pointSel));
+    }
+
+    coeff.x = s * pa;
+    coeff.y = s * pb;
+    coeff.z = s * pc;
+    coeff.intensity = s * pd2;
+
+    if (s > 0.1 && pd2 != 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+
+void LaserOdometry::accumulateChunk(const size_t& begin,
+                                    const size_t& end,
+                                    const size_t& iterCount,
+                                    NormalEquations& normalEquations)
+{
+  normalEquations.clear();
+
+  pcl::PointXYZI coeff;
+
+  // the transform is fixed during an iteration
+  float srx = sin(_transform.rot_x.rad());
+  float crx = cos(_transform.rot_x.rad());
+  float sry = sin(_transform.rot_y.rad());
+  float cry = cos(_transform.rot_y.rad());
+  float srz = sin(_transform.rot_z.rad());
+  float crz = cos(_transform.rot_z.rad());
+
+  // corner points come first, followed by the surface points
+  size_t cornerPointsSharpNum = _cornerPointsSharp->points.size();
+  for (size_t k = begin; k < end; k++) {
+    bool isCorner = k < cornerPointsSharpNum;
+    const pcl::PointXYZI& pointOri = isCorner ? _cornerPointsSharp->points[k]
+                                              : _surfPointsFlat->points[k - cornerPointsSharpNum];
+    if (isCorner ? !associateCorner(k, iterCount, coeff)
+                 : !associateSurface(k - cornerPointsSharpNum, iterCount, coeff)) {
+      continue;
+    }
+
+    float s = 1;
+    float tx = s * _transform.pos.x();
+    float ty = s * _transform.pos.y();
+    float tz = s * _transform.pos.z();
+
+    // updated derivatives with respect to rotation and translation
+    float arx, ary, arz, atx, aty, atz;
+    int selectMethodType = 1; // 1: original; else: disturbance model
+
+    if (selectMethodType == 1) {
+      arx = s * (- pointOri.x * (crx * sry * srz)
+                 + pointOri.y * (crx * crz * sry)
+                 + pointOri.z * (srx * sry)
+                 + tx * (crx * sry * srz)
+                 - ty * (crx * crz * sry)
+                 - tz * (srx * sry)) * coeff.x
+          + s * (+ pointOri.x * (srx * srz)
+                 - pointOri.y * (crz * srx)
+                 + pointOri.z * crx
+                 - tx * (srx * srz)
+                 + ty * (crz * srx)
+                 - tz * (crx)) * coeff.y
+          + s * (+ pointOri.x * (crx * cry * srz)
+                 - pointOri.y * (crx * cry * crz)
+                 - pointOri.z * (cry * srx)
+                 - tx * (crx * cry * srz)
+                 + ty * (crx * cry * crz)
+                 + tz * (cry * srx)) * coeff.z;
+
+      ary = s * (- pointOri.x * (crz * sry + cry * srx * srz)
+                 - pointOri.y * (sry * srz - cry * crz * srx)
+                 - pointOri.z * (crx * cry)
+                 + tx * (crz * sry + cry * srx * srz)
+                 + ty * (sry * srz - cry * crz * srx)
+                 + tz * (crx * cry)) * coeff.x
+          + s * (+ pointOri.x * (cry * crz - srx * sry * srz)
+                 + pointOri.y * (cry * srz + crz * srx * sry)
+                 - pointOri.z * (crx * sry)
+                 - tx * (cry * crz - srx * sry * srz)
+                 - ty * (cry * srz + crz * srx * sry)
+                 + tz * (crx * sry)) * coeff.z;
+
+      arz = s * (- pointOri.x * (cry * srz + crz * srx * sry)
+                 + pointOri.y * (cry * crz - srx * sry * srz)
+                 + tx * (cry * srz + crz * srx * sry)
+                 - ty * (cry * crz - srx * sry * srz)) * coeff.x
+          + s * (- pointOri.x * (crx * crz)
+                 - pointOri.y * (crx * srz)
+                 + tx * crx * crz
+                 + ty * crx * srz) * coeff.y
+          + s * (+ pointOri.x * (cry * crz * srx - sry * srz)
+                 + pointOri.y * (crz * sry + cry * srx * srz)
+                 + tx * (sry * srz - cry * crz * srx)
+                 - ty * (crz * sry + cry * srx * srz)) * coeff.z;
+
+      atx = - s * (cry * crz - srx * sry * srz) * coeff.x
+            + s * (crx * srz) * coeff.y
+            - s * (crz * sry + cry * srx * srz) * coeff.z;
+      aty = - s * (cry * srz + crz * srx * sry) * coeff.x
+            - s * (crx * crz) * coeff.y
+            - s * (sry * srz - cry * crz * srx) * coeff.z;
+      atz = + s * (crx * sry) * coeff.x
+            - s * (srx) * coeff.y
+            - s * (crx * cry) * coeff.z;
+    } else {
+      s = 1.0;
+      float x_trf_bck = + pointOri.x * (crz * cry + srx * sry * srz)
+                        + pointOri.y * (cry * srz - crz * sry * srx)
+                        + pointOri.z * (crx * sry)
+                        + tx * (-crz * cry - srz * sry * srz)
+                        + ty * (-cry * srz + crz * sry * srx)
+                        + tz * (-crx * sry);
+      float y_trf_bck = + pointOri.x * (-crx * srz)
+                        + pointOri.y * (crz * crx)
+                        + pointOri.z * (srx)
+                        + tx * (crx * srz)
+                        + ty * (-crz * crx)
+                        + tz * (-srx);
+      float z_trf_bck = + pointOri.x * (-crz * sry + cry * srz * srx)
+                        + pointOri.y * (-srz * sry - crz * cry * srx)
+                        + pointOri.z * (cry * crx)
+                        + tx * (crz * sry - cry * srz * srx)
+                        + ty * (srz * sry + crz * cry * srx)
+                        + tz * (-cry * crx);
+
+      arx = -s * (0.0 *        coeff.x - z_trf_bck * coeff.y + y_trf_bck * coeff.z);
+      ary = -s * (z_trf_bck *  coeff.x + 0.0 *       coeff.y - x_trf_bck * coeff.z);
+      arz = -s * (-y_trf_bck * coeff.x + x_trf_bck * coeff.y + 0.0       * coeff.z);
+
+      atx = -s * coeff.x;
+      aty = -s * coeff.y;
+      atz = -s * coeff.z;
+    }
+
+    NormalEquations::Vector6 matA;
+    matA << arx, ary, arz, atx, aty, atz;
+    normalEquations.add(matA, -0.05 * coeff.intensity);
+  }
+}
+
+
+
 bool LaserOdometry::process()
 {
   if (!hasNewData()) {
@@ -320,11 +634,17 @@ bool LaserOdometry::process()
   reset();
 
   if (!_systemInited) {
-    _cornerPointsLessSharp.swap(_lastCornerCloud);
-    _surfPointsLessFlat.swap(_lastSurfaceCloud);
+    // the input clouds are shared with the caller, keep private copies
+    _lastCornerCloud.reset(new pcl::PointCloud<pcl::PointXYZI>());
+    _lastSurfaceCloud.reset(new pcl::PointCloud<pcl::PointXYZI>());
+    std::vector<int> indices;
+    pcl::removeNaNFromPointCloud(*_cornerPointsLessSharp, *_lastCornerCloud, indices);
+    pcl::removeNaNFromPointCloud(*_surfPointsLessFlat, *_lastSurfaceCloud, indices);
 
     _lastCornerKDTree->setInputCloud(_lastCornerCloud);
     _lastSurfaceKDTree->setInputCloud(_lastSurfaceCloud);
+    _lastCornerRingIndex.setInputCloud(*_lastCornerCloud);
+    _lastSurfaceRingIndex.setInputCloud(*_lastSurfaceCloud);
 
     _transformSum.rot_x += _imuPitchStart;
     _transformSum.rot_z += _imuRollStart;
@@ -333,7 +653,6 @@ bool LaserOdometry::process()
     return false;
   }
 
-  pcl::PointXYZI coeff;
   bool isDegenerate = false;
   Eigen::Matrix<float,6,6> matP;
 
@@ -346,11 +665,14 @@ bool LaserOdometry::process()
   size_t lastSurfaceCloudSize = _lastSurfaceCloud->points.size();
 
   if (lastCornerCloudSize > 10 && lastSurfaceCloudSize > 100) {
-    std::vector<int> pointSearchInd(1);
-    std::vector<float> pointSearchSqDis(1);
     std::vector<int> indices;
 
-    pcl::removeNaNFromPointCloud(*_cornerPointsSharp, *_cornerPointsSharp, indices);
+    if (!_cornerPointsSharp->is_dense) {
+      // filter into a private cloud, the input is shared with the caller
+      pcl::PointCloud<pcl::PointXYZI>::Ptr cornerPointsSharp(new pcl::PointCloud<pcl::PointXYZI>());
+      pcl::removeNaNFromPointCloud(*_cornerPointsSharp, *cornerPointsSharp, indices);
+      _cornerPointsSharp = cornerPointsSharp;
+    }
     size_t cornerPointsSharpNum = _cornerPointsSharp->points.size();
     size_t surfPointsFlatNum = _surfPointsFlat->points.size();
 
@@ -360,347 +682,53 @@ bool LaserOdometry::process()
     _pointSearchSurfInd2.resize(surfPointsFlatNum);
     _pointSearchSurfInd3.resize(surfPointsFlatNum);
 
-    for (size_t iterCount = 0; iterCount < _params.maxIterations; iterCount++) {
-      pcl::PointXYZI pointSel, pointProj, tripod1, tripod2, tripod3;
-      _laserCloudOri->clear();
-      _coeffSel->clear();
-
-      for (size_t i = 0; i < cornerPointsSharpNum; i++) {
-        transformToStart(_cornerPointsSharp->points[i], pointSel);
-
-        if (iterCount % 5 == 0) {
-          pcl::removeNaNFromPointCloud(*_lastCornerCloud, *_lastCornerCloud, indices);
-          _lastCornerKDTree->nearestKSearch(pointSel, 1, pointSearchInd, pointSearchSqDis);
-
-          int closestPointInd = -1, minPointInd2 = -1;
-          if (pointSearchSqDis[0] < 25) {
-            closestPointInd = pointSearchInd[0];
-            int closestPointScan = int(_lastCornerCloud->points[closestPointInd].intensity);
-
-            float pointSqDis, minPointSqDis2 = 25;
-            for (size_t j = closestPointInd + 1; j < cornerPointsSharpNum; j++) {
-              if (size_t(_lastCornerCloud->points[j].intensity) > closestPointScan + 2.5) {
-                break;
-              }
-
-              pointSqDis = calcSquaredDiff(_lastCornerCloud->points[j], pointSel);
-
-              if (int(_lastCornerCloud->points[j].intensity) > closestPointScan) {
-                if (pointSqDis < minPointSqDis2) {
-                  minPointSqDis2 = pointSqDis;
-                  minPointInd2 = j;
-                }
-              }
-            }
-            for (int j = closestPointInd - 1; j >= 0; j--) {
-              if (int(_lastCornerCloud->points[j].intensity) < closestPointScan - 2.5) {
-                break;
-              }
-
-              pointSqDis = calcSquaredDiff(_lastCornerCloud->points[j], pointSel);
-
-              if (int(_lastCornerCloud->points[j].intensity) < closestPointScan) {
-                if (pointSqDis < minPointSqDis2) {
-                  minPointSqDis2 = pointSqDis;
-                  minPointInd2 = j;
-                }
-              }
-            }
-          }
-
-          _pointSearchCornerInd1[i] = closestPointInd;
-          _pointSearchCornerInd2[i] = minPointInd2;
-        }
-
-        if (_pointSearchCornerInd2[i] >= 0) {
-          tripod1 = _lastCornerCloud->points[_pointSearchCornerInd1[i]];
-          tripod2 = _lastCornerCloud->points[_pointSearchCornerInd2[i]];
-
-          float x0 = pointSel.x;
-          float y0 = pointSel.y;
-          float z0 = pointSel.z;
-          float x1 = tripod1.x;
-          float y1 = tripod1.y;
-          float z1 = tripod1.z;
-          float x2 = tripod2.x;
-          float y2 = tripod2.y;
-          float z2 = tripod2.z;
-
-          float a012 = sqrt(((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                            * ((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                            + ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
-                              * ((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
-                            + ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))
-                              * ((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1)));
-
-          float l12 = sqrt((x1 - x2)*(x1 - x2) + (y1 - y2)*(y1 - y2) + (z1 - z2)*(z1 - z2));
-
-          float la = ((y1 - y2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                      + (z1 - z2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))) / a012 / l12;
-
-          float lb = -((x1 - x2)*((x0 - x1)*(y0 - y2) - (x0 - x2)*(y0 - y1))
-                       - (z1 - z2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
-
-          float lc = -((x1 - x2)*((x0 - x1)*(z0 - z2) - (x0 - x2)*(z0 - z1))
-                       + (y1 - y2)*((y0 - y1)*(z0 - z2) - (y0 - y2)*(z0 - z1))) / a012 / l12;
-
-          float ld2 = a012 / l12;
-
-          // TODO: Why writing to a variable that's never read?
-          pointProj = pointSel;
-          pointProj.x -= la * ld2;
-          pointProj.y -= lb * ld2;
-          pointProj.z -= lc * ld2;
-
-          float s = 1;
-          if (iterCount >= 5) {
-            s = 1 - 1.8f * fabs(ld2);
-          }
-
-          coeff.x = s * la;
-          coeff.y = s * lb;
-          coeff.z = s * lc;
-          coeff.intensity = s * ld2;
+    size_t featureNum = cornerPointsSharpNum + surfPointsFlatNum;
+    size_t chunkNum = (featureNum + ODOMETRY_CHUNK_SIZE - 1) / ODOMETRY_CHUNK_SIZE;
+    _chunkEquations.resize(chunkNum);
+    _pointSel.resize(featureNum);
+    _pointSearchNearestInd.resize(featureNum);
+    _pointSearchNearestSqDis.resize(featureNum);
 
-          if (s > 0.1 && ld2 != 0) {
-            _laserCloudOri->push_back(_cornerPointsSharp->points[i]);
-            _coeffSel->push_back(coeff);
+    for (size_t iterCount = 0; iterCount < _params.maxIterations; iterCount++) {
+      if (iterCount % 5 == 0) {
+        // nearest neighbors of all feature points in one batch per cloud
+        _threadPool->parallelFor(chunkNum, [&](size_t chunk, size_t) {
+          size_t end = std::min(featureNum, (chunk + 1) * ODOMETRY_CHUNK_SIZE);
+          for (size_t k = chunk * ODOMETRY_CHUNK_SIZE; k < end; k++) {
+            transformToStart(k < cornerPointsSharpNum ? _cornerPointsSharp->points[k]
+                                                      : _surfPointsFlat->points[k - cornerPointsSharpNum],
+                             _pointSel[k]);
           }
-        }
+        });
+        _lastCornerKDTree->nearestKSearch(_pointSel.data(), cornerPointsSharpNum, 1,
+                                          _pointSearchNearestInd.data(), _pointSearchNearestSqDis.data(),
+                                          *_threadPool);
+        _lastSurfaceKDTree->nearestKSearch(_pointSel.data() + cornerPointsSharpNum, surfPointsFlatNum, 1,
+                                           _pointSearchNearestInd.data() + cornerPointsSharpNum,
+                                           _pointSearchNearestSqDis.data() + cornerPointsSharpNum,
+                                           *_threadPool);
       }
 
-      for (size_t i = 0; i < surfPointsFlatNum; i++) {
-        transformToStart(_surfPointsFlat->points[i], pointSel);
-
-        if (iterCount % 5 == 0) {
-          _lastSurfaceKDTree->nearestKSearch(pointSel, 1, pointSearchInd, pointSearchSqDis);
-          int closestPointInd = -1, minPointInd2 = -1, minPointInd3 = -1;
-          if (pointSearchSqDis[0] < 25) {
-            closestPointInd = pointSearchInd[0];
-            int closestPointScan = int(_lastSurfaceCloud->points[closestPointInd].intensity);
-
-            float pointSqDis, minPointSqDis2 = 25, minPointSqDis3 = 25;
-            for (size_t j = closestPointInd + 1; j < surfPointsFlatNum; j++) {
-              if (int(_lastSurfaceCloud->points[j].intensity) > closestPointScan + 2.5) {
-                break;
-              }
-
-              pointSqDis = calcSquaredDiff(_lastSurfaceCloud->points[j], pointSel);
-
-              if (int(_lastSurfaceCloud->points[j].intensity) <= closestPointScan) {
-                if (pointSqDis < minPointSqDis2) {
-                  minPointSqDis2 = pointSqDis;
-                  minPointInd2 = j;
-                }
-              } else {
-                if (pointSqDis < minPointSqDis3) {
-                  minPointSqDis3 = pointSqDis;
-                  minPointInd3 = j;
-                }
-              }
-            }
-            for (int j = closestPointInd - 1; j >= 0; j--) {
-              if (int(_lastSurfaceCloud->points[j].intensity) < closestPointScan - 2.5) {
-                break;
-              }
-
-              pointSqDis = calcSquaredDiff(_lastSurfaceCloud->points[j], pointSel);
-
-              if (int(_lastSurfaceCloud->points[j].intensity) >= closestPointScan) {
-                if (pointSqDis < minPointSqDis2) {
-                  minPointSqDis2 = pointSqDis;
-                  minPointInd2 = j;
-                }
-              } else {
-                if (pointSqDis < minPointSqDis3) {
-                  minPointSqDis3 = pointSqDis;
-                  minPointInd3 = j;
-                }
-              }
-            }
-          }
+      _threadPool->parallelFor(chunkNum, [&](size_t chunk, size_t) {
+        accumulateChunk(chunk * ODOMETRY_CHUNK_SIZE,
+                        std::min(featureNum, (chunk + 1) * ODOMETRY_CHUNK_SIZE),
+                        iterCount, _chunkEquations[chunk]);
+      });
 
-          _pointSearchSurfInd1[i] = closestPointInd;
-          _pointSearchSurfInd2[i] = minPointInd2;
-          _pointSearchSurfInd3[i] = minPointInd3;
-        }
-
-        if (_pointSearchSurfInd2[i] >= 0 && _pointSearchSurfInd3[i] >= 0) {
-          tripod1 = _lastSurfaceCloud->points[_pointSearchSurfInd1[i]];
-          tripod2 = _lastSurfaceCloud->points[_pointSearchSurfInd2[i]];
-          tripod3 = _lastSurfaceCloud->points[_pointSearchSurfInd3[i]];
-
-          float pa = (tripod2.y - tripod1.y) * (tripod3.z - tripod1.z)
-                     - (tripod3.y - tripod1.y) * (tripod2.z - tripod1.z);
-          float pb = (tripod2.z - tripod1.z) * (tripod3.x - tripod1.x)
-                     - (tripod3.z - tripod1.z) * (tripod2.x - tripod1.x);
-          float pc = (tripod2.x - tripod1.x) * (tripod3.y - tripod1.y)
-                     - (tripod3.x - tripod1.x) * (tripod2.y - tripod1.y);
-          float pd = -(pa * tripod1.x + pb * tripod1.y + pc * tripod1.z);
-
-          float ps = sqrt(pa * pa + pb * pb + pc * pc);
-          pa /= ps;
-          pb /= ps;
-          pc /= ps;
-          pd /= ps;
-
-          float pd2 = pa * pointSel.x + pb * pointSel.y + pc * pointSel.z + pd;
-
-          // TODO: Why writing to a variable that's never read? Maybe it should be used afterwards?
-          pointProj = pointSel;
-          pointProj.x -= pa * pd2;
-          pointProj.y -= pb * pd2;
-          pointProj.z -= pc * pd2;
-
-          float s = 1;
-          if (iterCount >= 5) {
-            s = 1 - 1.8f * fabs(pd2) / sqrt(calcPointDistance(pointSel));
-          }
-
-          coeff.x = s * pa;
-          coeff.y = s * pb;
-          coeff.z = s * pc;
-          coeff.intensity = s * pd2;
-
-          if (s > 0.1 && pd2 != 0) {
-            _laserCloudOri->push_back(_surfPointsFlat->points[i]);
-            _coeffSel->push_back(coeff);
-          }
-        }
+      // sum up in chunk order, so the result does not depend on the number of threads
+      NormalEquations normalEquations;
+      for (const NormalEquations& chunkEquations : _chunkEquations) {
+        normalEquations += chunkEquations;
       }
+      const Eigen::Matrix<float,6,6>& matAtA = normalEquations.matAtA();
+      Eigen::Matrix<float,6,1> matX;
+      size_t pointSelNum = normalEquations.size();
 
-      size_t pointSelNum = _laserCloudOri->points.size();
       if (pointSelNum < 10) {
         continue;
       }
 
-      Eigen::Matrix<float,Eigen::Dynamic,6> matA(pointSelNum, 6);
-      Eigen::Matrix<float,6,Eigen::Dynamic> matAt(6,pointSelNum);
-      Eigen::Matrix<float,6,6> matAtA;
-      Eigen::VectorXf matB(pointSelNum);
-      Eigen::Matrix<float,6,1> matAtB;
-      Eigen::Matrix<float,6,1> matX;
-
-      for (size_t i = 0; i < pointSelNum; i++) {
-        const pcl::PointXYZI& pointOri = _laserCloudOri->points[i];
-        coeff = _coeffSel->points[i];
-
-        float s = 1;
-
-        float srx = sin(s * _transform.rot_x.rad());
-        float crx = cos(s * _transform.rot_x.rad());
-        float sry = sin(s * _transform.rot_y.rad());
-        float cry = cos(s * _transform.rot_y.rad());
-        float srz = sin(s * _transform.rot_z.rad());
-        float crz = cos(s * _transform.rot_z.rad());
-        float tx = s * _transform.pos.x();
-        float ty = s * _transform.pos.y();
-        float tz = s * _transform.pos.z();
-
-      	// updated derivatives with respect to rotation and translation
-      	float arx, ary, arz, atx, aty, atz;
-      	int selectMethodType = 1; // 1: original; else: disturbance model
-
-      	if (selectMethodType == 1) {
-           arx = s * (- pointOri.x * (crx * sry * srz)
-                      + pointOri.y * (crx * crz * sry)
-                      + pointOri.z * (srx * sry)
-                      + tx * (crx * sry * srz)
-                      - ty * (crx * crz * sry)
-                      - tz * (srx * sry)) * coeff.x
-               + s * (+ pointOri.x * (srx * srz)
-                      - pointOri.y * (crz * srx)
-                      + pointOri.z * crx
-                      - tx * (srx * srz)
-                      + ty * (crz * srx)
-                      - tz * (crx)) * coeff.y
-               + s * (+ pointOri.x * (crx * cry * srz)
-                      - pointOri.y * (crx * cry * crz)
-                      - pointOri.z * (cry * srx)
-                      - tx * (crx * cry * srz)
-                      + ty * (crx * cry * crz)
-                      + tz * (cry * srx)) * coeff.z;
-
-           ary = s * (- pointOri.x * (crz * sry + cry * srx * srz)
-                      - pointOri.y * (sry * srz - cry * crz * srx)
-                      - pointOri.z * (crx * cry)
-                      + tx * (crz * sry + cry * srx * srz)
-                      + ty * (sry * srz - cry * crz * srx)
-                      + tz * (crx * cry)) * coeff.x
-               + s * (+ pointOri.x * (cry * crz - srx * sry * srz)
-                      + pointOri.y * (cry * srz + crz * srx * sry)
-                      - pointOri.z * (crx * sry)
-                      - tx * (cry * crz - srx * sry * srz)
-                      - ty * (cry * srz + crz * srx * sry)
-                      + tz * (crx * sry)) * coeff.z;
-
-           arz = s * (- pointOri.x * (cry * srz + crz * srx * sry)
-                      + pointOri.y * (cry * crz - srx * sry * srz)
-                      + tx * (cry * srz + crz * srx * sry)
-                      - ty * (cry * crz - srx * sry * srz)) * coeff.x
-               + s * (- pointOri.x * (crx * crz)
-                      - pointOri.y * (crx * srz)
-                      + tx * crx * crz
-                      + ty * crx * srz) * coeff.y
-               + s * (+ pointOri.x * (cry * crz * srx - sry * srz)
-                      + pointOri.y * (crz * sry + cry * srx * srz)
-                      + tx * (sry * srz - cry * crz * srx)
-                      - ty * (crz * sry + cry * srx * srz)) * coeff.z;
-
-           atx = - s * (cry * crz - srx * sry * srz) * coeff.x
-                 + s * (crx * srz) * coeff.y
-                 - s * (crz * sry + cry * srx * srz) * coeff.z;
-           aty = - s * (cry * srz + crz * srx * sry) * coeff.x
-                 - s * (crx * crz) * coeff.y
-                 - s * (sry * srz - cry * crz * srx) * coeff.z;
-           atz = + s * (crx * sry) * coeff.x
-                 - s * (srx) * coeff.y
-                 - s * (crx * cry) * coeff.z;
-      	} else {
-           s = 1.0;
-           float x_trf_bck = + pointOri.x * (crz * cry + srx * sry * srz)
-                             + pointOri.y * (cry * srz - crz * sry * srx)
-                             + pointOri.z * (crx * sry)
-                             + tx * (-crz * cry - srz * sry * srz)
-                             + ty * (-cry * srz + crz * sry * srx)
-                             + tz * (-crx * sry);
-           float y_trf_bck = + pointOri.x * (-crx * srz)
-                             + pointOri.y * (crz * crx)
-                             + pointOri.z * (srx)
-                             + tx * (crx * srz)
-                             + ty * (-crz * crx)
-                             + tz * (-srx);
-           float z_trf_bck = + pointOri.x * (-crz * sry + cry * srz * srx)
-                             + pointOri.y * (-srz * sry - crz * cry * srx)
-                             + pointOri.z * (cry * crx)
-                             + tx * (crz * sry - cry * srz * srx)
-                             + ty * (srz * sry + crz * cry * srx)
-                             + tz * (-cry * crx);
-
-           arx = -s * (0.0 *        coeff.x - z_trf_bck * coeff.y + y_trf_bck * coeff.z);
-           ary = -s * (z_trf_bck *  coeff.x + 0.0 *       coeff.y - x_trf_bck * coeff.z);
-           arz = -s * (-y_trf_bck * coeff.x + x_trf_bck * coeff.y + 0.0       * coeff.z);
-
-           atx = -s * coeff.x;
-           aty = -s * coeff.y;
-           atz = -s * coeff.z;
-      	}
-
-        float d2 = coeff.intensity;
-
-        matA(i, 0) = arx;
-        matA(i, 1) = ary;
-        matA(i, 2) = arz;
-        matA(i, 3) = atx;
-        matA(i, 4) = aty;
-        matA(i, 5) = atz;
-        matB(i, 0) = -0.05 * d2;
-      }
-      matAt = matA.transpose();
-      matAtA = matAt * matA;
-      matAtB = matAt * matB;
-
-      matX = matAtA.colPivHouseholderQr().solve(matAtB);
+      matX = matAtA.colPivHouseholderQr().solve(normalEquations.matAtB());
 
       if (iterCount == 0) {
         Eigen::Matrix<float,1,6> matE;
@@ -799,11 +827,18 @@ bool LaserOdometry::process()
   _transformSum.rot_z = rz;
   _transformSum.pos = trans;
 
-  transformToEnd(_cornerPointsLessSharp);
-  transformToEnd(_surfPointsLessFlat);
+  // fresh clouds, as lastCornerCloud() and lastSurfaceCloud() may have handed out the
+  // previous ones. The KD-trees own a packed copy of the points they were built on,
+  // and are only consulted when the clouds pass the size guards below, i.e. after a rebuild.
+  _lastCornerCloud.reset(new pcl::PointCloud<pcl::PointXYZI>());
+  _lastSurfaceCloud.reset(new pcl::PointCloud<pcl::PointXYZI>());
+  transformToEnd(*_cornerPointsLessSharp, *_lastCornerCloud);
+  transformToEnd(*_surfPointsLessFlat, *_lastSurfaceCloud);
 
-  _cornerPointsLessSharp.swap(_lastCornerCloud);
-  _surfPointsLessFlat.swap(_lastSurfaceCloud);
+  // sanitize once here, so the KD-trees and the association never see NaNs
+  std::vector<int> indices;
+  pcl::removeNaNFromPointCloud(*_lastCornerCloud, *_lastCornerCloud, indices);
+  pcl::removeNaNFromPointCloud(*_lastSurfaceCloud, *_lastSurfaceCloud, indices);
 
   lastCornerCloudSize = _lastCornerCloud->points.size();
   lastSurfaceCloudSize = _lastSurfaceCloud->points.size();
@@ -811,6 +846,8 @@ bool LaserOdometry::process()
   if (lastCornerCloudSize > 10 && lastSurfaceCloudSize > 100) {
     _lastCornerKDTree->setInputCloud(_lastCornerCloud);
     _lastSurfaceKDTree->setInputCloud(_lastSurfaceCloud);
+    _lastCornerRingIndex.setInputCloud(*_lastCornerCloud);
+    _lastSurfaceRingIndex.setInputCloud(*_lastSurfaceCloud);
   }
 
   return true;
@@ -819,9 +856,7 @@ bool LaserOdometry::process()
 bool LaserOdometry::generateRegisteredCloud(pcl::PointCloud<pcl::PointXYZI>::Ptr& registered_cloud) {
   // transform full resolution input cloud to end
   if (_params.ioRatio < 2 || _frameCount % _params.ioRatio == 1) {
-    transformToEnd(_laserCloudFullRes);  // transform full resolution cloud to sweep end before sending it
-
-//    pcl::copyPointCloud(*_laserCloudFullRes, *registered_cloud); // TODO: fix it
+    transformToEnd(*_laserCloudFullRes, *registered_cloud);  // transform full resolution cloud to sweep end before sending it
 
     return true;
   }
@@ -36,11 +36,15 @@
 #include "common.h"
 #include "Twist.h"
 #include "nanoflann_pcl.h"
+#include "NormalEquations.h"
 #include "Parameters.h"
+#include "RingIndex.h"
+#include "ThreadPool.h"
 
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include <pcl/common/io.h>
+#include <Eigen/Core>
 //#include <tf/transform_datatypes.h>
 //#include <tf/transform_broadcaster.h>
 
@@ -54,12 +58,15 @@ class LaserOdometry {
 public:
   explicit LaserOdometry(const LaserOdometryParams& params = LaserOdometryParams());
 
-  /** \brief Process incoming messages in a loop until shutdown (used in active mode). */
-  void spin(const pcl::PointCloud<pcl::PointXYZI>::Ptr&,
-            const pcl::PointCloud<pcl::PointXYZI>::Ptr&,
-            const pcl::PointCloud<pcl::PointXYZI>::Ptr&,
-            const pcl::PointCloud<pcl::PointXYZI>::Ptr&,
-            const pcl::PointCloud<pcl::PointXYZI>::Ptr&,
+  /** \brief Process incoming messages in a loop until shutdown (used in active mode).
+   *
+   * The clouds are shared, not copied, and are only read during this call.
+   */
+  void spin(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr&,
+            const pcl::PointCloud<pcl::PointXYZI>::ConstPtr&,
+            const pcl::PointCloud<pcl::PointXYZI>::ConstPtr&,
+            const pcl::PointCloud<pcl::PointXYZI>::ConstPtr&,
+            const pcl::PointCloud<pcl::PointXYZI>::ConstPtr&,
             Twist _transform,
             Time timestamp);
 
@@ -69,23 +76,23 @@ public:
   bool generateRegisteredCloud(pcl::PointCloud<pcl::PointXYZI>::Ptr& registered_cloud);
 
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr& cornerPointsSharp() {
+  const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& cornerPointsSharp() const {
     return _cornerPointsSharp;
   }
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr& cornerPointsLessSharp() {
+  const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& cornerPointsLessSharp() const {
     return _cornerPointsLessSharp;
   }
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr& surfPointsFlat() {
+  const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& surfPointsFlat() const {
     return _surfPointsFlat;
   }
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr& surfPointsLessFlat() {
+  const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& surfPointsLessFlat() const {
     return _surfPointsLessFlat;
   }
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr& laserCloudFullRes() {
+  const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& laserCloudFullRes() const {
     return _laserCloudFullRes;
   }
 
@@ -202,9 +209,11 @@ protected:
 
   /** \brief Transform the given point cloud to the end of the sweep.
    *
-   * @param cloud the point cloud to transform
+   * @param cloudIn the point cloud to transform
+   * @param cloudOut the point cloud instance for storing the result
    */
-  size_t transformToEnd(pcl::PointCloud<pcl::PointXYZI>::Ptr& cloud);
+  size_t transformToEnd(const pcl::PointCloud<pcl::PointXYZI>& cloudIn,
+                        pcl::PointCloud<pcl::PointXYZI>& cloudOut);
 
   void pluginIMURotation(const Angle& bcx, const Angle& bcy, const Angle& bcz,
                          const Angle& blx, const Angle& bly, const Angle& blz,
@@ -214,6 +223,38 @@ protected:
   void accumulateRotation(Angle cx, Angle cy, Angle cz,
                           Angle lx, Angle ly, Angle lz,
                           Angle &ox, Angle &oy, Angle &oz);
+
+  /** \brief Find the edge in the last corner cloud matching a sharp corner point.
+   *
+   * New correspondences are searched every fifth iteration, starting from the nearest neighbors
+   * found for all feature points in one batch, otherwise the stored ones are reused.
+   *
+   * @param i the index of the sharp corner point
+   * @param iterCount the current iteration
+   * @param coeff the point instance for storing the residual direction and distance
+   * @return true if the point contributes a residual
+   */
+  bool associateCorner(const size_t& i,
+                       const size_t& iterCount,
+                       pcl::PointXYZI& coeff);
+
+  /** \brief Find the plane in the last surface cloud matching a flat surface point.
+   *
+   * @see associateCorner()
+   */
+  bool associateSurface(const size_t& i,
+                        const size_t& iterCount,
+                        pcl::PointXYZI& coeff);
+
+  /** \brief Associate the feature points [begin, end) and sum up their normal equations.
+   *
+   * Feature indices address the sharp corner points first, followed by the flat surface points.
+   * Chunks only write their own correspondence slots, so they can be processed in parallel.
+   */
+  void accumulateChunk(const size_t& begin,
+                       const size_t& end,
+                       const size_t& iterCount,
+                       NormalEquations& normalEquations);
   
 
 private:
@@ -237,21 +278,24 @@ private:
   bool _newLaserCloudFullRes;       ///< flag if a new full resolution cloud has been received
   bool _newImuTrans;                ///< flag if a new IMU transformation information cloud has been received
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _cornerPointsSharp;      ///< sharp corner points cloud
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _cornerPointsLessSharp;  ///< less sharp corner points cloud
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _surfPointsFlat;         ///< flat surface points cloud
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _surfPointsLessFlat;     ///< less flat surface points cloud
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudFullRes;             ///< full resolution cloud
+  pcl::PointCloud<pcl::PointXYZI>::ConstPtr _cornerPointsSharp;      ///< sharp corner points cloud
+  pcl::PointCloud<pcl::PointXYZI>::ConstPtr _cornerPointsLessSharp;  ///< less sharp corner points cloud
+  pcl::PointCloud<pcl::PointXYZI>::ConstPtr _surfPointsFlat;         ///< flat surface points cloud
+  pcl::PointCloud<pcl::PointXYZI>::ConstPtr _surfPointsLessFlat;     ///< less flat surface points cloud
+  pcl::PointCloud<pcl::PointXYZI>::ConstPtr _laserCloudFullRes;      ///< full resolution cloud
 
   pcl::PointCloud<pcl::PointXYZI>::Ptr _lastCornerCloud;    ///< last corner points cloud
   pcl::PointCloud<pcl::PointXYZI>::Ptr _lastSurfaceCloud;   ///< last surface points cloud
 
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _laserCloudOri;      ///< point selection
-  pcl::PointCloud<pcl::PointXYZI>::Ptr _coeffSel;           ///< point selection coefficients
-
   nanoflann::KdTreeFLANN<pcl::PointXYZI>::Ptr _lastCornerKDTree;   ///< last corner cloud KD-tree
   nanoflann::KdTreeFLANN<pcl::PointXYZI>::Ptr _lastSurfaceKDTree;  ///< last surface cloud KD-tree
+  RingIndex _lastCornerRingIndex;    ///< last corner cloud index by scan ring, for the second tripod point
+  RingIndex _lastSurfaceRingIndex;   ///< last surface cloud index by scan ring, for the second and third tripod points
+
 
+  std::vector<pcl::PointXYZI, Eigen::aligned_allocator<pcl::PointXYZI> > _pointSel;  ///< feature points transformed to the sweep start in the last search iteration
+  std::vector<int> _pointSearchNearestInd;        ///< nearest neighbor index per feature point, in the last corner or surface cloud
+  std::vector<float> _pointSearchNearestSqDis;    ///< nearest neighbor squared distance per feature point
 
   std::vector<int> _pointSearchCornerInd1;    ///< first corner point search index buffer
   std::vector<int> _pointSearchCornerInd2;    ///< second corner point search index buffer
@@ -260,6 +304,9 @@ private:
   std::vector<int> _pointSearchSurfInd2;    ///< second surface point search index buffer
   std::vector<int> _pointSearchSurfInd3;    ///< third surface point search index buffer
 
+  std::vector<NormalEquations, Eigen::aligned_allocator<NormalEquations> > _chunkEquations;  ///< per chunk normal equations
+  ThreadPool::Ptr _threadPool;              ///< workers associating the feature points
+
   Twist _transform;     ///< optimized pose transformation
   Twist _transformSum;  ///< accumulated optimized pose transformation
 
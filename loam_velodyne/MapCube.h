@@ -0,0 +1,153 @@
+#ifndef LOAM_MAPCUBE_H
+#define LOAM_MAPCUBE_H
+
+
+#include <stddef.h>
+#include <unordered_map>
+
+#include "nanoflann_pcl.h"
+#include "VoxelHashIndex.h"
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+
+namespace loam {
+
+/** \brief Integer coordinates of a map cube, counted in cubes from the cube of the map origin. */
+struct CubeKey {
+  CubeKey(const int& i_ = 0, const int& j_ = 0, const int& k_ = 0)
+      : i(i_), j(j_), k(k_)
+  {}
+
+  bool operator==(const CubeKey& other) const
+  {
+    return i == other.i && j == other.j && k == other.k;
+  }
+
+  int i, j, k;
+};
+
+/** \brief Spatial hash of cube coordinates. */
+struct CubeKeyHash {
+  size_t operator()(const CubeKey& key) const
+  {
+    return (size_t(key.i) * 73856093u) ^ (size_t(key.j) * 19349663u) ^ (size_t(key.k) * 83492791u);
+  }
+};
+
+/** \brief The corner and surface map points of one 50 m cube of the map.
+ *
+ * Each cube keeps its own search indices, KD-trees or voxel hash indices,
+ * which are only rebuilt in updateIndices() after the points of the cube
+ * changed. The local map is searched by querying the indices of the few cubes
+ * around a point instead of one index over the concatenation of all
+ * surrounding cubes, so the per-frame index cost scales with the cubes that
+ * received points rather than with the local map.
+ */
+struct MapCube {
+  typedef pcl::PointCloud<pcl::PointXYZI> Cloud;
+  typedef nanoflann::KdTreeFLANN<pcl::PointXYZI> KdTree;
+
+  MapCube()
+      : cornerCloud(new Cloud()),
+        surfCloud(new Cloud()),
+        cornerDirty(false),
+        surfDirty(false),
+        indicesStale(false),
+        valid(false)
+  {}
+
+  /** \brief Rebuild the search indices if the points changed since the last call.
+   *
+   * @param voxelHash build voxel hash indices if true, KD-trees otherwise
+   * @param searchRadius the search radius of the voxel hash indices
+   */
+  void updateIndices(const bool& voxelHash, const float& searchRadius)
+  {
+    if (!indicesStale) {
+      return;
+    }
+    if (voxelHash) {
+      updateHash(cornerCloud, cornerHash, searchRadius);
+      updateHash(surfCloud, surfHash, searchRadius);
+      cornerKdtree.reset();
+      surfKdtree.reset();
+    } else {
+      updateKdTree(cornerCloud, cornerKdtree);
+      updateKdTree(surfCloud, surfKdtree);
+      cornerHash.reset();
+      surfHash.reset();
+    }
+    indicesStale = false;
+  }
+
+  /** \brief Find the k nearest corner or surface points with whichever index was built.
+   *
+   * A voxel hash index only returns points within its search radius. Missing
+   * neighbors are marked by index -1.
+   *
+   * @return false if there is no index, i.e. the cloud is empty
+   */
+  bool nearestKSearch(const bool& corner,
+                      const pcl::PointXYZI& point,
+                      const int& k,
+                      int* indices,
+                      float* sqDistances) const
+  {
+    const KdTree::Ptr& kdtree = corner ? cornerKdtree : surfKdtree;
+    const VoxelHashIndex::Ptr& hash = corner ? cornerHash : surfHash;
+    if (kdtree) {
+      kdtree->nearestKSearch(&point, 1, k, indices, sqDistances);
+    } else if (hash) {
+      hash->nearestKSearch(&point, 1, k, indices, sqDistances);
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  Cloud::Ptr cornerCloud;     ///< corner points
+  Cloud::Ptr surfCloud;       ///< surface points
+  KdTree::Ptr cornerKdtree;   ///< KD-tree of the corner points, null if there are none
+  KdTree::Ptr surfKdtree;     ///< KD-tree of the surface points, null if there are none
+  VoxelHashIndex::Ptr cornerHash;   ///< voxel hash index of the corner points, null if there are none
+  VoxelHashIndex::Ptr surfHash;     ///< voxel hash index of the surface points, null if there are none
+  bool cornerDirty;           ///< flag if corner points were added since the corner cloud was down sized
+  bool surfDirty;             ///< flag if surface points were added since the surface cloud was down sized
+  bool indicesStale;          ///< flag if the points changed since the search indices were built
+  bool valid;                 ///< flag if the cube is part of the local map of the current frame
+
+private:
+  static void updateKdTree(const Cloud::Ptr& cloud, KdTree::Ptr& kdtree)
+  {
+    if (cloud->empty()) {
+      kdtree.reset();
+      return;
+    }
+    if (!kdtree) {
+      kdtree.reset(new KdTree());
+    }
+    kdtree->setInputCloud(cloud);
+  }
+
+  static void updateHash(const Cloud::Ptr& cloud, VoxelHashIndex::Ptr& hash, const float& cellSize)
+  {
+    if (cloud->empty()) {
+      hash.reset();
+      return;
+    }
+    if (!hash) {
+      hash.reset(new VoxelHashIndex());
+    }
+    hash->setCellSize(cellSize);
+    hash->setInputCloud(cloud);
+  }
+};
+
+/** \brief Sparse map of the occupied cubes. Elements never move, so references stay valid on insertion. */
+typedef std::unordered_map<CubeKey, MapCube, CubeKeyHash> CubeMap;
+
+} // end namespace loam
+
+#endif //LOAM_MAPCUBE_H
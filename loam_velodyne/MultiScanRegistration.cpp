@@ -36,6 +36,8 @@
 
 #include "math_utils.h"
 
+#include <algorithm>
+
 
 namespace loam {
 
@@ -45,9 +47,13 @@ MultiScanMapper::MultiScanMapper(const float& lowerBound,
     : _lowerBound(lowerBound),
       _upperBound(upperBound),
       _nScanRings(nScanRings),
-      _factor((nScanRings - 1) / (upperBound - lowerBound))
+      _factor((nScanRings - 1) / (upperBound - lowerBound)),
+      _beamMin(0),
+      _beamMax(0),
+      _lookupMin(0),
+      _lookupScale(0)
 {
-
+  buildLookupTable();
 }
 
 void MultiScanMapper::set(const float &lowerBound,
@@ -58,11 +64,75 @@ void MultiScanMapper::set(const float &lowerBound,
   _upperBound = upperBound;
   _nScanRings = nScanRings;
   _factor = (nScanRings - 1) / (upperBound - lowerBound);
+  buildLookupTable();
+}
+
+void MultiScanMapper::setBeamAngles(const std::vector<float>& beamAngles)
+{
+  _beamAngles.clear();
+  for (float angle : beamAngles) {
+    _beamAngles.push_back(deg2rad(angle));
+  }
+
+  if (!_beamAngles.empty()) {
+    _nScanRings = _beamAngles.size();
+
+    // accept points up to half a beam gap beyond the outermost beams
+    std::vector<float> sorted(_beamAngles);
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+    float lowerGap = n > 1 ? sorted[1] - sorted[0] : deg2rad(1.0f);
+    float upperGap = n > 1 ? sorted[n - 1] - sorted[n - 2] : deg2rad(1.0f);
+    _beamMin = sorted[0] - lowerGap / 2;
+    _beamMax = sorted[n - 1] + upperGap / 2;
+  }
+
+  buildLookupTable();
+}
+
+
+
+MultiScanMapper MultiScanMapper::Hesai_P40()
+{
+  // 6 beams 1 degree apart from 7 to 2 degrees, 23 beams 1/3 degree apart
+  // from 5/3 to -17/3 degrees, and 11 beams 1 degree apart from -6 to -16 degrees
+  std::vector<float> beamAngles;
+  for (int i = 0; i < 6; i++) {
+    beamAngles.push_back(7 - i);
+  }
+  for (int i = 0; i < 23; i++) {
+    beamAngles.push_back((5 - i) / 3.0f);
+  }
+  for (int i = 0; i < 11; i++) {
+    beamAngles.push_back(-6 - i);
+  }
+
+  MultiScanMapper mapper(-16, 7, 40);
+  mapper.setBeamAngles(beamAngles);
+  return mapper;
 }
 
 
 
 int MultiScanMapper::getRingForAngle(const float& angle) {
+  if (!_beamAngles.empty()) {
+    if (!(angle >= _beamMin && angle <= _beamMax)) {
+      return -1;
+    }
+
+    // closest beam
+    int ring = 0;
+    float minDiff = std::fabs(angle - _beamAngles[0]);
+    for (size_t i = 1; i < _beamAngles.size(); i++) {
+      float diff = std::fabs(angle - _beamAngles[i]);
+      if (diff < minDiff) {
+        minDiff = diff;
+        ring = i;
+      }
+    }
+    return ring;
+  }
+
   float angle_ = angle * 180 / M_PI;
   if (angle_ < 7.5 && angle_ > 1.8)
     return round(8 - angle_) - 1;
@@ -76,6 +146,52 @@ int MultiScanMapper::getRingForAngle(const float& angle) {
 
 
 
+int MultiScanMapper::getRingForTan(const float& tanAngle) {
+  float bin = (tanAngle - _lookupMin) * _lookupScale;
+  if (bin >= 0 && bin < LOOKUP_TABLE_SIZE) {
+    int ring = _ringLookup[int(bin)];
+    if (ring != RING_EXACT) {
+      return ring;
+    }
+  }
+
+  // bins with a ring boundary, values outside the table and NaN
+  return getRingForAngle(std::atan(tanAngle));
+}
+
+
+
+void MultiScanMapper::buildLookupTable()
+{
+  // cover the field of view with a degree to spare, outside of it the exact mapping is used
+  float lowerAngle, upperAngle;
+  if (!_beamAngles.empty()) {
+    lowerAngle = _beamMin - deg2rad(1.0f);
+    upperAngle = _beamMax + deg2rad(1.0f);
+  } else {
+    lowerAngle = deg2rad(-17.5f);
+    upperAngle = deg2rad(8.5f);
+  }
+
+  _lookupMin = std::tan(lowerAngle);
+  _lookupScale = LOOKUP_TABLE_SIZE / (std::tan(upperAngle) - _lookupMin);
+  _ringLookup.resize(LOOKUP_TABLE_SIZE);
+
+  // Ring boundaries lie much farther apart than a bin is wide (about 0.01 deg),
+  // so a bin holds at most one of them. A bin mapping both its (slightly
+  // widened) ends and its center to the same ring thus lies within that ring.
+  const float margin = 0.05f;
+  for (int i = 0; i < LOOKUP_TABLE_SIZE; i++) {
+    int lowerRing = getRingForAngle(std::atan(_lookupMin + (i - margin) / _lookupScale));
+    int centerRing = getRingForAngle(std::atan(_lookupMin + (i + 0.5f) / _lookupScale));
+    int upperRing = getRingForAngle(std::atan(_lookupMin + (i + 1 + margin) / _lookupScale));
+
+    _ringLookup[i] = (lowerRing == centerRing && centerRing == upperRing) ? centerRing : RING_EXACT;
+  }
+}
+
+
+
 
 
 
@@ -83,7 +199,8 @@ MultiScanRegistration::MultiScanRegistration(const MultiScanMapper& scanMapper,
                                              const ScanRegistrationParams& params)
     : ScanRegistration(params),
       _systemDelay(SYSTEM_DELAY),
-      _scanMapper(scanMapper)
+      _scanMapper(scanMapper),
+      _beamRingsCalibrated(false)
 {
 
 };
@@ -130,14 +247,13 @@ void MultiScanRegistration::process(const pcl::PointCloud<pcl::PointXYZ>& laserC
     }
 
     // calculate vertical point angle and scan ID
-    float angle = std::atan(point.y / std::sqrt(point.x * point.x + point.z * point.z));
-    int scanID = _scanMapper.getRingForAngle(angle);
+    int scanID = _scanMapper.getRingForTan(point.y / std::sqrt(point.x * point.x + point.z * point.z));
     if (scanID >= _scanMapper.getNumberOfScanRings() || scanID < 0 ){
       continue;
     }
 
     // calculate horizontal point angle
-    float ori = -std::atan2(point.x, point.z);
+    float ori = -fastAtan2(point.x, point.z);
     if (!halfPassed) {
       if (ori < startOri - M_PI / 2) {
         ori += 2 * M_PI;
@@ -190,4 +306,103 @@ void MultiScanRegistration::process(const pcl::PointCloud<pcl::PointXYZ>& laserC
   // publishResult();
 }
 
+
+
+
+void MultiScanRegistration::processOrganized(const pcl::PointCloud<pcl::PointXYZ>& laserCloudIn,
+                                             const Time& scanTime)
+{
+  // reset internal buffers and set IMU start state based on current scan time
+  reset(scanTime);
+
+  if (!_beamRingsCalibrated) {
+    _beamRingsCalibrated = calibrateBeamRings(laserCloudIn);
+  }
+
+  size_t nFirings = laserCloudIn.width;
+  pcl::PointXYZI point;
+
+  // construct sorted full resolution cloud ring by ring, in firing order
+  size_t cloudSize = 0;
+  for (size_t ring = 0; ring < _ringBeams.size(); ring++) {
+    const std::vector<int>& beams = _ringBeams[ring];
+
+    for (size_t col = 0; col < nFirings; col++) {
+      // relative scan time based on the firing
+      float relTime = _params.scanPeriod * col / nFirings;
+
+      for (int beam : beams) {
+        const pcl::PointXYZ& pointIn = laserCloudIn(col, beam);
+        point.x = pointIn.y;
+        point.y = pointIn.z;
+        point.z = pointIn.x;
+
+        // skip NaN and INF valued points
+        if (!pcl_isfinite(point.x) ||
+            !pcl_isfinite(point.y) ||
+            !pcl_isfinite(point.z)) {
+          continue;
+        }
+
+        // skip zero valued points
+        if (point.x * point.x + point.y * point.y + point.z * point.z < 0.0001) {
+          continue;
+        }
+
+        point.intensity = ring + relTime;
+        _laserCloud.push_back(point);
+      }
+    }
+
+    IndexRange range(cloudSize, 0);
+    cloudSize = _laserCloud.size();
+    range.second = cloudSize > 0 ? cloudSize - 1 : 0;
+    _scanIndices.push_back(range);
+  }
+
+  // extract features
+  extractFeatures();
+}
+
+
+
+bool MultiScanRegistration::calibrateBeamRings(const pcl::PointCloud<pcl::PointXYZ>& laserCloudIn)
+{
+  size_t nBeams = laserCloudIn.height;
+  size_t nFirings = laserCloudIn.width;
+  int nRings = _scanMapper.getNumberOfScanRings();
+
+  _ringBeams.assign(nRings, std::vector<int>());
+
+  bool assigned = false;
+  std::vector<int> votes(nRings);
+  for (size_t beam = 0; beam < nBeams; beam++) {
+    std::fill(votes.begin(), votes.end(), 0);
+
+    for (size_t col = 0; col < nFirings; col++) {
+      const pcl::PointXYZ& point = laserCloudIn(col, beam);
+      if (!pcl_isfinite(point.x) ||
+          !pcl_isfinite(point.y) ||
+          !pcl_isfinite(point.z) ||
+          point.x * point.x + point.y * point.y + point.z * point.z < 0.0001) {
+        continue;
+      }
+
+      int scanID = _scanMapper.getRingForTan(point.z / std::sqrt(point.x * point.x + point.y * point.y));
+      if (scanID >= 0 && scanID < nRings) {
+        votes[scanID]++;
+      }
+    }
+
+    // beams outside of the mapped field of view are dropped, as their points would be
+    int ring = std::max_element(votes.begin(), votes.end()) - votes.begin();
+    if (nRings > 0 && votes[ring] > 0) {
+      _ringBeams[ring].push_back(beam);
+      assigned = true;
+    }
+  }
+
+  return assigned;
+}
+
 } // end namespace loam
@@ -36,13 +36,22 @@
 
 #include "loam_velodyne/ScanRegistration.h"
 
+#include <vector>
+
 
 namespace loam {
 
 
 
-/** \brief Class realizing a linear mapping from vertical point angle to the corresponding scan ring.
+/** \brief Class realizing a mapping from vertical point angle to the corresponding scan ring.
+ *
+ * Without a beam angle table the rings follow the fixed formula of our 40 beam
+ * sensor. With a table, a point belongs to the beam closest to its angle.
  *
+ * For the per point loop the mapping is also precomputed into a lookup table
+ * indexed by the tangent of the vertical angle, which saves the atan() call.
+ * Bins containing a ring boundary are marked and resolved by the exact mapping,
+ * so the table gives the same rings as getRingForAngle(std::atan(tanAngle)).
  */
 class MultiScanMapper {
 public:
@@ -70,12 +79,27 @@ public:
            const float& upperBound,
            const uint16_t& nScanRings);
 
+  /** \brief Set the vertical angles of the beams, ring i being the beam at beamAngles[i].
+   *
+   * An empty table restores the fixed formula.
+   *
+   * @param beamAngles the vertical beam angles (degrees)
+   */
+  void setBeamAngles(const std::vector<float>& beamAngles);
+
   /** \brief Map the specified vertical point angle to its ring ID.
    *
    * @param angle the vertical point angle (in rad)
-   * @return the ring ID
+   * @return the ring ID, or -1 for angles outside the field of view
    */
-  inline int getRingForAngle(const float& angle);
+  int getRingForAngle(const float& angle);
+
+  /** \brief Map the tangent of the vertical point angle to its ring ID using the lookup table.
+   *
+   * @param tanAngle the tangent of the vertical point angle, i.e. height over horizontal distance
+   * @return the ring ID, or -1 for angles outside the field of view
+   */
+  int getRingForTan(const float& tanAngle);
 
   /** Multi scan mapper for Velodyne VLP-16 according to data sheet. */
   static inline MultiScanMapper Velodyne_VLP_16() { return MultiScanMapper(-15, 15, 16); };
@@ -86,12 +110,32 @@ public:
   /** Multi scan mapper for Velodyne HDL-64E according to data sheet. */
   static inline MultiScanMapper Velodyne_HDL_64E() { return MultiScanMapper(-24.9f, 2, 64); };
 
+  /** Multi scan mapper for the Hesai P40 with its beam angle table. */
+  static MultiScanMapper Hesai_P40();
+
 
 private:
+  /** \brief Rebuild the lookup table after the mapping has changed. */
+  void buildLookupTable();
+
+  /** Marks lookup table bins that need the exact mapping. */
+  static const int16_t RING_EXACT = -2;
+
+  /** The number of lookup table bins. */
+  static const int LOOKUP_TABLE_SIZE = 4096;
+
   float _lowerBound;      ///< the vertical angle of the first scan ring
   float _upperBound;      ///< the vertical angle of the last scan ring
   uint16_t _nScanRings;   ///< number of scan rings
   float _factor;          ///< linear interpolation factor
+
+  std::vector<float> _beamAngles;   ///< vertical beam angles (rad), empty for the fixed formula
+  float _beamMin;                   ///< lowest vertical angle still assigned to a beam (rad)
+  float _beamMax;                   ///< highest vertical angle still assigned to a beam (rad)
+
+  std::vector<int16_t> _ringLookup; ///< ring ID per tangent bin
+  float _lookupMin;                 ///< tangent at the start of the first bin
+  float _lookupScale;               ///< bins per tangent unit
 };
 
 
@@ -113,14 +157,41 @@ public:
   void process(const pcl::PointCloud<pcl::PointXYZ>& laserCloudIn,
                const Time& scanTime);
 
+  /** \brief Process a new organized input cloud.
+   *
+   * The cloud holds one row per beam and one column per firing, in firing
+   * order, with invalid points set to NaN. Rings are taken from the beams
+   * instead of the vertical point angles, and relative point times from the
+   * firing columns instead of the horizontal point angles. The beam to ring
+   * assignment is calibrated once from the vertical angles of the first frame.
+   *
+   * @param laserCloudIn the new organized input cloud to process
+   * @param scanTime the scan (message) timestamp
+   */
+  void processOrganized(const pcl::PointCloud<pcl::PointXYZ>& laserCloudIn,
+                        const Time& scanTime);
+
   int& systemDelay() {
     return _systemDelay;
   }
 
 protected:
+  /** \brief Assign each beam of the organized cloud the ring most of its points map to.
+   *
+   * Beams without valid points, like dead channels or upward beams seeing only
+   * sky, stay unmapped and their points are dropped.
+   *
+   * @param laserCloudIn the organized input cloud
+   * @return true if any beam could be assigned, so the assignment is final
+   */
+  bool calibrateBeamRings(const pcl::PointCloud<pcl::PointXYZ>& laserCloudIn);
+
   int _systemDelay;             ///< system startup delay counter
   MultiScanMapper _scanMapper;  ///< mapper for mapping vertical point angles to scan ring IDs
 
+  bool _beamRingsCalibrated;                 ///< flag if the beam to ring assignment is final
+  std::vector<std::vector<int> > _ringBeams; ///< beams (rows of the organized cloud) per ring
+
 private:
   static const int SYSTEM_DELAY = 0;
 };
@@ -0,0 +1,72 @@
+#ifndef LOAM_NORMALEQUATIONS_H
+#define LOAM_NORMALEQUATIONS_H
+
+
+#include <stddef.h>
+
+#include <Eigen/Core>
+
+
+namespace loam {
+
+/** \brief Normal equations A^T*A*x = A^T*b of a least squares problem in the six pose parameters.
+ *
+ * Residuals are added one row at a time, so neither A nor its transpose is
+ * ever stored and accumulating does not allocate. Partial sums, e.g. of
+ * different threads, can be combined with operator+=.
+ */
+class NormalEquations {
+public:
+  typedef Eigen::Matrix<float, 6, 6> Matrix6;
+  typedef Eigen::Matrix<float, 6, 1> Vector6;
+
+  NormalEquations() { clear(); }
+
+  /** \brief Remove all residuals. */
+  void clear()
+  {
+    _matAtA.setZero();
+    _matAtB.setZero();
+    _size = 0;
+  }
+
+  /** \brief Add one residual.
+   *
+   * @param a the row of the Jacobian A
+   * @param b the entry of the right hand side b
+   */
+  void add(const Vector6& a, const float& b)
+  {
+    _matAtA.noalias() += a * a.transpose();
+    _matAtB.noalias() += a * b;
+    _size++;
+  }
+
+  NormalEquations& operator+=(const NormalEquations& other)
+  {
+    _matAtA += other._matAtA;
+    _matAtB += other._matAtB;
+    _size += other._size;
+    return *this;
+  }
+
+  /** \brief The matrix A^T*A. */
+  const Matrix6& matAtA() const { return _matAtA; }
+
+  /** \brief The vector A^T*b. */
+  const Vector6& matAtB() const { return _matAtB; }
+
+  /** \brief The number of residuals added. */
+  size_t size() const { return _size; }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+  Matrix6 _matAtA;
+  Vector6 _matAtB;
+  size_t _size;
+};
+
+} // end namespace loam
+
+#endif //LOAM_NORMALEQUATIONS_H
@@ -82,6 +82,9 @@ struct ScanRegistrationParams {
 
   int nScanRings;
 
+  /** The number of threads extracting features from the scans in parallel. */
+  int nThreads;
+
   ScanRegistrationParams(const float& scanPeriod_ = 0.1,
                         const int& imuHistorySize_ = 200,
                         const int& nFeatureRegions_ = 6,
@@ -91,7 +94,8 @@ struct ScanRegistrationParams {
                         const float& lessFlatFilterSize_ = 0.2,
                         const float& surfaceCurvatureThreshold_ = 0.1,
                         const int& systemDelay_ = 20,
-                        const std::string lidarModel_ = "none")
+                        const std::string lidarModel_ = "none",
+                        const int& nThreads_ = 1)
   : scanPeriod(scanPeriod_),
     imuHistorySize(imuHistorySize_),
     nFeatureRegions(nFeatureRegions_),
@@ -102,7 +106,8 @@ struct ScanRegistrationParams {
     lessFlatFilterSize(lessFlatFilterSize_),
     surfaceCurvatureThreshold(surfaceCurvatureThreshold_),
     systemDelay(systemDelay_),
-    lidarModel(lidarModel_)
+    lidarModel(lidarModel_),
+    nThreads(nThreads_)
   { }
 
 };
@@ -117,16 +122,21 @@ struct LaserOdometryParams {
   float deltaTAbort;     ///< optimization abort threshold for deltaT
   float deltaRAbort;     ///< optimization abort threshold for deltaR
 
+  /** The number of threads associating feature points in parallel. */
+  int nThreads;
+
   LaserOdometryParams(const float& scanPeriod_ = 0.1,
                       const uint16_t& ioRatio_ = 2,
                       const size_t& maxIterations_ = 25,
                       const float& deltaTAbort_ = 0.1,
-                      const float& deltaRAbort_ = 0.1)
+                      const float& deltaRAbort_ = 0.1,
+                      const int& nThreads_ = 1)
   : scanPeriod(scanPeriod_),
     ioRatio(ioRatio_),
     maxIterations(maxIterations_),
     deltaTAbort(deltaTAbort_),
-    deltaRAbort(deltaRAbort_)
+    deltaRAbort(deltaRAbort_),
+    nThreads(nThreads_)
   { }
 };
 
@@ -143,10 +153,20 @@ struct LaserMappingParams {
   float surfFilterSize;
   float mapFilterSize;
 
-  static const size_t laserCloudWidth = 21;
-  static const size_t laserCloudHeight = 11;
-  static const size_t laserCloudDepth = 21;
-  static const size_t laserCloudNum = laserCloudWidth * laserCloudHeight * laserCloudDepth;
+  /** The number of threads associating stack points with the map in parallel. */
+  int nThreads;
+
+  float fovMinElevation;  ///< lower bound of the vertical field of view in degrees
+  float fovMaxElevation;  ///< upper bound of the vertical field of view in degrees
+  float fovMaxRange;      ///< maximum range in m, 0 for no limit
+
+  /** Search the map with voxel hash indices instead of KD-trees. */
+  bool voxelHashSearch;
+
+  /** Add point-to-edge residuals for the corner points. The original edge test
+   * compared the smallest eigenvalue against the middle one and never passed,
+   * so by default mapping optimizes on surface residuals only. */
+  bool edgeResiduals;
 
   LaserMappingParams(const float& scanPeriod_ = 0.1,
                     const int& stackFrameNum_ = 1,
@@ -156,7 +176,13 @@ struct LaserMappingParams {
                     const float& deltaRAbort_ = 0.05,
                     const float& cornerFilterSize_ = 0.2,
                     const float& surfFilterSize_ = 0.4,
-                    const float& mapFilterSize_ = 0.6)
+                    const float& mapFilterSize_ = 0.6,
+                    const int& nThreads_ = 1,
+                    const float& fovMinElevation_ = -90,
+                    const float& fovMaxElevation_ = 90,
+                    const float& fovMaxRange_ = 0,
+                    const bool& voxelHashSearch_ = true,
+                    const bool& edgeResiduals_ = false)
   : scanPeriod(scanPeriod_),
     stackFrameNum(stackFrameNum_),
     mapFrameNum(mapFrameNum_),
@@ -165,7 +191,13 @@ struct LaserMappingParams {
     deltaRAbort(deltaRAbort_),
     cornerFilterSize(cornerFilterSize_),
     surfFilterSize(surfFilterSize_),
-    mapFilterSize(mapFilterSize_)
+    mapFilterSize(mapFilterSize_),
+    nThreads(nThreads_),
+    fovMinElevation(fovMinElevation_),
+    fovMaxElevation(fovMaxElevation_),
+    fovMaxRange(fovMaxRange_),
+    voxelHashSearch(voxelHashSearch_),
+    edgeResiduals(edgeResiduals_)
   { }
 
 };
@@ -0,0 +1,147 @@
+#include "loam_velodyne/RingIndex.h"
+#include "math_utils.h"
+
+#include <cmath>
+
+
+namespace loam {
+
+/** \brief Margin on the azimuth window, covering the error of fastAtan2(). */
+static const float AZIMUTH_SLACK = 1e-4f;
+
+
+
+RingIndex::RingIndex(const size_t& azimuthBuckets)
+    : _azimuthBuckets(azimuthBuckets),
+      _bucketWidth(float(2 * M_PI / azimuthBuckets)),
+      _ringCount(0)
+{}
+
+
+
+size_t RingIndex::bucketOf(const float& azimuth) const
+{
+  size_t bucket = size_t((azimuth + float(M_PI)) / _bucketWidth);
+  return bucket < _azimuthBuckets ? bucket : _azimuthBuckets - 1;
+}
+
+
+
+void RingIndex::setInputCloud(const pcl::PointCloud<pcl::PointXYZI>& cloud)
+{
+  const size_t cloudSize = cloud.points.size();
+
+  _ringCount = 0;
+  for (size_t i = 0; i < cloudSize; i++) {
+    int ring = int(cloud.points[i].intensity);
+    if (ring >= _ringCount) {
+      _ringCount = ring + 1;
+    }
+  }
+
+  // count the points per bucket, skipping points without a ring or azimuth
+  const size_t bucketCount = size_t(_ringCount) * _azimuthBuckets;
+  _bucketStart.assign(bucketCount + 1, 0);
+  _pointBucket.resize(cloudSize);
+  for (size_t i = 0; i < cloudSize; i++) {
+    const pcl::PointXYZI& point = cloud.points[i];
+    int ring = int(point.intensity);
+    if (ring < 0 || !std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z)) {
+      _pointBucket[i] = bucketCount;
+      continue;
+    }
+    size_t bucket = size_t(ring) * _azimuthBuckets + bucketOf(fastAtan2(point.x, point.z));
+    _pointBucket[i] = bucket;
+    _bucketStart[bucket + 1]++;
+  }
+
+  for (size_t b = 0; b < bucketCount; b++) {
+    _bucketStart[b + 1] += _bucketStart[b];
+  }
+
+  // scatter the points in cloud order, so each bucket keeps the cloud order
+  _entries.resize(_bucketStart[bucketCount]);
+  std::vector<size_t>& fill = _pointBucket;
+  for (size_t i = 0; i < cloudSize; i++) {
+    size_t bucket = fill[i];
+    if (bucket == bucketCount) {
+      continue;
+    }
+    const pcl::PointXYZI& point = cloud.points[i];
+    Entry& entry = _entries[_bucketStart[bucket]++];
+    entry.x = point.x;
+    entry.y = point.y;
+    entry.z = point.z;
+    entry.index = int(i);
+  }
+
+  // the scatter advanced each start to the start of the next bucket
+  for (size_t b = bucketCount; b > 0; b--) {
+    _bucketStart[b] = _bucketStart[b - 1];
+  }
+  _bucketStart[0] = 0;
+}
+
+
+
+int RingIndex::nearestInRing(const pcl::PointXYZI& point,
+                             const int& ring,
+                             const int& excludeIdx,
+                             float& maxSqDis) const
+{
+  if (ring < 0 || ring >= _ringCount) {
+    return -1;
+  }
+
+  // a point closer than sqrt(maxSqDis) lies within asin(sqrt(maxSqDis) / rho)
+  // of the query azimuth, with rho the horizontal distance of the query point
+  const float rhoSq = point.x * point.x + point.z * point.z;
+  auto halfWindow = [&](const float& sqDis) {
+    return sqDis < rhoSq ? std::asin(std::sqrt(sqDis / rhoSq)) + AZIMUTH_SLACK : float(M_PI);
+  };
+
+  const size_t ringStart = size_t(ring) * _azimuthBuckets;
+  const size_t centerBucket = bucketOf(fastAtan2(point.x, point.z));
+  int bestIdx = -1;
+  float window = halfWindow(maxSqDis);
+
+  auto searchBucket = [&](const size_t& bucket) {
+    const size_t end = _bucketStart[ringStart + bucket + 1];
+    for (size_t e = _bucketStart[ringStart + bucket]; e < end; e++) {
+      const Entry& entry = _entries[e];
+      float dx = entry.x - point.x;
+      float dy = entry.y - point.y;
+      float dz = entry.z - point.z;
+      float sqDis = dx * dx + dy * dy + dz * dz;
+      if (sqDis < maxSqDis && entry.index != excludeIdx) {
+        maxSqDis = sqDis;
+        bestIdx = entry.index;
+      }
+    }
+  };
+
+  searchBucket(centerBucket);
+  if (bestIdx >= 0) {
+    window = halfWindow(maxSqDis);
+  }
+
+  // the points of the buckets at offset o are at least (o - 1) bucket widths away in azimuth
+  for (size_t offset = 1; 2 * offset <= _azimuthBuckets; offset++) {
+    if (float(offset - 1) * _bucketWidth > window) {
+      break;
+    }
+
+    int previousIdx = bestIdx;
+    searchBucket((centerBucket + offset) % _azimuthBuckets);
+    if (2 * offset != _azimuthBuckets) {
+      searchBucket((centerBucket + _azimuthBuckets - offset) % _azimuthBuckets);
+    }
+    if (bestIdx != previousIdx) {
+      window = halfWindow(maxSqDis);
+    }
+  }
+
+  return bestIdx;
+}
+
+} // end namespace loam
@@ -0,0 +1,66 @@
+#ifndef LOAM_RINGINDEX_H
+#define LOAM_RINGINDEX_H
+
+
+#include <stddef.h>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+
+namespace loam {
+
+/** \brief Index of a feature cloud by scan ring and azimuth, for nearest neighbor queries within one ring.
+ *
+ * The ring of a point is the integer part of its intensity, its azimuth the
+ * angle around the vertical y axis. Each ring is split into azimuth buckets,
+ * stored contiguously. A query visits the buckets around the azimuth of the
+ * query point, outwards, and stops as soon as no point of the remaining
+ * buckets can be closer than the best one found, so the result is exact.
+ */
+class RingIndex {
+public:
+  explicit RingIndex(const size_t& azimuthBuckets = 360);
+
+  /** \brief Index the points of a cloud, replacing the previous cloud. */
+  void setInputCloud(const pcl::PointCloud<pcl::PointXYZI>& cloud);
+
+  /** \brief Find the nearest point of a ring.
+   *
+   * @param point the query point
+   * @param ring the ring to search
+   * @param excludeIdx a cloud index to skip, e.g. the query point's own nearest neighbor, or -1
+   * @param maxSqDis only points with a squared distance below this value are considered;
+   * set to the squared distance of the point found
+   * @return the cloud index of the nearest point, -1 if there is none below maxSqDis
+   */
+  int nearestInRing(const pcl::PointXYZI& point,
+                    const int& ring,
+                    const int& excludeIdx,
+                    float& maxSqDis) const;
+
+  /** \brief The number of rings, i.e. the highest ring of the cloud plus one. */
+  int ringCount() const { return _ringCount; }
+
+private:
+  /** \brief A point in bucket order. */
+  struct Entry {
+    float x, y, z;
+    int index;
+  };
+
+  size_t bucketOf(const float& azimuth) const;
+
+  size_t _azimuthBuckets;             ///< number of buckets per ring
+  float _bucketWidth;                 ///< azimuth range of a bucket in radians
+  int _ringCount;
+
+  std::vector<size_t> _bucketStart;   ///< first entry of bucket ring * _azimuthBuckets + bucket, plus the end
+  std::vector<Entry> _entries;        ///< the points, sorted by ring and bucket
+  std::vector<size_t> _pointBucket;   ///< bucket per cloud point, scratch for building
+};
+
+} // end namespace loam
+
+#endif //LOAM_RINGINDEX_H
@@ -32,8 +32,9 @@
 
 #include "loam_velodyne/ScanRegistration.h"
 #include "math_utils.h"
+#include "loam_velodyne/Curvature.h"
 
-#include <pcl/filters/voxel_grid.h>
+#include <algorithm>
 
 
 namespace loam {
@@ -52,10 +53,7 @@ ScanRegistration::ScanRegistration(const ScanRegistrationParams& params)
         _surfacePointsFlat(),
         _surfacePointsLessFlat(),
         _imuTrans(4, 1),
-        _regionCurvature(),
-        _regionLabel(),
-        _regionSortIndices(),
-        _scanNeighborPicked()
+        _threadPool(new ThreadPool(params.nThreads))
 {
   _imuHistory.ensureCapacity(params.imuHistorySize);
 }
@@ -156,146 +154,192 @@ void ScanRegistration::interpolateIMUStateFor(const Time &relTime,
 
 void ScanRegistration::extractFeatures(const uint16_t& beginIdx)
 {
-  // extract features from individual scans
   size_t nScans = _scanIndices.size();
-  for (size_t i = beginIdx; i < nScans; i++) {
-    pcl::PointCloud<pcl::PointXYZI>::Ptr surfPointsLessFlatScan(new pcl::PointCloud<pcl::PointXYZI>);
-    size_t scanStartIdx = _scanIndices[i].first;
-    size_t scanEndIdx = _scanIndices[i].second;
+  if (beginIdx >= nScans) {
+    return;
+  }
 
-    // skip empty scans
-    if (scanEndIdx <= scanStartIdx + 2 * _params.curvatureRegion) {
-      continue;
-    }
+  // extract features from individual scans in parallel, each worker with its own buffers
+  _workerBuffers.resize(_threadPool->size());
+  _scanFeatures.resize(nScans - beginIdx);
+  _threadPool->parallelFor(nScans - beginIdx, [&](size_t i, size_t worker) {
+    extractScanFeatures(beginIdx + i, _workerBuffers[worker], _scanFeatures[i]);
+  });
+
+  // merge in scan order, resulting in the same clouds as a serial pass
+  for (const ScanFeatures& features : _scanFeatures) {
+    _cornerPointsSharp += features.cornerPointsSharp;
+    _cornerPointsLessSharp += features.cornerPointsLessSharp;
+    _surfacePointsFlat += features.surfacePointsFlat;
+    _surfacePointsLessFlat += features.surfacePointsLessFlat;
+  }
+}
 
-    // reset scan buffers
-    setScanBuffersFor(scanStartIdx, scanEndIdx);
 
-    // extract features from equally sized scan regions
-    for (int j = 0; j < _params.nFeatureRegions; j++) {
-      size_t sp = ((scanStartIdx + _params.curvatureRegion) * (_params.nFeatureRegions - j)
-                   + (scanEndIdx - _params.curvatureRegion) * j) / _params.nFeatureRegions;
-      size_t ep = ((scanStartIdx + _params.curvatureRegion) * (_params.nFeatureRegions - 1 - j)
-                   + (scanEndIdx - _params.curvatureRegion) * (j + 1)) / _params.nFeatureRegions - 1;
 
-      // skip empty regions
-      if (ep <= sp) {
-        continue;
-      }
+void ScanRegistration::extractScanFeatures(const size_t& scanID,
+                                           ScanFeatureBuffers& buffers,
+                                           ScanFeatures& features)
+{
+  features.cornerPointsSharp.clear();
+  features.cornerPointsLessSharp.clear();
+  features.surfacePointsFlat.clear();
+  features.surfacePointsLessFlat.clear();
+
+  pcl::PointCloud<pcl::PointXYZI>& surfPointsLessFlatScan = buffers.surfPointsLessFlatScan;
+  surfPointsLessFlatScan.clear();
+  size_t scanStartIdx = _scanIndices[scanID].first;
+  size_t scanEndIdx = _scanIndices[scanID].second;
+
+  // skip empty scans
+  if (scanEndIdx <= scanStartIdx + 2 * _params.curvatureRegion) {
+    return;
+  }
 
-      size_t regionSize = ep - sp + 1;
+  // reset scan buffers
+  setScanBuffersFor(scanStartIdx, scanEndIdx, buffers);
 
-      // reset region buffers
-      setRegionBuffersFor(sp, ep);
+  std::vector<float>& regionCurvature = buffers.regionCurvature;
+  std::vector<PointLabel>& regionLabel = buffers.regionLabel;
+  std::vector<size_t>& regionSortIndices = buffers.regionSortIndices;
+  std::vector<int>& scanNeighborPicked = buffers.scanNeighborPicked;
 
+  // extract features from equally sized scan regions
+  for (int j = 0; j < _params.nFeatureRegions; j++) {
+    size_t sp = ((scanStartIdx + _params.curvatureRegion) * (_params.nFeatureRegions - j)
+                 + (scanEndIdx - _params.curvatureRegion) * j) / _params.nFeatureRegions;
+    size_t ep = ((scanStartIdx + _params.curvatureRegion) * (_params.nFeatureRegions - 1 - j)
+                 + (scanEndIdx - _params.curvatureRegion) * (j + 1)) / _params.nFeatureRegions - 1;
 
-      // extract corner features
-      int largestPickedNum = 0;
-      for (size_t k = regionSize; k > 0 && largestPickedNum < _params.maxCornerLessSharp;) {
-        size_t idx = _regionSortIndices[--k];
-        size_t scanIdx = idx - scanStartIdx;
-        size_t regionIdx = idx - sp;
+    // skip empty regions
+    if (ep <= sp) {
+      continue;
+    }
 
-        if (_scanNeighborPicked[scanIdx] == 0 &&
-            _regionCurvature[regionIdx] > _params.surfaceCurvatureThreshold) {
+    size_t regionSize = ep - sp + 1;
+
+    // reset region buffers
+    setRegionBuffersFor(sp, ep, scanStartIdx, buffers);
+
+    // points are visited by curvature, ties by index, as a stable sort would
+    // order them. Only the few points needed are popped from a heap instead
+    // of sorting the whole region.
+    auto curvatureLess = [&](size_t a, size_t b) {
+      float ca = regionCurvature[a - sp], cb = regionCurvature[b - sp];
+      return ca < cb || (ca == cb && a < b);
+    };
+    auto curvatureGreater = [&](size_t a, size_t b) { return curvatureLess(b, a); };
+
+    // extract corner features
+    int largestPickedNum = 0;
+    std::make_heap(regionSortIndices.begin(), regionSortIndices.end(), curvatureLess);
+    for (size_t k = regionSize; k > 0 && largestPickedNum < _params.maxCornerLessSharp;) {
+      std::pop_heap(regionSortIndices.begin(), regionSortIndices.begin() + k, curvatureLess);
+      size_t idx = regionSortIndices[--k];
+      size_t scanIdx = idx - scanStartIdx;
+      size_t regionIdx = idx - sp;
+
+      // all remaining points are flatter
+      if (regionCurvature[regionIdx] <= _params.surfaceCurvatureThreshold) {
+        break;
+      }
 
-          largestPickedNum++;
-          if (largestPickedNum <= _params.maxCornerSharp) {
-            _regionLabel[regionIdx] = CORNER_SHARP;
-            _cornerPointsSharp.push_back(_laserCloud[idx]);
-          } else {
-            _regionLabel[regionIdx] = CORNER_LESS_SHARP;
-          }
-          _cornerPointsLessSharp.push_back(_laserCloud[idx]);
+      if (scanNeighborPicked[scanIdx] == 0) {
 
-          markAsPicked(idx, scanIdx);
+        largestPickedNum++;
+        if (largestPickedNum <= _params.maxCornerSharp) {
+          regionLabel[regionIdx] = CORNER_SHARP;
+          features.cornerPointsSharp.push_back(_laserCloud[idx]);
+        } else {
+          regionLabel[regionIdx] = CORNER_LESS_SHARP;
         }
+        features.cornerPointsLessSharp.push_back(_laserCloud[idx]);
+
+        markAsPicked(idx, scanIdx, buffers);
       }
+    }
 
-      // extract flat surface features
-      size_t smallestPickedNum = 0;
-      for (size_t k = 0; k < regionSize && smallestPickedNum < (size_t)_params.maxSurfaceFlat; k++) {
-        size_t idx = _regionSortIndices[k];
-        size_t scanIdx = idx - scanStartIdx;
-        size_t regionIdx = idx - sp;
+    // extract flat surface features
+    size_t smallestPickedNum = 0;
+    std::make_heap(regionSortIndices.begin(), regionSortIndices.end(), curvatureGreater);
+    for (size_t k = regionSize; k > 0 && smallestPickedNum < (size_t)_params.maxSurfaceFlat;) {
+      std::pop_heap(regionSortIndices.begin(), regionSortIndices.begin() + k, curvatureGreater);
+      size_t idx = regionSortIndices[--k];
+      size_t scanIdx = idx - scanStartIdx;
+      size_t regionIdx = idx - sp;
+
+      // all remaining points are sharper
+      if (regionCurvature[regionIdx] >= _params.surfaceCurvatureThreshold) {
+        break;
+      }
 
-        if (_scanNeighborPicked[scanIdx] == 0 &&
-            _regionCurvature[regionIdx] < _params.surfaceCurvatureThreshold) {
+      if (scanNeighborPicked[scanIdx] == 0) {
 
-          smallestPickedNum++;
-          _regionLabel[regionIdx] = SURFACE_FLAT;
-          _surfacePointsFlat.push_back(_laserCloud[idx]);
+        smallestPickedNum++;
+        regionLabel[regionIdx] = SURFACE_FLAT;
+        features.surfacePointsFlat.push_back(_laserCloud[idx]);
 
-          markAsPicked(idx, scanIdx);
-        }
+        markAsPicked(idx, scanIdx, buffers);
       }
+    }
 
-      // extract less flat surface features
-      for (size_t k = 0; k < regionSize; k++) {
-        if (_regionLabel[k] <= SURFACE_LESS_FLAT) {
-          surfPointsLessFlatScan->push_back(_laserCloud[sp + k]);
-        }
+    // extract less flat surface features
+    for (size_t k = 0; k < regionSize; k++) {
+      if (regionLabel[k] <= SURFACE_LESS_FLAT) {
+        surfPointsLessFlatScan.push_back(_laserCloud[sp + k]);
       }
     }
-
-    // down size less flat surface point cloud of current scan
-    pcl::PointCloud<pcl::PointXYZI> surfPointsLessFlatScanDS;
-    pcl::VoxelGrid<pcl::PointXYZI> downSizeFilter;
-    downSizeFilter.setInputCloud(surfPointsLessFlatScan);
-    downSizeFilter.setLeafSize(_params.lessFlatFilterSize, _params.lessFlatFilterSize, _params.lessFlatFilterSize);
-    downSizeFilter.filter(surfPointsLessFlatScanDS);
-
-    _surfacePointsLessFlat += surfPointsLessFlatScanDS;
   }
+
+  // down size less flat surface point cloud of current scan
+  buffers.lessFlatFilter.setLeafSize(_params.lessFlatFilterSize);
+  buffers.lessFlatFilter.filter(surfPointsLessFlatScan, features.surfacePointsLessFlat);
 }
 
 
 
 void ScanRegistration::setRegionBuffersFor(const size_t& startIdx,
-                                           const size_t& endIdx)
+                                           const size_t& endIdx,
+                                           const size_t& scanStartIdx,
+                                           ScanFeatureBuffers& buffers)
 {
   // resize buffers
   size_t regionSize = endIdx - startIdx + 1;
-  _regionCurvature.resize(regionSize);
-  _regionSortIndices.resize(regionSize);
-  _regionLabel.assign(regionSize, SURFACE_LESS_FLAT);
-
-  // calculate point curvatures and reset sort indices
-  float pointWeight = -2 * _params.curvatureRegion;
+  buffers.regionCurvature.resize(regionSize);
+  buffers.regionSortIndices.resize(regionSize);
+  buffers.regionLabel.assign(regionSize, SURFACE_LESS_FLAT);
 
+  // take point curvatures from the scan and reset sort indices
   for (size_t i = startIdx, regionIdx = 0; i <= endIdx; i++, regionIdx++) {
-    float diffX = pointWeight * _laserCloud[i].x;
-    float diffY = pointWeight * _laserCloud[i].y;
-    float diffZ = pointWeight * _laserCloud[i].z;
-
-    for (int j = 1; j <= _params.curvatureRegion; j++) {
-      diffX += _laserCloud[i + j].x + _laserCloud[i - j].x;
-      diffY += _laserCloud[i + j].y + _laserCloud[i - j].y;
-      diffZ += _laserCloud[i + j].z + _laserCloud[i - j].z;
-    }
-
-    _regionCurvature[regionIdx] = diffX * diffX + diffY * diffY + diffZ * diffZ;
-    _regionSortIndices[regionIdx] = i;
-  }
-
-  // sort point curvatures
-  for (size_t i = 1; i < regionSize; i++) {
-    for (size_t j = i; j >= 1; j--) {
-      if (_regionCurvature[_regionSortIndices[j] - startIdx] < _regionCurvature[_regionSortIndices[j - 1] - startIdx]) {
-        std::swap(_regionSortIndices[j], _regionSortIndices[j - 1]);
-      }
-    }
+    buffers.regionCurvature[regionIdx] = buffers.scanCurvature[i - scanStartIdx];
+    buffers.regionSortIndices[regionIdx] = i;
   }
 }
 
 
 
 void ScanRegistration::setScanBuffersFor(const size_t& startIdx,
-                                         const size_t& endIdx)
+                                         const size_t& endIdx,
+                                         ScanFeatureBuffers& buffers)
 {
+  std::vector<int>& scanNeighborPicked = buffers.scanNeighborPicked;
+
   // resize buffers
   size_t scanSize = endIdx - startIdx + 1;
-  _scanNeighborPicked.assign(scanSize, 0);
+  scanNeighborPicked.assign(scanSize, 0);
+
+  // calculate the curvatures of the whole scan at once on an SoA copy
+  buffers.scanX.resize(scanSize);
+  buffers.scanY.resize(scanSize);
+  buffers.scanZ.resize(scanSize);
+  buffers.scanCurvature.resize(scanSize);
+  for (size_t i = 0; i < scanSize; i++) {
+    const pcl::PointXYZI& point = _laserCloud[startIdx + i];
+    buffers.scanX[i] = point.x;
+    buffers.scanY[i] = point.y;
+    buffers.scanZ[i] = point.z;
+  }
+  computeCurvature(buffers.scanX.data(), buffers.scanY.data(), buffers.scanZ.data(), scanSize, _params.curvatureRegion, buffers.scanCurvature.data());
 
   // mark unreliable points as picked
   for (size_t i = startIdx + _params.curvatureRegion; i < endIdx - _params.curvatureRegion; i++) {
@@ -313,7 +357,7 @@ void ScanRegistration::setScanBuffersFor(const size_t& startIdx,
         float weighted_distance = std::sqrt(calcSquaredDiff(nextPoint, point, depth2 / depth1)) / depth2;
 
         if (weighted_distance < 0.1) {
-          std::fill_n(&_scanNeighborPicked[i - startIdx - _params.curvatureRegion], _params.curvatureRegion + 1, 1);
+          std::fill_n(&scanNeighborPicked[i - startIdx - _params.curvatureRegion], _params.curvatureRegion + 1, 1);
 
           continue;
         }
@@ -321,7 +365,7 @@ void ScanRegistration::setScanBuffersFor(const size_t& startIdx,
         float weighted_distance = std::sqrt(calcSquaredDiff(point, nextPoint, depth1 / depth2)) / depth1;
 
         if (weighted_distance < 0.1) {
-          std::fill_n(&_scanNeighborPicked[i - startIdx + 1], _params.curvatureRegion + 1, 1);
+          std::fill_n(&scanNeighborPicked[i - startIdx + 1], _params.curvatureRegion + 1, 1);
         }
       }
     }
@@ -330,7 +374,7 @@ void ScanRegistration::setScanBuffersFor(const size_t& startIdx,
     float dis = calcSquaredPointDistance(point);
 
     if (diffNext > 0.0002 * dis && diffPrevious > 0.0002 * dis) {
-      _scanNeighborPicked[i - startIdx] = 1;
+      scanNeighborPicked[i - startIdx] = 1;
     }
   }
 }
@@ -338,16 +382,19 @@ void ScanRegistration::setScanBuffersFor(const size_t& startIdx,
 
 
 void ScanRegistration::markAsPicked(const size_t& cloudIdx,
-                                    const size_t& scanIdx)
+                                    const size_t& scanIdx,
+                                    ScanFeatureBuffers& buffers)
 {
-  _scanNeighborPicked[scanIdx] = 1;
+  std::vector<int>& scanNeighborPicked = buffers.scanNeighborPicked;
+
+  scanNeighborPicked[scanIdx] = 1;
 
   for (int i = 1; i <= _params.curvatureRegion; i++) {
     if (calcSquaredDiff(_laserCloud[cloudIdx + i], _laserCloud[cloudIdx + i - 1]) > 0.05) {
       break;
     }
 
-    _scanNeighborPicked[scanIdx + i] = 1;
+    scanNeighborPicked[scanIdx + i] = 1;
   }
 
   for (int i = 1; i <= _params.curvatureRegion; i++) {
@@ -355,7 +402,7 @@ void ScanRegistration::markAsPicked(const size_t& cloudIdx,
       break;
     }
 
-    _scanNeighborPicked[scanIdx - i] = 1;
+    scanNeighborPicked[scanIdx - i] = 1;
   }
 }
 
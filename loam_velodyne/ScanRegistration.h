@@ -40,6 +40,8 @@
 #include "CircularBuffer.h"
 #include "IMUState.h"
 #include "Parameters.h"
+#include "ThreadPool.h"
+#include "VoxelFilter.h"
 
 #include <stdint.h>
 #include <vector>
@@ -63,6 +65,32 @@ enum PointLabel {
 
 
 
+/** \brief Working buffers for extracting the features of a single scan. */
+struct ScanFeatureBuffers {
+  std::vector<float> regionCurvature;      ///< point curvature buffer
+  std::vector<PointLabel> regionLabel;     ///< point label buffer
+  std::vector<size_t> regionSortIndices;   ///< region indices, selected by point curvature
+  std::vector<int> scanNeighborPicked;     ///< flag if neighboring point was already picked
+  std::vector<float> scanX;                ///< x coordinates of the current scan
+  std::vector<float> scanY;                ///< y coordinates of the current scan
+  std::vector<float> scanZ;                ///< z coordinates of the current scan
+  std::vector<float> scanCurvature;        ///< point curvatures of the current scan
+  pcl::PointCloud<pcl::PointXYZI> surfPointsLessFlatScan;  ///< less flat surface points of the current scan
+  VoxelFilter lessFlatFilter;              ///< voxel filter for down sizing the less flat surface points
+};
+
+
+
+/** \brief Features extracted from a single scan. */
+struct ScanFeatures {
+  pcl::PointCloud<pcl::PointXYZI> cornerPointsSharp;      ///< sharp corner points
+  pcl::PointCloud<pcl::PointXYZI> cornerPointsLessSharp;  ///< less sharp corner points
+  pcl::PointCloud<pcl::PointXYZI> surfacePointsFlat;      ///< flat surface points
+  pcl::PointCloud<pcl::PointXYZI> surfacePointsLessFlat;  ///< down sized less flat surface points
+};
+
+
+
 /** \brief Base class for LOAM scan registration implementations.
  *
  * As there exist various sensor devices, producing differently formatted point clouds,
@@ -142,26 +170,49 @@ protected:
   void transformToStartIMU(pcl::PointXYZI& point);
 
   /** \brief Extract features from current laser cloud.
+   *
+   * The scans are processed in parallel and their features appended in scan order.
    *
    * @param beginIdx the index of the first scan to extract features from
    */
   void extractFeatures(const uint16_t& beginIdx = 0);
 
+  /** \brief Extract the features of a single scan.
+   *
+   * @param scanID the index of the scan
+   * @param buffers the working buffers of the calling worker
+   * @param features the output features
+   */
+  void extractScanFeatures(const size_t& scanID,
+                           ScanFeatureBuffers& buffers,
+                           ScanFeatures& features);
+
   /** \brief Set up region buffers for the specified point range.
+   *
+   * Takes the point curvatures from the scan buffers. The region indices are
+   * left unsorted, extractFeatures() selects from them by curvature.
    *
    * @param startIdx the region start index
    * @param endIdx the region end index
+   * @param scanStartIdx the start index of the scan containing the region
+   * @param buffers the working buffers to set up
    */
   void setRegionBuffersFor(const size_t& startIdx,
-                           const size_t& endIdx);
+                           const size_t& endIdx,
+                           const size_t& scanStartIdx,
+                           ScanFeatureBuffers& buffers);
 
   /** \brief Set up scan buffers for the specified point range.
+   *
+   * Computes the curvatures of all points of the scan.
    *
    * @param startIdx the scan start index
    * @param endIdx the scan start index
+   * @param buffers the working buffers to set up
    */
   void setScanBuffersFor(const size_t& startIdx,
-                         const size_t& endIdx);
+                         const size_t& endIdx,
+                         ScanFeatureBuffers& buffers);
 
   /** \brief Mark a point and its neighbors as picked.
    *
@@ -170,9 +221,11 @@ protected:
    *
    * @param cloudIdx the index of the picked point in the full resolution cloud
    * @param scanIdx the index of the picked point relative to the current scan
+   * @param buffers the working buffers of the current scan
    */
   void markAsPicked(const size_t& cloudIdx,
-                    const size_t& scanIdx);
+                    const size_t& scanIdx,
+                    ScanFeatureBuffers& buffers);
 
 
 private:
@@ -205,10 +258,9 @@ protected:
   pcl::PointCloud<pcl::PointXYZI> _surfacePointsLessFlat;  ///< less flat surface points cloud
   pcl::PointCloud<pcl::PointXYZ> _imuTrans;                ///< IMU transformation information
 
-  std::vector<float> _regionCurvature;      ///< point curvature buffer
-  std::vector<PointLabel> _regionLabel;     ///< point label buffer
-  std::vector<size_t> _regionSortIndices;   ///< sorted region indices based on point curvature
-  std::vector<int> _scanNeighborPicked;     ///< flag if neighboring point was already picked
+  std::vector<ScanFeatureBuffers> _workerBuffers;  ///< working buffers per thread pool worker
+  std::vector<ScanFeatures> _scanFeatures;         ///< features per scan, merged after extraction
+  ThreadPool::Ptr _threadPool;                     ///< workers for the per-scan feature extraction
 
 };
 
@@ -0,0 +1,102 @@
+#ifndef LOAM_SYMMETRICEIGEN3_H
+#define LOAM_SYMMETRICEIGEN3_H
+
+
+#include <algorithm>
+#include <cmath>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+
+namespace loam {
+
+/** \brief Largest two eigenvalues and the dominant eigenvector of a symmetric 3x3 matrix.
+ *
+ * The eigenvalues are taken from the trigonometric solution of the
+ * characteristic polynomial, the eigenvector from the largest cross product of
+ * two rows of m - lambdaMax * I. Everything is evaluated in double precision on
+ * the stack. Only the upper triangle of m is read.
+ *
+ * This takes about 120 ns, half the time of the iterative SelfAdjointEigenSolver
+ * and as fast as its computeDirect() on the float matrix. computeDirect() is not
+ * used because in float it loses accuracy on the flat, elongated covariances of
+ * edge neighbors: eigenvalue errors up to 2e-4 of the largest eigenvalue, against
+ * 6e-8 here (see test_symmetric_eigen3 and bench_symmetric_eigen3).
+ *
+ * Degenerate input is handled: a zero matrix yields zero eigenvalues, and if
+ * lambdaMax is repeated, direction is some unit vector of its eigenspace.
+ *
+ * @param m the symmetric matrix
+ * @param lambdaMax the largest eigenvalue
+ * @param lambdaMid the middle eigenvalue
+ * @param direction the unit eigenvector of lambdaMax
+ */
+inline void dominantEigen3(const Eigen::Matrix3f& m,
+                           float& lambdaMax,
+                           float& lambdaMid,
+                           Eigen::Vector3f& direction)
+{
+  double a00 = m(0, 0), a01 = m(0, 1), a02 = m(0, 2);
+  double a11 = m(1, 1), a12 = m(1, 2), a22 = m(2, 2);
+
+  // scale to [-1, 1] against over- and underflow
+  double scale = std::max(std::max(std::max(std::fabs(a00), std::fabs(a01)), std::max(std::fabs(a02), std::fabs(a11))),
+                          std::max(std::fabs(a12), std::fabs(a22)));
+  if (scale == 0) {
+    lambdaMax = lambdaMid = 0;
+    direction = Eigen::Vector3f::UnitX();
+    return;
+  }
+  a00 /= scale; a01 /= scale; a02 /= scale;
+  a11 /= scale; a12 /= scale; a22 /= scale;
+
+  // eigenvalues of the deviatoric part b = a - q * I
+  double q = (a00 + a11 + a22) / 3;
+  double b00 = a00 - q, b11 = a11 - q, b22 = a22 - q;
+  double p2 = (b00 * b00 + b11 * b11 + b22 * b22 + 2 * (a01 * a01 + a02 * a02 + a12 * a12)) / 6;
+  if (p2 <= 0) {
+    // multiple of the identity
+    lambdaMax = lambdaMid = float(q * scale);
+    direction = Eigen::Vector3f::UnitX();
+    return;
+  }
+
+  double p = std::sqrt(p2);
+  double det = b00 * (b11 * b22 - a12 * a12) - a01 * (a01 * b22 - a12 * a02) + a02 * (a01 * a12 - b11 * a02);
+  double r = std::min(1.0, std::max(-1.0, det / (2 * p2 * p)));
+  double phi = std::acos(r) / 3;
+
+  double l1 = q + 2 * p * std::cos(phi);
+  double l3 = q + 2 * p * std::cos(phi + 2 * M_PI / 3);
+  double l2 = 3 * q - l1 - l3;
+
+  lambdaMax = float(l1 * scale);
+  lambdaMid = float(l2 * scale);
+
+  // the eigenvector is orthogonal to all rows of a - l1 * I
+  Eigen::Vector3d r0(a00 - l1, a01, a02);
+  Eigen::Vector3d r1(a01, a11 - l1, a12);
+  Eigen::Vector3d r2(a02, a12, a22 - l1);
+  Eigen::Vector3d c[3] = { r0.cross(r1), r0.cross(r2), r1.cross(r2) };
+  double n[3] = { c[0].squaredNorm(), c[1].squaredNorm(), c[2].squaredNorm() };
+  int best = n[0] >= n[1] ? (n[0] >= n[2] ? 0 : 2) : (n[1] >= n[2] ? 1 : 2);
+
+  if (n[best] > 1e-20) {
+    direction = (c[best] / std::sqrt(n[best])).cast<float>();
+    return;
+  }
+
+  // l1 is repeated, the rows span at most a line: any orthogonal vector will do
+  double rn[3] = { r0.squaredNorm(), r1.squaredNorm(), r2.squaredNorm() };
+  const Eigen::Vector3d& row = rn[0] >= rn[1] ? (rn[0] >= rn[2] ? r0 : r2) : (rn[1] >= rn[2] ? r1 : r2);
+  if (row.squaredNorm() > 0) {
+    direction = row.unitOrthogonal().cast<float>();
+  } else {
+    direction = Eigen::Vector3f::UnitX();
+  }
+}
+
+} // end namespace loam
+
+#endif //LOAM_SYMMETRICEIGEN3_H
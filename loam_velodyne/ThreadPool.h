@@ -0,0 +1,137 @@
+#ifndef LOAM_THREADPOOL_H
+#define LOAM_THREADPOOL_H
+
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+
+namespace loam {
+
+/** \brief Fixed set of worker threads for data parallel loops.
+ *
+ * The thread calling parallelFor() takes part in the work as worker 0, so a
+ * pool of size n starts n - 1 threads and a pool of size 1 runs everything
+ * inline. Calls from different threads are serialized; nested calls are not
+ * supported.
+ */
+class ThreadPool {
+public:
+  typedef boost::shared_ptr<ThreadPool> Ptr;
+
+  explicit ThreadPool(const size_t& nThreads = 1)
+      : _job(NULL),
+        _next(0),
+        _active(0),
+        _generation(0),
+        _stop(false)
+  {
+    for (size_t i = 1; i < nThreads; i++) {
+      _workers.push_back(std::thread(&ThreadPool::run, this, i));
+    }
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _start.notify_all();
+    for (std::thread& worker : _workers) {
+      worker.join();
+    }
+  }
+
+  /** \brief The number of workers, including the calling thread. */
+  size_t size() const { return _workers.size() + 1; }
+
+  /** \brief Call fn(i, worker) for every i in [0, n) and wait until all calls returned.
+   *
+   * Indices are handed out one at a time, in increasing order, to whichever
+   * worker is free. The worker index lies in [0, size()) and can be used to
+   * address per-worker scratch buffers.
+   */
+  template <typename Function>
+  void parallelFor(const size_t& n, const Function& fn)
+  {
+    if (_workers.empty() || n <= 1) {
+      for (size_t i = 0; i < n; i++) {
+        fn(i, size_t(0));
+      }
+      return;
+    }
+
+    std::lock_guard<std::mutex> call(_callMutex);
+    std::function<void(size_t)> job = [&](size_t worker) {
+      for (size_t i = _next++; i < n; i = _next++) {
+        fn(i, worker);
+      }
+    };
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _job = &job;
+      _next = 0;
+      _active = _workers.size();
+      _generation++;
+    }
+    _start.notify_all();
+
+    job(0);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _active == 0; });
+    _job = NULL;
+  }
+
+private:
+  ThreadPool(const ThreadPool&);
+  ThreadPool& operator=(const ThreadPool&);
+
+  void run(size_t worker)
+  {
+    size_t generation = 0;
+    for (;;) {
+      std::function<void(size_t)>* job;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _start.wait(lock, [&] { return _stop || _generation != generation; });
+        if (_stop) {
+          return;
+        }
+        generation = _generation;
+        job = _job;
+      }
+
+      (*job)(worker);
+
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (--_active == 0) {
+        _done.notify_one();
+      }
+    }
+  }
+
+  std::vector<std::thread> _workers;
+  std::mutex _callMutex;                ///< serializes parallelFor() calls
+  std::mutex _mutex;
+  std::condition_variable _start;
+  std::condition_variable _done;
+  std::function<void(size_t)>* _job;    ///< the loop of the running parallelFor() call
+  std::atomic<size_t> _next;            ///< the next index to hand out
+  size_t _active;                       ///< workers still running the current job
+  size_t _generation;                   ///< incremented for every job
+  bool _stop;
+};
+
+} // end namespace loam
+
+#endif //LOAM_THREADPOOL_H
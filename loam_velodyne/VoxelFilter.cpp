@@ -0,0 +1,164 @@
+#include "loam_velodyne/VoxelFilter.h"
+#include "math_utils.h"
+
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LOAM_VOXELFILTER_AVX2
+#include <immintrin.h>
+#endif
+
+
+namespace loam {
+
+/** \brief Voxel coordinate of a point coordinate, INT32_MIN if it is not representable (as cvttps2dq does). */
+static inline int32_t toVoxelKey(const float& v, const float& inverseLeafSize)
+{
+  float key = std::floor(v * inverseLeafSize);
+  if (key >= -2147483648.0f && key < 2147483648.0f) {
+    return int32_t(key);
+  }
+  return INT32_MIN;
+}
+
+/** \brief Voxel coordinates of the points [beginIdx, endIdx). */
+static void computeKeys(const pcl::PointXYZI* points,
+                        const size_t& beginIdx, const size_t& endIdx,
+                        const float& inverseLeafSize,
+                        int32_t* keyI, int32_t* keyJ, int32_t* keyK)
+{
+  for (size_t i = beginIdx; i < endIdx; i++) {
+    keyI[i] = toVoxelKey(points[i].x, inverseLeafSize);
+    keyJ[i] = toVoxelKey(points[i].y, inverseLeafSize);
+    keyK[i] = toVoxelKey(points[i].z, inverseLeafSize);
+  }
+}
+
+
+
+#ifdef LOAM_VOXELFILTER_AVX2
+
+/** \brief AVX2 version of computeKeys(), gathering the coordinates of eight points at a time. */
+__attribute__((target("avx2")))
+static void computeKeysAVX2(const pcl::PointXYZI* points,
+                            const size_t& beginIdx, const size_t& endIdx,
+                            const float& inverseLeafSize,
+                            int32_t* keyI, int32_t* keyJ, int32_t* keyK)
+{
+  const int stride = sizeof(pcl::PointXYZI) / sizeof(float);
+  const __m256i offsets = _mm256_setr_epi32(0, stride, 2 * stride, 3 * stride,
+                                            4 * stride, 5 * stride, 6 * stride, 7 * stride);
+  const __m256 scale = _mm256_set1_ps(inverseLeafSize);
+
+  size_t i = beginIdx;
+  for (; i + 8 <= endIdx; i += 8) {
+    const float* base = &points[i].x;
+    __m256 x = _mm256_i32gather_ps(base, offsets, 4);
+    __m256 y = _mm256_i32gather_ps(base + 1, offsets, 4);
+    __m256 z = _mm256_i32gather_ps(base + 2, offsets, 4);
+
+    _mm256_storeu_si256((__m256i*)(keyI + i), _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_mul_ps(x, scale))));
+    _mm256_storeu_si256((__m256i*)(keyJ + i), _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_mul_ps(y, scale))));
+    _mm256_storeu_si256((__m256i*)(keyK + i), _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_mul_ps(z, scale))));
+  }
+
+  computeKeys(points, i, endIdx, inverseLeafSize, keyI, keyJ, keyK);
+}
+
+#endif
+
+
+
+VoxelFilter::VoxelFilter(const float& leafSize)
+{
+  setLeafSize(leafSize);
+}
+
+
+
+void VoxelFilter::setLeafSize(const float& leafSize)
+{
+  _leafSize = leafSize;
+  _inverseLeafSize = 1.0f / leafSize;
+}
+
+
+
+void VoxelFilter::filter(const pcl::PointCloud<pcl::PointXYZI>& cloudIn,
+                         pcl::PointCloud<pcl::PointXYZI>& cloudOut)
+{
+  const size_t cloudSize = cloudIn.points.size();
+  const pcl::PointXYZI* points = cloudIn.points.data();
+
+  // voxel coordinates of all points
+  _keyI.resize(cloudSize);
+  _keyJ.resize(cloudSize);
+  _keyK.resize(cloudSize);
+#ifdef LOAM_VOXELFILTER_AVX2
+  static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+  if (hasAVX2) {
+    computeKeysAVX2(points, 0, cloudSize, _inverseLeafSize, _keyI.data(), _keyJ.data(), _keyK.data());
+  } else
+#endif
+  {
+    computeKeys(points, 0, cloudSize, _inverseLeafSize, _keyI.data(), _keyJ.data(), _keyK.data());
+  }
+
+  // table of at least twice the number of points, so probe sequences stay short
+  size_t tableSize = 16;
+  while (tableSize < 2 * cloudSize) {
+    tableSize *= 2;
+  }
+  const uint32_t mask = uint32_t(tableSize - 1);
+  _table.assign(tableSize, 0);
+  _voxels.clear();
+
+  // sum up the points per voxel
+  for (size_t idx = 0; idx < cloudSize; idx++) {
+    const pcl::PointXYZI& point = points[idx];
+    if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z)) {
+      continue;
+    }
+
+    const int32_t i = _keyI[idx];
+    const int32_t j = _keyJ[idx];
+    const int32_t k = _keyK[idx];
+
+    for (uint32_t slot = hashVoxelKey(i, j, k) & mask; ; slot = (slot + 1) & mask) {
+      if (_table[slot] == 0) {
+        Voxel voxel = { i, j, k, 1, point.x, point.y, point.z, point.intensity };
+        _voxels.push_back(voxel);
+        _table[slot] = uint32_t(_voxels.size());
+        break;
+      }
+
+      Voxel& voxel = _voxels[_table[slot] - 1];
+      if (voxel.i == i && voxel.j == j && voxel.k == k) {
+        voxel.count++;
+        voxel.x += point.x;
+        voxel.y += point.y;
+        voxel.z += point.z;
+        voxel.intensity += point.intensity;
+        break;
+      }
+    }
+  }
+
+  // one centroid per voxel
+  cloudOut.header = cloudIn.header;
+  cloudOut.resize(_voxels.size());
+  for (size_t v = 0; v < _voxels.size(); v++) {
+    const Voxel& voxel = _voxels[v];
+    const float count = float(voxel.count);
+    pcl::PointXYZI& point = cloudOut.points[v];
+    point.x = voxel.x / count;
+    point.y = voxel.y / count;
+    point.z = voxel.z / count;
+    point.intensity = voxel.intensity / count;
+  }
+  cloudOut.width = uint32_t(_voxels.size());
+  cloudOut.height = 1;
+  cloudOut.is_dense = true;
+}
+
+} // end namespace loam
@@ -0,0 +1,63 @@
+#ifndef LOAM_VOXELFILTER_H
+#define LOAM_VOXELFILTER_H
+
+
+#include <stdint.h>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+
+namespace loam {
+
+/** \brief Voxel grid filter replacing the points of each occupied voxel by their centroid.
+ *
+ * Produces the same points as pcl::VoxelGrid<pcl::PointXYZI>, up to the
+ * rounding of the centroid sums, with the intensity averaged like the
+ * coordinates. Instead of sorting point indices by voxel, voxels are looked up
+ * in an open addressing hash table, and all buffers are kept between calls, so
+ * a filter that is reused does not allocate once its buffers have grown.
+ *
+ * The voxels are emitted in the order of their first point rather than in PCL's
+ * voxel index order. Points with non-finite coordinates are dropped. Voxel
+ * coordinates are computed with AVX2 when the CPU supports it.
+ */
+class VoxelFilter {
+public:
+  explicit VoxelFilter(const float& leafSize = 1.0f);
+
+  /** \brief Set the edge length of the cubic voxels. */
+  void setLeafSize(const float& leafSize);
+
+  float leafSize() const { return _leafSize; }
+
+  /** \brief Down sample a cloud.
+   *
+   * @param cloudIn the input cloud
+   * @param cloudOut the output cloud, must not be the input cloud
+   */
+  void filter(const pcl::PointCloud<pcl::PointXYZI>& cloudIn,
+              pcl::PointCloud<pcl::PointXYZI>& cloudOut);
+
+private:
+  /** \brief Point sums of one occupied voxel. */
+  struct Voxel {
+    int32_t i, j, k;
+    uint32_t count;
+    float x, y, z, intensity;
+  };
+
+  float _leafSize;
+  float _inverseLeafSize;
+
+  std::vector<int32_t> _keyI;     ///< voxel coordinates of the input points
+  std::vector<int32_t> _keyJ;
+  std::vector<int32_t> _keyK;
+  std::vector<uint32_t> _table;   ///< hash table of voxel indices + 1, 0 marks a free slot
+  std::vector<Voxel> _voxels;     ///< occupied voxels in order of their first point
+};
+
+} // end namespace loam
+
+#endif //LOAM_VOXELFILTER_H
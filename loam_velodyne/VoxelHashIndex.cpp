@@ -0,0 +1,205 @@
+#include "loam_velodyne/VoxelHashIndex.h"
+#include "math_utils.h"
+
+#include <cmath>
+#include <limits>
+
+
+namespace loam {
+
+/** \brief Cell coordinate of a point coordinate, false if it is not finite or not representable. */
+static inline bool toCellKey(const float& v, const float& inverseCellSize, int32_t& key)
+{
+  float cell = std::floor(v * inverseCellSize);
+  if (cell >= -2147483648.0f && cell < 2147483648.0f) {
+    key = int32_t(cell);
+    return true;
+  }
+  return false;
+}
+
+
+
+VoxelHashIndex::VoxelHashIndex(const float& cellSize)
+    : _cellSize(cellSize),
+      _indexCellSize(cellSize),
+      _inverseCellSize(1.0f / cellSize)
+{}
+
+
+
+void VoxelHashIndex::setInputCloud(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& cloud)
+{
+  const size_t cloudSize = cloud->points.size();
+  _indexCellSize = _cellSize;
+  _inverseCellSize = 1.0f / _cellSize;
+
+  // table of at least twice the number of points, so probe sequences stay short
+  size_t tableSize = 16;
+  while (tableSize < 2 * cloudSize) {
+    tableSize *= 2;
+  }
+  const uint32_t mask = uint32_t(tableSize - 1);
+  _table.assign(tableSize, 0);
+  _cells.clear();
+  _pointCell.resize(cloudSize);
+
+  // count the points per cell
+  for (size_t idx = 0; idx < cloudSize; idx++) {
+    const pcl::PointXYZI& point = cloud->points[idx];
+    int32_t i, j, k;
+    if (!toCellKey(point.x, _inverseCellSize, i) ||
+        !toCellKey(point.y, _inverseCellSize, j) ||
+        !toCellKey(point.z, _inverseCellSize, k)) {
+      _pointCell[idx] = std::numeric_limits<uint32_t>::max();
+      continue;
+    }
+
+    for (uint32_t slot = hashVoxelKey(i, j, k) & mask; ; slot = (slot + 1) & mask) {
+      if (_table[slot] == 0) {
+        Cell cell = { i, j, k, 0, 1 };
+        _cells.push_back(cell);
+        _table[slot] = uint32_t(_cells.size());
+        _pointCell[idx] = uint32_t(_cells.size() - 1);
+        break;
+      }
+
+      Cell& cell = _cells[_table[slot] - 1];
+      if (cell.i == i && cell.j == j && cell.k == k) {
+        cell.end++;
+        _pointCell[idx] = _table[slot] - 1;
+        break;
+      }
+    }
+  }
+
+  // turn the counts into ranges, then scatter the points into them
+  uint32_t begin = 0;
+  for (Cell& cell : _cells) {
+    uint32_t count = cell.end;
+    cell.begin = cell.end = begin;
+    begin += count;
+  }
+
+  _entries.resize(begin);
+  for (size_t idx = 0; idx < cloudSize; idx++) {
+    if (_pointCell[idx] == std::numeric_limits<uint32_t>::max()) {
+      continue;
+    }
+    const pcl::PointXYZI& point = cloud->points[idx];
+    Entry& entry = _entries[_cells[_pointCell[idx]].end++];
+    entry.x = point.x;
+    entry.y = point.y;
+    entry.z = point.z;
+    entry.index = int(idx);
+  }
+}
+
+
+
+const VoxelHashIndex::Cell* VoxelHashIndex::findCell(const int32_t& i, const int32_t& j, const int32_t& k) const
+{
+  const uint32_t mask = uint32_t(_table.size() - 1);
+  for (uint32_t slot = hashVoxelKey(i, j, k) & mask; _table[slot] != 0; slot = (slot + 1) & mask) {
+    const Cell& cell = _cells[_table[slot] - 1];
+    if (cell.i == i && cell.j == j && cell.k == k) {
+      return &cell;
+    }
+  }
+  return NULL;
+}
+
+
+
+int VoxelHashIndex::search(const pcl::PointXYZI& point, const int& k, int* indices, float* sqDistances) const
+{
+  int count = 0;
+  int32_t ci, cj, ck;
+  if (k <= 0 || _cells.empty() ||
+      !toCellKey(point.x, _inverseCellSize, ci) ||
+      !toCellKey(point.y, _inverseCellSize, cj) ||
+      !toCellKey(point.z, _inverseCellSize, ck)) {
+    return count;
+  }
+
+  // distances of the query point to the lower and upper faces of its cell, per axis
+  const float lower[3] = { point.x - ci * _indexCellSize, point.y - cj * _indexCellSize, point.z - ck * _indexCellSize };
+  const float upper[3] = { _indexCellSize - lower[0], _indexCellSize - lower[1], _indexCellSize - lower[2] };
+  const int order[3] = { 0, -1, 1 };    // own cell first, so the bound tightens early
+
+  float worstSqDis = _indexCellSize * _indexCellSize;
+  for (int a = 0; a < 3; a++) {
+    const int di = order[a];
+    const float dx = di < 0 ? lower[0] : (di > 0 ? upper[0] : 0);
+    for (int b = 0; b < 3; b++) {
+      const int dj = order[b];
+      const float dy = dj < 0 ? lower[1] : (dj > 0 ? upper[1] : 0);
+      for (int c = 0; c < 3; c++) {
+        const int dk = order[c];
+        const float dz = dk < 0 ? lower[2] : (dk > 0 ? upper[2] : 0);
+
+        // skip cells that cannot hold a point closer than the current k-th neighbor
+        if (dx * dx + dy * dy + dz * dz >= worstSqDis) {
+          continue;
+        }
+        const Cell* cell = findCell(ci + di, cj + dj, ck + dk);
+        if (!cell) {
+          continue;
+        }
+
+        for (uint32_t e = cell->begin; e < cell->end; e++) {
+          const Entry& entry = _entries[e];
+          float ex = entry.x - point.x;
+          float ey = entry.y - point.y;
+          float ez = entry.z - point.z;
+          float sqDis = ex * ex + ey * ey + ez * ez;
+          if (sqDis >= worstSqDis) {
+            continue;
+          }
+
+          // insert into the sorted neighbors
+          int pos = count < k ? count++ : k - 1;
+          for (; pos > 0 && sqDistances[pos - 1] > sqDis; pos--) {
+            sqDistances[pos] = sqDistances[pos - 1];
+            indices[pos] = indices[pos - 1];
+          }
+          sqDistances[pos] = sqDis;
+          indices[pos] = entry.index;
+          if (count == k) {
+            worstSqDis = sqDistances[k - 1];
+          }
+        }
+      }
+    }
+  }
+
+  return count;
+}
+
+
+
+int VoxelHashIndex::nearestKSearch(const pcl::PointXYZI& point, int k,
+                                   std::vector<int>& k_indices,
+                                   std::vector<float>& k_sqr_distances) const
+{
+  k_indices.resize(k);
+  k_sqr_distances.resize(k);
+  return search(point, k, k_indices.data(), k_sqr_distances.data());
+}
+
+
+
+void VoxelHashIndex::nearestKSearch(const pcl::PointXYZI* points, size_t n, int k,
+                                    int* k_indices, float* k_sqr_distances) const
+{
+  for (size_t i = 0; i < n; i++) {
+    int* indices = k_indices + i * k;
+    float* sqDistances = k_sqr_distances + i * k;
+    for (int j = search(points[i], k, indices, sqDistances); j < k; j++) {
+      indices[j] = -1;
+      sqDistances[j] = std::numeric_limits<float>::max();
+    }
+  }
+}
+
+} // end namespace loam
@@ -0,0 +1,89 @@
+#ifndef LOAM_VOXELHASHINDEX_H
+#define LOAM_VOXELHASHINDEX_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+
+namespace loam {
+
+/** \brief Fixed radius nearest neighbor index over a hash of cubic cells.
+ *
+ * A drop-in for nanoflann::KdTreeFLANN<pcl::PointXYZI> where only neighbors
+ * within a fixed radius matter: nearestKSearch() returns the k nearest points
+ * closer than the cell size, and leaves out any farther ones. Building is a
+ * single counting pass over the points, and a query scans the points of the
+ * up to 27 cells around the query point.
+ */
+class VoxelHashIndex {
+public:
+  typedef boost::shared_ptr<VoxelHashIndex> Ptr;
+
+  explicit VoxelHashIndex(const float& cellSize = 1.0f);
+
+  /** \brief Set the cell edge length, which is also the search radius. Applies from the next setInputCloud(). */
+  void setCellSize(const float& cellSize) { _cellSize = cellSize; }
+
+  float cellSize() const { return _cellSize; }
+
+  /** \brief Index the points of a cloud, replacing the previous cloud. The cloud is not referenced afterwards. */
+  void setInputCloud(const pcl::PointCloud<pcl::PointXYZI>::ConstPtr& cloud);
+
+  /** \brief Find the k nearest points closer than the cell size.
+   *
+   * @param point the query point
+   * @param k the number of neighbors
+   * @param k_indices resized to k, the cloud indices of the neighbors, nearest first
+   * @param k_sqr_distances resized to k, the squared distances of the neighbors
+   * @return the number of neighbors found
+   */
+  int nearestKSearch(const pcl::PointXYZI& point, int k,
+                     std::vector<int>& k_indices,
+                     std::vector<float>& k_sqr_distances) const;
+
+  /** \brief Find the k nearest points closer than the cell size for each of n query points, without allocating.
+   *
+   * The neighbors of query i are written to k_indices[i * k] and k_sqr_distances[i * k]
+   * onwards, nearest first. Missing neighbors are marked by index -1 and the largest
+   * float distance, as in nanoflann::KdTreeFLANN::nearestKSearch().
+   */
+  void nearestKSearch(const pcl::PointXYZI* points, size_t n, int k,
+                      int* k_indices, float* k_sqr_distances) const;
+
+private:
+  /** \brief An occupied cell and the range of its points in _entries. */
+  struct Cell {
+    int32_t i, j, k;
+    uint32_t begin, end;
+  };
+
+  /** \brief A point in cell order. */
+  struct Entry {
+    float x, y, z;
+    int index;
+  };
+
+  /** \brief The cell with the given coordinates, NULL if it is empty. */
+  const Cell* findCell(const int32_t& i, const int32_t& j, const int32_t& k) const;
+
+  int search(const pcl::PointXYZI& point, const int& k, int* indices, float* sqDistances) const;
+
+  float _cellSize;
+  float _indexCellSize;                 ///< cell size of the indexed cloud
+  float _inverseCellSize;
+
+  std::vector<Cell> _cells;             ///< occupied cells in order of their first point
+  std::vector<uint32_t> _table;         ///< hash table of cell indices + 1, 0 marks a free slot
+  std::vector<Entry> _entries;          ///< the points, grouped by cell
+  std::vector<uint32_t> _pointCell;     ///< cell per cloud point, scratch for building
+};
+
+} // end namespace loam
+
+#endif //LOAM_VOXELHASHINDEX_H
@@ -5,6 +5,8 @@
 #include "Angle.h"
 #include "Vector3.h"
 
+#include <stdint.h>
+#include <algorithm>
 #include <cmath>
 
 
@@ -59,6 +61,61 @@ inline float deg2rad(float degrees)
 
 
 
+/** \brief Approximate atan2 for the per point loops.
+ *
+ * Uses a polynomial on [0, 1] with a maximum error of about 2e-6 rad, and
+ * handles the quadrants and signed zeros like std::atan2.
+ *
+ * @param y The y coordinate.
+ * @param x The x coordinate.
+ * @return The angle in radians, in [-pi, pi].
+ */
+inline float fastAtan2(const float& y, const float& x)
+{
+  float ax = std::fabs(x);
+  float ay = std::fabs(y);
+  float mx = std::max(ax, ay);
+  float mn = std::min(ax, ay);
+  if (!(mx > 0) || std::isinf(mx)) {
+    // zeros, NaN and INF
+    return std::atan2(y, x);
+  }
+
+  float a = mn / mx;
+  float s = a * a;
+  float r = a * (0.99997726f + s * (-0.33262347f + s * (0.19354346f + s * (-0.11643287f + s * (0.05265332f - s * 0.01172120f)))));
+
+  if (ay > ax) {
+    r = 1.57079637f - r;
+  }
+  if (x < 0) {
+    r = 3.14159274f - r;
+  }
+  return std::signbit(y) ? -r : r;
+}
+
+
+
+
+/** \brief Hash of integer voxel coordinates, mixed so the low bits can address a power of two sized table.
+ *
+ * @param i The x voxel coordinate.
+ * @param j The y voxel coordinate.
+ * @param k The z voxel coordinate.
+ * @return The hash value.
+ */
+inline uint32_t hashVoxelKey(const int32_t& i, const int32_t& j, const int32_t& k)
+{
+  uint32_t h = (uint32_t(i) * 73856093u) ^ (uint32_t(j) * 19349663u) ^ (uint32_t(k) * 83492791u);
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  return h;
+}
+
+
+
+
 /** \brief Calculate the squared difference of the given two points.
  *
  * @param a The first point.
@@ -41,6 +41,9 @@
 #ifndef NANO_KDTREE_KDTREE_FLANN_H_
 #define NANO_KDTREE_KDTREE_FLANN_H_
 
+#include <algorithm>
+#include <limits>
+#include <vector>
 #include <boost/shared_ptr.hpp>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
@@ -51,6 +54,11 @@ namespace nanoflann
 
 // Adapter class to give to nanoflann the same "look and fell" of pcl::KdTreeFLANN.
 // limited to squared distance between 3D points
+//
+// The tree is built over a packed copy of the x/y/z coordinates taken in
+// setInputCloud(), so leaf scans read 12 bytes per point instead of the full
+// PCL point, and the distance is the plain squared Euclidean distance with
+// the dimension fixed at compile time.
 template <typename PointT>
 class KdTreeFLANN
 {
@@ -66,15 +74,14 @@ public:
     typedef boost::shared_ptr<std::vector<int> > IndicesPtr;
     typedef boost::shared_ptr<const std::vector<int> > IndicesConstPtr;
 
-    KdTreeFLANN (bool sorted = true);
-
-    KdTreeFLANN (const KdTreeFLANN<PointT> &k);
+    KdTreeFLANN (bool sorted = true, size_t leaf_size = 10);
 
     void  setEpsilon (float eps);
 
     void  setSortedResults (bool sorted);
 
-    inline Ptr makeShared () { return Ptr (new KdTreeFLANN<PointT> (*this)); }
+    // maximum number of points per leaf, used from the next setInputCloud()
+    void  setLeafSize (size_t leaf_size);
 
     void setInputCloud (const PointCloudPtr &cloud, const IndicesConstPtr &indices = IndicesConstPtr ());
 
@@ -83,6 +90,20 @@ public:
     int  nearestKSearch (const PointT &point, int k, std::vector<int> &k_indices,
                          std::vector<float> &k_sqr_distances) const;
 
+    // k nearest neighbors of each of n query points, without allocating: the
+    // neighbors of query i are written to k_indices[i * k] and
+    // k_sqr_distances[i * k] onwards, nearest first, and missing neighbors
+    // are marked by index -1 and the largest float distance
+    void nearestKSearch (const PointT *points, size_t n, int k, int *k_indices,
+                         float *k_sqr_distances) const;
+
+    // same as above, spread over the workers of a loam::ThreadPool or
+    // anything else offering parallelFor(n, fn(i, worker))
+    template <typename Pool>
+    void nearestKSearch (const PointT *points, size_t n, int k, int *k_indices,
+                         float *k_sqr_distances, Pool &pool) const;
+
+    // neighbors within radius, as distance (not squared)
     int radiusSearch (const PointT &point, double radius, std::vector<int> &k_indices,
                       std::vector<float> &k_sqr_distances) const;
 
@@ -90,30 +111,32 @@ private:
 
     nanoflann::SearchParams _params;
 
+    // packed x/y/z coordinates of the (indexed) input points
     struct PointCloud_Adaptor
     {
-      inline size_t kdtree_get_point_count() const;
-      inline float kdtree_get_pt(const size_t idx, int dim) const;
+      inline size_t kdtree_get_point_count() const { return points.size() / 3; }
+      inline float kdtree_get_pt(const size_t idx, int dim) const { return points[3 * idx + dim]; }
       template <class BBOX> bool kdtree_get_bbox(BBOX&) const { return false; }
-      PointCloudConstPtr pcl;
-      IndicesConstPtr indices;
+      std::vector<float> points;
     };
 
     typedef nanoflann::KDTreeSingleIndexAdaptor<
-      nanoflann::SO3_Adaptor<float, PointCloud_Adaptor > ,
-      PointCloud_Adaptor, 3, int> KDTreeFlann_PCL_SO3;
+      nanoflann::L2_Simple_Adaptor<float, PointCloud_Adaptor > ,
+      PointCloud_Adaptor, 3, int> KDTreeFlann_PCL_L2;
+
+    void buildIndex (const PointCloud &cloud, const IndicesConstPtr &indices);
 
     PointCloud_Adaptor _adaptor;
 
-    KDTreeFlann_PCL_SO3 _kdtree;
+    KDTreeFlann_PCL_L2 _kdtree;
 
 };
 
 //---------- Definitions ---------------------
 
 template<typename PointT> inline
-KdTreeFLANN<PointT>::KdTreeFLANN(bool sorted):
-    _kdtree(3,_adaptor)
+KdTreeFLANN<PointT>::KdTreeFLANN(bool sorted, size_t leaf_size):
+    _kdtree(3,_adaptor, nanoflann::KDTreeSingleIndexAdaptorParams(leaf_size))
 {
     _params.sorted = sorted;
 }
@@ -130,21 +153,37 @@ void KdTreeFLANN<PointT>::setSortedResults(bool sorted)
     _params.sorted = sorted;
 }
 
+template<typename PointT> inline
+void KdTreeFLANN<PointT>::setLeafSize(size_t leaf_size)
+{
+    _kdtree.m_leaf_max_size = leaf_size;
+}
+
 template<typename PointT> inline
 void KdTreeFLANN<PointT>::setInputCloud(const KdTreeFLANN::PointCloudPtr &cloud,
                                         const IndicesConstPtr &indices)
 {
-    _adaptor.pcl = cloud;
-    _adaptor.indices = indices;
-    _kdtree.buildIndex();
+    buildIndex(*cloud, indices);
 }
 
 template<typename PointT> inline
 void KdTreeFLANN<PointT>::setInputCloud(const KdTreeFLANN::PointCloudConstPtr &cloud,
                                         const IndicesConstPtr &indices)
 {
-    _adaptor.pcl = cloud;
-    _adaptor.indices = indices;
+    buildIndex(*cloud, indices);
+}
+
+template<typename PointT> inline
+void KdTreeFLANN<PointT>::buildIndex(const PointCloud &cloud, const IndicesConstPtr &indices)
+{
+    const size_t n = indices ? indices->size() : cloud.points.size();
+    _adaptor.points.resize(3 * n);
+    for (size_t i = 0; i < n; i++) {
+        const PointT& p = indices ? cloud.points[(*indices)[i]] : cloud.points[i];
+        _adaptor.points[3 * i] = p.x;
+        _adaptor.points[3 * i + 1] = p.y;
+        _adaptor.points[3 * i + 2] = p.z;
+    }
     _kdtree.buildIndex();
 }
 
@@ -158,49 +197,66 @@ int KdTreeFLANN<PointT>::nearestKSearch(const PointT &point, int num_closest,
 
     nanoflann::KNNResultSet<float,int> resultSet(num_closest);
     resultSet.init( k_indices.data(), k_sqr_distances.data());
-    _kdtree.findNeighbors(resultSet, point.data, nanoflann::SearchParams() );
+    _kdtree.findNeighbors(resultSet, point.data, _params);
     return resultSet.size();
 }
 
+template<typename PointT> inline
+void KdTreeFLANN<PointT>::nearestKSearch(const PointT *points, size_t n, int num_closest,
+                                         int *k_indices, float *k_sqr_distances) const
+{
+    for (size_t i = 0; i < n; i++) {
+        int *indices = k_indices + i * num_closest;
+        float *sqr_distances = k_sqr_distances + i * num_closest;
+
+        nanoflann::KNNResultSet<float,int> resultSet(num_closest);
+        resultSet.init(indices, sqr_distances);
+        _kdtree.findNeighbors(resultSet, points[i].data, _params);
+        for (int j = int(resultSet.size()); j < num_closest; j++) {
+            indices[j] = -1;
+            sqr_distances[j] = std::numeric_limits<float>::max();
+        }
+    }
+}
+
+template<typename PointT> template <typename Pool> inline
+void KdTreeFLANN<PointT>::nearestKSearch(const PointT *points, size_t n, int num_closest,
+                                         int *k_indices, float *k_sqr_distances, Pool &pool) const
+{
+    // queries are independent and only write their own slots
+    const size_t chunk_size = 64;
+    pool.parallelFor((n + chunk_size - 1) / chunk_size, [&](size_t chunk, size_t) {
+        const size_t begin = chunk * chunk_size;
+        const size_t offset = begin * num_closest;
+        nearestKSearch(points + begin, std::min(chunk_size, n - begin), num_closest,
+                       k_indices + offset, k_sqr_distances + offset);
+    });
+}
+
 template<typename PointT> inline
 int KdTreeFLANN<PointT>::radiusSearch(const PointT &point, double radius,
                               std::vector<int> &k_indices,
                               std::vector<float> &k_sqr_distances) const
 {
-    static std::vector<std::pair<int, float> > indices_dist;
+    std::vector<std::pair<int, float> > indices_dist;
     indices_dist.reserve( 128 );
 
-    RadiusResultSet<float, int> resultSet(radius, indices_dist);
-    const size_t nFound = _kdtree.findNeighbors(resultSet, point.data, _params);
+    RadiusResultSet<float, int> resultSet(radius * radius, indices_dist);
+    _kdtree.findNeighbors(resultSet, point.data, _params);
+    const size_t nFound = indices_dist.size();
 
     if (_params.sorted)
         std::sort(indices_dist.begin(), indices_dist.end(), IndexDist_Sorter() );
 
     k_indices.resize(nFound);
     k_sqr_distances.resize(nFound);
-    for(int i=0; i<nFound; i++ ){
+    for(size_t i=0; i<nFound; i++ ){
         k_indices[i]       = indices_dist[i].first;
         k_sqr_distances[i] = indices_dist[i].second;
     }
     return nFound;
 }
 
-template<typename PointT> inline
-size_t KdTreeFLANN<PointT>::PointCloud_Adaptor::kdtree_get_point_count() const {
-    if( indices ) return indices->size();
-    if( pcl)  return pcl->points.size();
-    return 0;
-}
-
-template<typename PointT> inline
-float KdTreeFLANN<PointT>::PointCloud_Adaptor::kdtree_get_pt(const size_t idx, int dim) const{
-    const PointT& p = ( indices ) ? pcl->points[(*indices)[idx]] : pcl->points[idx];
-    if (dim==0) return p.x;
-    else if (dim==1) return p.y;
-    else if (dim==2) return p.z;
-    else return 0.0;
-}
-
 }
 
 
@@ -28,12 +28,58 @@ int main(int argc, char* argv[])
 {
     if (argc < 3) {
         std::fprintf(stderr, "Args not enough !\n");
-        std::printf("[Usage] ./GenerateSamplesForPointLabeler [dsvl] [calib]\n");
+        std::printf("[Usage] ./GenerateSamplesForPointLabeler [dsvl] [calib] [options]\n");
         std::printf("For example:\n");
         std::printf("[dsvl](required): 20190331133302_4-seg.dsvl\n");
         std::printf("[calib](required): P40n.calib\n");
+        std::printf("[options]:\n");
+        std::printf("  --start N : index of the first frame to process\n");
+        std::printf("  --end N   : index one past the last frame, -1 for the end of the log\n");
+        std::printf("  --prefetch N   : number of frames decoded ahead, 0 to decode synchronously\n");
+        std::printf("  --drop-when-full : drop decoded frames instead of waiting when the prefetch buffer is full\n");
+        std::printf("  --sync : run registration, odometry and mapping one after another on one thread\n");
+        std::printf("  --pipeline-depth N : number of frames queued between two pipeline stages\n");
+        std::printf("  --headless : do not open a viewer\n");
+        std::printf("  --vis-every N : show only every N-th frame in the viewer\n");
+        std::printf("  --threads N : number of threads per LOAM stage, 0 to split the cores among the stages\n");
+        std::printf("  --unorganized : recover rings from point angles instead of the beam layout\n");
+        std::printf("  --edge-residuals : also match corner points to map edges in mapping\n");
+        std::printf("  --no-fov-culling : search all map cubes around the sensor, not only those in its field of view\n");
         return 0;
     }
+
+    DsvlProcessorParams params;
+    for (int i = 3; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--start" && i + 1 < argc) {
+            params.startFrame = std::atoi(argv[++i]);
+        } else if (arg == "--end" && i + 1 < argc) {
+            params.endFrame = std::atoi(argv[++i]);
+        } else if (arg == "--prefetch" && i + 1 < argc) {
+            params.prefetchDepth = std::atoi(argv[++i]);
+        } else if (arg == "--drop-when-full") {
+            params.prefetchDropWhenFull = true;
+        } else if (arg == "--sync") {
+            params.pipelined = false;
+        } else if (arg == "--pipeline-depth" && i + 1 < argc) {
+            params.pipelineDepth = std::atoi(argv[++i]);
+        } else if (arg == "--headless") {
+            params.headless = true;
+        } else if (arg == "--vis-every" && i + 1 < argc) {
+            params.visualizeEvery = std::atoi(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            params.threads = std::atoi(argv[++i]);
+        } else if (arg == "--unorganized") {
+            params.organized = false;
+        } else if (arg == "--edge-residuals") {
+            params.edgeResiduals = true;
+        } else if (arg == "--no-fov-culling") {
+            params.fovCulling = false;
+        } else {
+            std::fprintf(stderr, "Unknown option : %s\n", argv[i]);
+            return 0;
+        }
+    }
     std::string dsvlfilename(argv[1]);
 
     // 激光雷达到GPS标定文件
@@ -47,7 +93,7 @@ int main(int argc, char* argv[])
     VIS_WIDTH  = 1080;
     FAC_HEIGHT = (double)VIS_HEIGHT / (double)HEIGHT;
 
-    DsvlProcessor dsvl(dsvlfilename, calibFileName);
+    DsvlProcessor dsvl(dsvlfilename, calibFileName, params);
     dsvl.Processing();
 
     cout << "Over!" << endl;
@@ -0,0 +1,102 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/// Bounded lock-free ring for exactly one producer and one consumer thread.
+///
+/// tryPush/tryPop never block. push/pop wait (spin, then back off with short
+/// sleeps) until they succeed or the ring is closed. Once closed, push fails
+/// immediately and pop drains what is left before failing.
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(size_t capacity):
+    _slots(capacity > 0 ? capacity : 1),
+    _head(0),
+    _tail(0),
+    _closed(false)
+    {
+    }
+
+    size_t capacity() const { return _slots.size(); }
+
+    size_t size() const { return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire); }
+
+    bool closed() const { return _closed.load(std::memory_order_acquire); }
+
+    void close() { _closed.store(true, std::memory_order_release); }
+
+    /// Producer side. Moves from item only on success.
+    bool tryPush(T& item)
+    {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) >= _slots.size())
+            return false;
+        _slots[tail % _slots.size()] = std::move(item);
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Consumer side.
+    bool tryPop(T& item)
+    {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire))
+            return false;
+        item = std::move(_slots[head % _slots.size()]);
+        _slots[head % _slots.size()] = T();
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool push(T& item)
+    {
+        for (int spins = 0; !closed(); spins++) {
+            if (tryPush(item))
+                return true;
+            backoff(spins);
+        }
+        return false;
+    }
+
+    bool pop(T& item)
+    {
+        for (int spins = 0; ; spins++) {
+            // check closed before trying, so an item pushed right before
+            // close() is still handed out
+            bool wasClosed = closed();
+            if (tryPop(item))
+                return true;
+            if (wasClosed)
+                return false;
+            backoff(spins);
+        }
+    }
+
+private:
+    SpscRing(const SpscRing&);
+    SpscRing& operator=(const SpscRing&);
+
+    static void backoff(int spins)
+    {
+        if (spins < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    std::vector<T> _slots;
+    // head and tail are written by different threads, keep them on separate cache lines
+    alignas(64) std::atomic<size_t> _head;
+    alignas(64) std::atomic<size_t> _tail;
+    std::atomic<bool> _closed;
+};
+
+#endif // SPSCRING_H
@@ -0,0 +1,125 @@
+// loam::computeCurvature() against computeCurvatureScalar() and the original
+// per-point loop over pcl::PointXYZI, bit for bit, on random rings of all small
+// sizes. Built with -ffp-contract=off like Curvature.cpp.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <pcl/point_types.h>
+
+#include "loam_velodyne/Curvature.h"
+
+
+namespace {
+
+typedef std::vector<pcl::PointXYZI, Eigen::aligned_allocator<pcl::PointXYZI> > Ring;
+
+std::mt19937 rng(42);
+
+/** \brief The curvature loop of ScanRegistration::setRegionBuffersFor() before the SoA kernel. */
+void originalCurvature(const Ring& ring, const int& region, std::vector<float>& curvature)
+{
+  curvature.assign(ring.size(), 0.0f);
+  float pointWeight = -2 * region;
+
+  for (size_t i = region; i + region < ring.size(); i++) {
+    float diffX = pointWeight * ring[i].x;
+    float diffY = pointWeight * ring[i].y;
+    float diffZ = pointWeight * ring[i].z;
+
+    for (int j = 1; j <= region; j++) {
+      diffX += ring[i + j].x + ring[i - j].x;
+      diffY += ring[i + j].y + ring[i - j].y;
+      diffZ += ring[i + j].z + ring[i - j].z;
+    }
+
+    curvature[i] = diffX * diffX + diffY * diffY + diffZ * diffZ;
+  }
+}
+
+/** \brief A ring of points around the sensor, with range jumps like at object borders. */
+Ring randomRing(const size_t& size)
+{
+  std::uniform_real_distribution<float> uniform(0, 1);
+  Ring ring(size);
+  float range = 10;
+  for (size_t i = 0; i < size; i++) {
+    if (uniform(rng) < 0.05f) {
+      range = 1 + 80 * uniform(rng);
+    }
+    float azimuth = float(2 * M_PI * i / std::max(size, size_t(1)));
+    float r = range * (1 + 0.01f * uniform(rng));
+    ring[i].x = r * std::sin(azimuth);
+    ring[i].y = -1.5f + 0.1f * uniform(rng);
+    ring[i].z = r * std::cos(azimuth);
+  }
+  return ring;
+}
+
+/** \brief Compare all three implementations on one ring, false on any difference. */
+bool checkRing(const Ring& ring, const int& region)
+{
+  const size_t size = ring.size();
+  std::vector<float> x(size), y(size), z(size);
+  for (size_t i = 0; i < size; i++) {
+    x[i] = ring[i].x;
+    y[i] = ring[i].y;
+    z[i] = ring[i].z;
+  }
+
+  // one guard entry behind the output catches writes past the end
+  const float guard = -1.0f;
+  std::vector<float> vectorized(size + 1, guard), scalar(size + 1, guard), original;
+  loam::computeCurvature(x.data(), y.data(), z.data(), size, region, vectorized.data());
+  loam::computeCurvatureScalar(x.data(), y.data(), z.data(), size, region, scalar.data());
+  originalCurvature(ring, region, original);
+
+  return vectorized[size] == guard && scalar[size] == guard
+         && std::memcmp(vectorized.data(), scalar.data(), size * sizeof(float)) == 0
+         && std::memcmp(scalar.data(), original.data(), size * sizeof(float)) == 0;
+}
+
+} // end anonymous namespace
+
+
+
+int main()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  std::printf("AVX2 %s\n", __builtin_cpu_supports("avx2") ? "available, comparing the vectorized kernel"
+                                                          : "not available, only the scalar path is covered");
+#endif
+
+  int rings = 0;
+  int failures = 0;
+  const int regions[] = { 0, 1, 2, 5, 9 };
+  for (const int& region : regions) {
+    // every size up to a few vectors, covering size < 2 * region + 1 and all remainders modulo 8
+    for (size_t size = 0; size <= 64; size++) {
+      for (int n = 0; n < 20; n++) {
+        rings++;
+        if (!checkRing(randomRing(size), region) && ++failures <= 5) {
+          std::printf("  mismatch: size %zu, region %d\n", size, region);
+        }
+      }
+    }
+
+    // full rings of a 40 beam sensor at 0.2 degrees, and around it
+    const size_t sizes[] = { 1799, 1800, 1801, 1803, 1807 };
+    for (const size_t& size : sizes) {
+      rings++;
+      if (!checkRing(randomRing(size), region) && ++failures <= 5) {
+        std::printf("  mismatch: size %zu, region %d\n", size, region);
+      }
+    }
+  }
+
+  std::printf("%d rings, failures %d\n", rings, failures);
+  std::printf(failures == 0 ? "passed\n" : "FAILED\n");
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,192 @@
+// k nearest neighbor and radius queries of nanoflann::KdTreeFLANN against brute force,
+// including more neighbors requested than the cloud holds.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "loam_velodyne/ThreadPool.h"
+#include "loam_velodyne/nanoflann_pcl.h"
+
+
+namespace {
+
+typedef pcl::PointXYZI PointT;
+typedef std::vector<PointT, Eigen::aligned_allocator<PointT> > PointList;
+
+std::mt19937 rng(42);
+
+/** \brief Squared distance, summed in the order of nanoflann's L2 metric. */
+float squaredDistance(const PointT& a, const PointT& b)
+{
+  float dx = a.x - b.x;
+  float dy = a.y - b.y;
+  float dz = a.z - b.z;
+  return dx * dx + dy * dy + dz * dz;
+}
+
+/** \brief All points sorted by distance to the query. */
+std::vector<std::pair<float, int> > bruteForce(const pcl::PointCloud<PointT>& cloud, const PointT& query)
+{
+  std::vector<std::pair<float, int> > all(cloud.size());
+  for (size_t i = 0; i < cloud.size(); i++) {
+    all[i] = std::make_pair(squaredDistance(cloud.points[i], query), int(i));
+  }
+  std::sort(all.begin(), all.end());
+  return all;
+}
+
+/** \brief Check one neighbor list of found entries against the sorted brute force distances.
+ *
+ * Indices are checked through the distance of the point they refer to, so ties may come in any order.
+ */
+bool checkNeighbors(const pcl::PointCloud<PointT>& cloud, const PointT& query,
+                    const std::vector<std::pair<float, int> >& expected, const size_t& found,
+                    const int* indices, const float* sqDistances)
+{
+  for (size_t j = 0; j < found; j++) {
+    if (indices[j] < 0 || size_t(indices[j]) >= cloud.size() ||
+        sqDistances[j] != expected[j].first ||
+        squaredDistance(cloud.points[indices[j]], query) != sqDistances[j]) {
+      return false;
+    }
+    for (size_t l = 0; l < j; l++) {
+      if (indices[l] == indices[j]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+pcl::PointCloud<PointT>::Ptr randomCloud(const size_t& size)
+{
+  // a street like spread: wide and flat, every third point on the ground
+  std::uniform_real_distribution<float> uniform(-1, 1);
+  pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>());
+  for (size_t i = 0; i < size; i++) {
+    PointT point;
+    point.x = 50 * uniform(rng);
+    point.y = i % 3 ? 3 * uniform(rng) : -1.8f;
+    point.z = 50 * uniform(rng);
+    point.intensity = float(i % 40);
+    cloud->push_back(point);
+  }
+  return cloud;
+}
+
+PointList queriesFor(const pcl::PointCloud<PointT>& cloud, const size_t& count)
+{
+  std::uniform_real_distribution<float> uniform(-1, 1);
+  PointList queries(count);
+  for (size_t i = 0; i < count; i++) {
+    PointT& query = queries[i];
+    if (i % 4 == 0) {
+      // far away from all points
+      query.x = 500 * uniform(rng);
+      query.y = 500 * uniform(rng);
+      query.z = 500 * uniform(rng);
+    } else {
+      query = cloud.points[rng() % cloud.size()];
+      query.x += 0.5f * uniform(rng);
+      query.y += 0.5f * uniform(rng);
+      query.z += 0.5f * uniform(rng);
+    }
+  }
+  return queries;
+}
+
+bool testCloud(const size_t& cloudSize, loam::ThreadPool& pool)
+{
+  pcl::PointCloud<PointT>::Ptr cloud = randomCloud(cloudSize);
+  nanoflann::KdTreeFLANN<PointT> kdtree;
+  kdtree.setInputCloud(cloud);
+
+  const PointList queries = queriesFor(*cloud, 500);
+  // more neighbors than points only on small clouds, the result set insertion is linear in k
+  const int ks[] = { 1, 5, 10, int(std::min(cloudSize, size_t(100))) + 3 };
+  const size_t kNum = sizeof(ks) / sizeof(ks[0]);
+
+  std::vector<int> batchIndices[kNum], poolIndices[kNum];
+  std::vector<float> batchSqDistances[kNum], poolSqDistances[kNum];
+  for (size_t n = 0; n < kNum; n++) {
+    const int& k = ks[n];
+    batchIndices[n].resize(queries.size() * k);
+    batchSqDistances[n].resize(queries.size() * k);
+    poolIndices[n].resize(queries.size() * k);
+    poolSqDistances[n].resize(queries.size() * k);
+    kdtree.nearestKSearch(queries.data(), queries.size(), k, batchIndices[n].data(), batchSqDistances[n].data());
+    kdtree.nearestKSearch(queries.data(), queries.size(), k, poolIndices[n].data(), poolSqDistances[n].data(), pool);
+  }
+
+  int failures = 0;
+  std::vector<int> indices;
+  std::vector<float> sqDistances;
+  for (size_t q = 0; q < queries.size(); q++) {
+    const std::vector<std::pair<float, int> > expected = bruteForce(*cloud, queries[q]);
+
+    for (size_t n = 0; n < kNum; n++) {
+      const int& k = ks[n];
+      const size_t found = std::min(size_t(k), cloudSize);
+
+      // single query, which reports how many neighbors it found
+      bool ok = kdtree.nearestKSearch(queries[q], k, indices, sqDistances) == int(found)
+                && indices.size() == size_t(k)
+                && checkNeighbors(*cloud, queries[q], expected, found, indices.data(), sqDistances.data());
+
+      // batched queries, which pad missing neighbors
+      const int* batch = &batchIndices[n][q * k];
+      const float* batchSq = &batchSqDistances[n][q * k];
+      ok = ok && checkNeighbors(*cloud, queries[q], expected, found, batch, batchSq);
+      for (size_t j = found; j < size_t(k); j++) {
+        ok = ok && batch[j] == -1 && batchSq[j] == std::numeric_limits<float>::max();
+      }
+
+      // the pool gives the same result as the serial batch
+      ok = ok && std::equal(batch, batch + k, &poolIndices[n][q * k])
+              && std::equal(batchSq, batchSq + k, &poolSqDistances[n][q * k]);
+
+      if (!ok && ++failures <= 5) {
+        std::printf("  mismatch: cloud %zu, k %d, query %zu\n", cloudSize, k, q);
+      }
+    }
+
+    // radius search, as used for the map around the sensor
+    const double radius = 1.5;
+    size_t inside = 0;
+    while (inside < expected.size() && expected[inside].first < radius * radius) {
+      inside++;
+    }
+    bool ok = kdtree.radiusSearch(queries[q], radius, indices, sqDistances) == int(inside)
+              && indices.size() == inside
+              && checkNeighbors(*cloud, queries[q], expected, inside, indices.data(), sqDistances.data());
+    if (!ok && ++failures <= 5) {
+      std::printf("  radius mismatch: cloud %zu, query %zu\n", cloudSize, q);
+    }
+  }
+
+  std::printf("cloud %6zu: failures %d\n", cloudSize, failures);
+  return failures == 0;
+}
+
+} // end anonymous namespace
+
+
+
+int main()
+{
+  loam::ThreadPool pool(4);
+
+  bool ok = true;
+  const size_t cloudSizes[] = { 1, 4, 9, 100, 2000, 20000 };
+  for (const size_t& cloudSize : cloudSizes) {
+    ok &= testCloud(cloudSize, pool);
+  }
+
+  std::printf(ok ? "passed\n" : "FAILED\n");
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
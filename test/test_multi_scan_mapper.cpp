@@ -0,0 +1,213 @@
+// loam::MultiScanMapper::getRingForTan() against the exact mapping
+// getRingForAngle(std::atan(tanAngle)) over the full elevation range, for the fixed
+// formula and for the P40 beam angle table, and the table against the formula.
+// Also the beam to ring calibration of organized clouds with dark beams.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "loam_velodyne/MultiScanRegistration.h"
+
+
+namespace {
+
+const float DEG = float(M_PI / 180);
+
+/** \brief The tangents to check: a fine sweep over -90 to 90 degrees, the tangents
+ * around each lookup table bin edge of the field of view, and random ones. */
+std::vector<float> testTangents()
+{
+  std::vector<float> tangents;
+  for (double angle = -89.9; angle <= 89.9; angle += 0.0005) {
+    tangents.push_back(float(std::tan(angle * M_PI / 180)));
+  }
+
+  // bin edges lie at most every 0.01 degree, step well below that around the field of view
+  for (float tanAngle = std::tan(-20 * DEG); tanAngle < std::tan(10 * DEG); tanAngle += 1e-5f) {
+    tangents.push_back(tanAngle);
+    tangents.push_back(std::nextafter(tanAngle, -1.0f));
+    tangents.push_back(std::nextafter(tanAngle, 1.0f));
+  }
+
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> uniform(-0.5f, 0.5f);
+  for (int i = 0; i < 1000000; i++) {
+    tangents.push_back(uniform(rng));
+  }
+
+  tangents.push_back(0);
+  tangents.push_back(std::numeric_limits<float>::max());
+  tangents.push_back(-std::numeric_limits<float>::max());
+  tangents.push_back(std::numeric_limits<float>::infinity());
+  tangents.push_back(-std::numeric_limits<float>::infinity());
+  return tangents;
+}
+
+/** \brief Compare the lookup table with the exact mapping, returns the number of mismatches. */
+int checkLookup(const char* name, loam::MultiScanMapper mapper, const std::vector<float>& tangents)
+{
+  int mismatches = 0;
+  size_t inView = 0;
+  for (const float& tanAngle : tangents) {
+    int expected = mapper.getRingForAngle(std::atan(tanAngle));
+    int actual = mapper.getRingForTan(tanAngle);
+    inView += expected >= 0;
+    if (actual != expected && ++mismatches <= 5) {
+      std::printf("  mismatch: %s, %.6f deg, ring %d instead of %d\n",
+                  name, std::atan(tanAngle) / DEG, actual, expected);
+    }
+  }
+
+  // NaN from points that are not finite is outside the field of view
+  if (mapper.getRingForTan(std::numeric_limits<float>::quiet_NaN()) != -1 && ++mismatches <= 5) {
+    std::printf("  mismatch: %s, NaN is mapped to a ring\n", name);
+  }
+
+  std::printf("%-8s %zu tangents, %zu in view, mismatches %d\n", name, tangents.size(), inView, mismatches);
+  return mismatches;
+}
+
+/** \brief The P40 table assigns the closest beam, the formula splits the two gaps
+ * between its segments at 1.8 and -5.8 degrees instead of in the middle.
+ * Everywhere else both must agree, on every ring and on the field of view,
+ * up to angles exactly between two beams. */
+int checkTableAgainstFormula(const std::vector<float>& tangents)
+{
+  loam::MultiScanMapper formula(-16, 7, 40);
+  loam::MultiScanMapper table = loam::MultiScanMapper::Hesai_P40();
+  const int nRings = table.getNumberOfScanRings();
+
+  // the beam angles, from the center of each ring of the formula
+  std::vector<float> beamAngles(nRings);
+  for (int ring = 0; ring < nRings; ring++) {
+    beamAngles[ring] = ring < 6 ? 7 - ring : (ring < 29 ? (5 - (ring - 6)) / 3.0f : -6 - (ring - 29));
+  }
+
+  int mismatches = 0;
+  size_t gapPoints = 0;
+  for (const float& tanAngle : tangents) {
+    float angle = std::atan(tanAngle);
+    int formulaRing = formula.getRingForAngle(angle);
+    int tableRing = table.getRingForAngle(angle);
+
+    // the formula maps -16.5 degrees to ring 40, which the registration drops
+    if (formulaRing >= nRings) {
+      formulaRing = -1;
+    }
+    if (formulaRing == tableRing) {
+      continue;
+    }
+
+    // ties between two beams, or on the bounds of the field of view
+    float degrees = angle / DEG;
+    bool tie = std::fabs(degrees - 7.5f) < 1e-4f || std::fabs(degrees + 16.5f) < 1e-4f;
+    for (int ring = 0; ring + 1 < nRings; ring++) {
+      tie = tie || std::fabs(degrees - (beamAngles[ring] + beamAngles[ring + 1]) / 2) < 1e-4f;
+    }
+
+    bool inGap = (degrees > 1.79f && degrees < 1.84f) || (degrees > -5.84f && degrees < -5.79f);
+    if (inGap) {
+      gapPoints++;
+    } else if (!tie && ++mismatches <= 5) {
+      std::printf("  mismatch: table and formula, %.6f deg, ring %d instead of %d\n",
+                  degrees, tableRing, formulaRing);
+    }
+  }
+
+  std::printf("%-8s %zu tangents differ between the segment gaps, mismatches %d\n",
+              "P40/fixed", gapPoints, mismatches);
+  return mismatches;
+}
+
+/** \brief Exposes the beam to ring assignment of the registration. */
+class CalibrationProbe : public loam::MultiScanRegistration {
+public:
+  CalibrationProbe() : loam::MultiScanRegistration(loam::MultiScanMapper::Hesai_P40()) {}
+
+  const std::vector<std::vector<int> >& ringBeams() const { return _ringBeams; }
+  bool calibrated() const { return _beamRingsCalibrated; }
+};
+
+/** \brief An organized P40 frame of a cylinder 20 m around the sensor, rows in reverse
+ * beam order, with the given beams dark. */
+pcl::PointCloud<pcl::PointXYZ> organizedFrame(const std::vector<int>& darkBeams)
+{
+  const int nBeams = 40, nFirings = 360;
+  pcl::PointCloud<pcl::PointXYZ> cloud(nFirings, nBeams);
+  for (int row = 0; row < nBeams; row++) {
+    int beam = nBeams - 1 - row;
+    float elevation = (beam < 6 ? 7 - beam : (beam < 29 ? (5 - (beam - 6)) / 3.0f : -6 - (beam - 29))) * DEG;
+    bool dark = std::find(darkBeams.begin(), darkBeams.end(), beam) != darkBeams.end();
+    for (int col = 0; col < nFirings; col++) {
+      float azimuth = float(2 * M_PI) * col / nFirings;
+      pcl::PointXYZ& point = cloud(col, row);
+      point.x = dark ? std::numeric_limits<float>::quiet_NaN() : 20 * std::cos(azimuth);
+      point.y = dark ? std::numeric_limits<float>::quiet_NaN() : 20 * std::sin(azimuth);
+      point.z = dark ? std::numeric_limits<float>::quiet_NaN() : 20 * std::tan(elevation);
+    }
+  }
+  return cloud;
+}
+
+/** \brief The assignment is final after the first frame, dark beams stay unmapped. */
+int checkCalibration()
+{
+  CalibrationProbe registration;
+  int mismatches = 0;
+
+  // no valid point at all, nothing to decide on yet
+  std::vector<int> allBeams;
+  for (int beam = 0; beam < 40; beam++) {
+    allBeams.push_back(beam);
+  }
+  registration.processOrganized(organizedFrame(allBeams), 0);
+  mismatches += registration.calibrated() ? 1 : 0;
+
+  // the two topmost beams see only sky
+  std::vector<int> darkBeams = { 0, 1 };
+  registration.processOrganized(organizedFrame(darkBeams), 0.1);
+  mismatches += registration.calibrated() ? 0 : 1;
+  const std::vector<std::vector<int> > ringBeams = registration.ringBeams();
+  for (int ring = 0; ring < 40; ring++) {
+    // ring r is beam r, i.e. row 39 - r, and the dark ones have no row
+    std::vector<int> expected;
+    if (ring > 1) {
+      expected.push_back(39 - ring);
+    }
+    if (ringBeams[ring] != expected && ++mismatches <= 5) {
+      std::printf("  mismatch: calibration, ring %d has %zu beams\n", ring, ringBeams[ring].size());
+    }
+  }
+
+  // later frames with all beams lit do not change it
+  registration.processOrganized(organizedFrame(std::vector<int>()), 0.2);
+  if (registration.ringBeams() != ringBeams && ++mismatches <= 5) {
+    std::printf("  mismatch: calibration changed on a later frame\n");
+  }
+
+  std::printf("%-8s mismatches %d\n", "calibration", mismatches);
+  return mismatches;
+}
+
+} // end anonymous namespace
+
+
+
+int main()
+{
+  const std::vector<float> tangents = testTangents();
+
+  int mismatches = 0;
+  mismatches += checkLookup("fixed", loam::MultiScanMapper(-16, 7, 40), tangents);
+  mismatches += checkLookup("P40", loam::MultiScanMapper::Hesai_P40(), tangents);
+  mismatches += checkTableAgainstFormula(tangents);
+  mismatches += checkCalibration();
+
+  std::printf(mismatches == 0 ? "passed\n" : "FAILED\n");
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,219 @@
+// Accuracy of loam::dominantEigen3() against a double precision SelfAdjointEigenSolver,
+// on covariances of 5 neighbors as built by LaserMapping::associateCorner().
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include <Eigen/Eigenvalues>
+
+#include "loam_velodyne/SymmetricEigen3.h"
+
+
+namespace {
+
+std::mt19937 rng(42);
+
+/** \brief Covariance of 5 points, accumulated in float like the mapping edge test. */
+Eigen::Matrix3f covariance(const Eigen::Vector3f points[5])
+{
+  Eigen::Vector3f mean = Eigen::Vector3f::Zero();
+  for (int j = 0; j < 5; j++) {
+    mean += points[j];
+  }
+  mean /= 5.0f;
+
+  Eigen::Matrix3f m = Eigen::Matrix3f::Zero();
+  for (int j = 0; j < 5; j++) {
+    Eigen::Vector3f a = points[j] - mean;
+    m += a * a.transpose();
+  }
+  return m / 5.0f;
+}
+
+Eigen::Vector3f uniformVector(const float& range)
+{
+  std::uniform_real_distribution<float> uniform(-range, range);
+  return Eigen::Vector3f(uniform(rng), uniform(rng), uniform(rng));
+}
+
+Eigen::Vector3f unitVector()
+{
+  Eigen::Vector3f v;
+  do {
+    v = uniformVector(1);
+  } while (v.squaredNorm() < 1e-2f || v.squaredNorm() > 1);
+  return v.normalized();
+}
+
+/** \brief 5 random points. */
+void randomPoints(Eigen::Vector3f points[5])
+{
+  Eigen::Vector3f offset = uniformVector(100);
+  for (int j = 0; j < 5; j++) {
+    points[j] = offset + uniformVector(1);
+  }
+}
+
+/** \brief 5 points along a line with some noise, as found on real edges. */
+void edgePoints(Eigen::Vector3f points[5])
+{
+  Eigen::Vector3f offset = uniformVector(100);
+  Eigen::Vector3f direction = unitVector();
+  std::uniform_real_distribution<float> along(-0.5f, 0.5f);
+  for (int j = 0; j < 5; j++) {
+    points[j] = offset + along(rng) * direction + uniformVector(0.02f);
+  }
+}
+
+/** \brief 5 exactly collinear points, so the middle and the smallest eigenvalue vanish. */
+void linePoints(Eigen::Vector3f points[5])
+{
+  Eigen::Vector3f direction = unitVector();
+  std::uniform_real_distribution<float> along(-0.5f, 0.5f);
+  for (int j = 0; j < 5; j++) {
+    points[j] = along(rng) * direction;
+  }
+}
+
+/** \brief 5 points at the same position, up to an occasional tiny noise. */
+void coincidentPoints(Eigen::Vector3f points[5])
+{
+  Eigen::Vector3f offset = uniformVector(100);
+  float noise = rng() % 2 ? 1e-5f : 0.0f;
+  for (int j = 0; j < 5; j++) {
+    points[j] = offset + uniformVector(noise);
+  }
+}
+
+/** \brief 2 and 3 points around two positions, a rank one covariance with noise. */
+void twoClusterPoints(Eigen::Vector3f points[5])
+{
+  Eigen::Vector3f first = uniformVector(100);
+  Eigen::Vector3f second = first + uniformVector(1);
+  for (int j = 0; j < 5; j++) {
+    points[j] = (j < 2 ? first : second) + uniformVector(1e-3f);
+  }
+}
+
+struct CaseStats {
+  double maxEigenvalueError;      ///< eigenvalue error relative to the largest eigenvalue
+  double maxDirectionError;       ///< sine of the angle to the reference eigenvector, times the relative gap
+  double maxResidual;             ///< |m d - lambdaMax d| relative to the largest eigenvalue
+  int decisionMismatches;         ///< edge test outcomes different from the reference
+  int failures;
+};
+
+/** \brief Compare against the reference on one matrix, update stats, return false on a failure. */
+bool check(const Eigen::Matrix3f& m, CaseStats& stats)
+{
+  float lambdaMax, lambdaMid;
+  Eigen::Vector3f direction;
+  loam::dominantEigen3(m, lambdaMax, lambdaMid, direction);
+
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(m.cast<double>());
+  const Eigen::Vector3d& values = solver.eigenvalues();          // ascending
+  Eigen::Vector3d reference = solver.eigenvectors().col(2);
+  double norm = std::max(std::fabs(values(2)), std::fabs(values(0)));
+
+  bool ok = std::isfinite(lambdaMax) && std::isfinite(lambdaMid) && direction.allFinite()
+            && std::fabs(direction.norm() - 1) < 1e-6f;
+
+  double eigenvalueError = 0;
+  double residual = 0;
+  if (norm > 0) {
+    eigenvalueError = std::max(std::fabs(lambdaMax - values(2)), std::fabs(lambdaMid - values(1))) / norm;
+    Eigen::Vector3d d = direction.cast<double>();
+    residual = (m.cast<double>() * d - double(lambdaMax) * d).norm() / norm;
+  } else {
+    ok = ok && lambdaMax == 0 && lambdaMid == 0;
+  }
+  ok = ok && eigenvalueError < 1e-6 && residual < 1e-5;
+
+  // the eigenvector is only defined up to the conditioning of the gap to the middle eigenvalue
+  double gap = norm > 0 ? (values(2) - values(1)) / norm : 0;
+  double directionError = 0;
+  if (gap > 1e-4) {
+    directionError = reference.cross(direction.cast<double>()).norm() * gap;
+    ok = ok && directionError < 1e-6;
+  }
+
+  // the edge test may only flip where the reference ratio is right at the threshold
+  bool edge = lambdaMax > 3 * lambdaMid;
+  bool referenceEdge = values(2) > 3 * values(1);
+  if (edge != referenceEdge) {
+    stats.decisionMismatches++;
+    ok = ok && std::fabs(values(2) - 3 * values(1)) < 1e-5 * norm;
+  }
+
+  stats.maxEigenvalueError = std::max(stats.maxEigenvalueError, eigenvalueError);
+  stats.maxDirectionError = std::max(stats.maxDirectionError, directionError);
+  stats.maxResidual = std::max(stats.maxResidual, residual);
+  if (!ok) {
+    stats.failures++;
+    if (stats.failures <= 5) {
+      std::printf("  mismatch: lambdaMax %g (%g), lambdaMid %g (%g), direction error %g, residual %g\n",
+                  lambdaMax, values(2), lambdaMid, values(1), directionError, residual);
+    }
+  }
+  return ok;
+}
+
+bool runCase(const char* name, void (*generate)(Eigen::Vector3f[5]), const int& count)
+{
+  CaseStats stats = {};
+  Eigen::Vector3f points[5];
+  for (int n = 0; n < count; n++) {
+    generate(points);
+    check(covariance(points), stats);
+  }
+
+  std::printf("%-12s max eigenvalue error %.2e, max direction error %.2e, max residual %.2e, "
+              "edge decisions flipped %d, failures %d / %d\n",
+              name, stats.maxEigenvalueError, stats.maxDirectionError, stats.maxResidual,
+              stats.decisionMismatches, stats.failures, count);
+  return stats.failures == 0;
+}
+
+bool runSpecialMatrices()
+{
+  CaseStats stats = {};
+  Eigen::Matrix3f m;
+
+  m.setZero();
+  check(m, stats);
+  m = 2.5f * Eigen::Matrix3f::Identity();
+  check(m, stats);
+  m = Eigen::Vector3f(3, 3, 1).asDiagonal();                  // repeated largest eigenvalue
+  check(m, stats);
+  m = Eigen::Vector3f(1e-30f, 0, 0).asDiagonal();             // underflowing squares
+  check(m, stats);
+  m = Eigen::Vector3f(1e30f, 1e29f, 0).asDiagonal();          // overflowing squares
+  check(m, stats);
+  m << 1, 1, 1,  1, 1, 1,  1, 1, 1;                           // rank one, off axis
+  check(m, stats);
+
+  std::printf("%-12s max eigenvalue error %.2e, max direction error %.2e, max residual %.2e, failures %d\n",
+              "special", stats.maxEigenvalueError, stats.maxDirectionError, stats.maxResidual, stats.failures);
+  return stats.failures == 0;
+}
+
+} // end anonymous namespace
+
+
+
+int main()
+{
+  const int count = 100000;
+  bool ok = true;
+  ok &= runCase("random", randomPoints, count);
+  ok &= runCase("edge", edgePoints, count);
+  ok &= runCase("line", linePoints, count);
+  ok &= runCase("coincident", coincidentPoints, count);
+  ok &= runCase("two-cluster", twoClusterPoints, count);
+  ok &= runSpecialMatrices();
+
+  std::printf(ok ? "passed\n" : "FAILED\n");
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,198 @@
+// loam::VoxelHashIndex against nanoflann::KdTreeFLANN: within the cell size both
+// must return the same neighbors, as LaserMapping only uses neighbors closer than that.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "loam_velodyne/VoxelHashIndex.h"
+#include "loam_velodyne/nanoflann_pcl.h"
+
+
+namespace {
+
+typedef pcl::PointXYZI PointT;
+typedef pcl::PointCloud<PointT> Cloud;
+typedef std::vector<PointT, Eigen::aligned_allocator<PointT> > PointList;
+
+std::mt19937 rng(42);
+std::uniform_real_distribution<float> uniform(0, 1);
+
+PointT makePoint(const float& x, const float& y, const float& z)
+{
+  PointT point;
+  point.x = x;
+  point.y = y;
+  point.z = z;
+  return point;
+}
+
+/** \brief A ground plane and some walls in one map cube, at the spacing of the down size filters. */
+Cloud::Ptr streetCloud(const float& spacing)
+{
+  Cloud::Ptr cloud(new Cloud());
+  for (float x = -25; x < 25; x += spacing) {
+    for (float z = -25; z < 25; z += spacing) {
+      if (uniform(rng) < 0.5f) {
+        cloud->push_back(makePoint(x + spacing * uniform(rng), -1.5f + 0.05f * uniform(rng), z + spacing * uniform(rng)));
+      }
+    }
+  }
+  for (int wall = 0; wall < 8; wall++) {
+    float x0 = 50 * uniform(rng) - 25, z0 = 50 * uniform(rng) - 25, angle = float(M_PI) * uniform(rng);
+    for (float t = 0; t < 20; t += spacing) {
+      for (float y = -1.5f; y < 4; y += spacing) {
+        cloud->push_back(makePoint(x0 + t * std::cos(angle), y, z0 + t * std::sin(angle)));
+      }
+    }
+  }
+  return cloud;
+}
+
+/** \brief Points on an integer lattice, so many of them lie exactly on cell faces, and many distances tie. */
+Cloud::Ptr latticeCloud()
+{
+  Cloud::Ptr cloud(new Cloud());
+  for (int x = -5; x <= 5; x++) {
+    for (int y = -5; y <= 5; y++) {
+      for (int z = -5; z <= 5; z++) {
+        cloud->push_back(makePoint(0.5f * x, 0.5f * y, 0.5f * z));
+      }
+    }
+  }
+  return cloud;
+}
+
+/** \brief Query points near the cloud, on cell faces, and far away from it. */
+PointList queriesFor(const Cloud& cloud, const size_t& count)
+{
+  PointList queries(count);
+  for (size_t i = 0; i < count; i++) {
+    PointT& query = queries[i];
+    if (i % 10 == 0) {
+      query = makePoint(300 * uniform(rng) - 150, 300 * uniform(rng) - 150, 300 * uniform(rng) - 150);
+    } else if (i % 10 == 1) {
+      query = makePoint(std::floor(20 * uniform(rng) - 10), std::floor(4 * uniform(rng) - 2), std::floor(20 * uniform(rng) - 10));
+    } else {
+      query = cloud.points[rng() % cloud.size()];
+      query.x += 1.2f * uniform(rng) - 0.6f;
+      query.y += 1.2f * uniform(rng) - 0.6f;
+      query.z += 1.2f * uniform(rng) - 0.6f;
+    }
+  }
+  return queries;
+}
+
+float squaredDistance(const PointT& a, const PointT& b)
+{
+  float dx = a.x - b.x;
+  float dy = a.y - b.y;
+  float dz = a.z - b.z;
+  return dx * dx + dy * dy + dz * dz;
+}
+
+/** \brief Compare the hash with the KD-tree on one cloud, returns the number of mismatching queries. */
+int compare(const char* name, const Cloud::Ptr& cloud, const float& cellSize, const int& k)
+{
+  nanoflann::KdTreeFLANN<PointT> kdtree;
+  kdtree.setInputCloud(cloud);
+  loam::VoxelHashIndex hash(cellSize);
+  hash.setInputCloud(cloud);
+
+  const PointList queries = queriesFor(*cloud, 5000);
+  std::vector<int> kdIndices(queries.size() * k), hashIndices(queries.size() * k);
+  std::vector<float> kdSqDistances(queries.size() * k), hashSqDistances(queries.size() * k);
+  kdtree.nearestKSearch(queries.data(), queries.size(), k, kdIndices.data(), kdSqDistances.data());
+  hash.nearestKSearch(queries.data(), queries.size(), k, hashIndices.data(), hashSqDistances.data());
+
+  const float maxSqDistance = cellSize * cellSize;
+  int mismatches = 0;
+  size_t neighbors = 0;
+  std::vector<int> indices;
+  std::vector<float> sqDistances;
+  for (size_t q = 0; q < queries.size(); q++) {
+    bool ok = true;
+    int within = 0;
+    for (int j = 0; j < k; j++) {
+      const size_t slot = q * k + j;
+      if (kdIndices[slot] >= 0 && kdSqDistances[slot] < maxSqDistance) {
+        // same distance, and a point at that distance, as ties may come in any order
+        within++;
+        ok = ok && hashIndices[slot] >= 0 && hashSqDistances[slot] == kdSqDistances[slot]
+                && squaredDistance(cloud->points[hashIndices[slot]], queries[q]) == hashSqDistances[slot];
+      } else {
+        ok = ok && hashIndices[slot] == -1 && hashSqDistances[slot] == std::numeric_limits<float>::max();
+      }
+    }
+    neighbors += within;
+
+    // the single query reports the neighbors it found
+    ok = ok && hash.nearestKSearch(queries[q], k, indices, sqDistances) == within
+            && std::equal(sqDistances.begin(), sqDistances.begin() + within, &hashSqDistances[q * k]);
+
+    if (!ok && ++mismatches <= 5) {
+      std::printf("  mismatch: %s, query %zu (%g %g %g)\n", name, q, queries[q].x, queries[q].y, queries[q].z);
+    }
+  }
+
+  std::printf("%-14s %6zu points, cell %.1f, k %d: %zu neighbors within the cell size, mismatches %d\n",
+              name, cloud->size(), cellSize, k, neighbors, mismatches);
+  return mismatches;
+}
+
+/** \brief Points that are not finite are left out of the index. */
+int testNonFinite()
+{
+  Cloud::Ptr cloud(new Cloud());
+  cloud->push_back(makePoint(0.1f, 0.1f, 0.1f));
+  cloud->push_back(makePoint(std::numeric_limits<float>::quiet_NaN(), 0.1f, 0.1f));
+  cloud->push_back(makePoint(0.2f, std::numeric_limits<float>::infinity(), 0.1f));
+  cloud->push_back(makePoint(1e20f, 0.1f, 0.1f));
+  cloud->push_back(makePoint(0.3f, 0.3f, 0.3f));
+
+  loam::VoxelHashIndex hash(1.0f);
+  hash.setInputCloud(cloud);
+  int indices[5];
+  float sqDistances[5];
+  PointT query = makePoint(0, 0, 0);
+  hash.nearestKSearch(&query, 1, 5, indices, sqDistances);
+
+  bool ok = indices[0] == 0 && indices[1] == 4 && indices[2] == -1 && indices[3] == -1 && indices[4] == -1;
+
+  // a query that is not finite finds nothing
+  PointT nanQuery = makePoint(std::numeric_limits<float>::quiet_NaN(), 0, 0);
+  hash.nearestKSearch(&nanQuery, 1, 5, indices, sqDistances);
+  ok = ok && indices[0] == -1;
+
+  // neither does an empty index
+  Cloud::Ptr empty(new Cloud());
+  hash.setInputCloud(empty);
+  hash.nearestKSearch(&query, 1, 5, indices, sqDistances);
+  ok = ok && indices[0] == -1;
+
+  std::printf("%-14s %s\n", "non-finite", ok ? "ok" : "mismatch");
+  return ok ? 0 : 1;
+}
+
+} // end anonymous namespace
+
+
+
+int main()
+{
+  int mismatches = 0;
+  mismatches += compare("corner map", streetCloud(0.2f), 1.0f, 5);
+  mismatches += compare("surface map", streetCloud(0.4f), 1.0f, 5);
+  mismatches += compare("surface map", streetCloud(0.4f), 1.0f, 1);
+  mismatches += compare("surface map", streetCloud(0.4f), 0.5f, 8);
+  mismatches += compare("lattice", latticeCloud(), 1.0f, 5);
+  mismatches += compare("lattice", latticeCloud(), 0.5f, 5);
+  mismatches += testNonFinite();
+
+  std::printf(mismatches == 0 ? "passed\n" : "FAILED\n");
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}